@@ -0,0 +1,58 @@
+#include "ai_budget.h"
+
+#include <algorithm>
+
+namespace checkers
+{
+	AiBudget::AiBudget(unsigned long long nodesPerSecond)
+	{
+		nodesPerSecond_ = nodesPerSecond;
+		available_ = (double)nodesPerSecond;
+		lastRefill_ = std::chrono::steady_clock::now();
+	}
+
+	void AiBudget::setNodesPerSecond(unsigned long long nodesPerSecond)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		nodesPerSecond_ = nodesPerSecond;
+		available_ = (double)nodesPerSecond;
+		lastRefill_ = std::chrono::steady_clock::now();
+	}
+
+	unsigned long long AiBudget::getNodesPerSecond()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return nodesPerSecond_;
+	}
+
+	void AiBudget::refill()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration_cast<std::chrono::microseconds>(now - lastRefill_).count() / 1000000.0;
+		lastRefill_ = now;
+
+		available_ = std::min<double>(available_ + seconds * nodesPerSecond_, (double)nodesPerSecond_);
+	}
+
+	unsigned long long AiBudget::reserve(unsigned long long wanted)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (nodesPerSecond_ == 0)
+			return wanted;
+
+		refill();
+		unsigned long long maxGrant = std::max<unsigned long long>(nodesPerSecond_ / kMaxGrantShare, 1);
+		unsigned long long granted = std::min<unsigned long long>(std::min(wanted, maxGrant), (unsigned long long)std::max<double>(available_, 0));
+		available_ -= (double)granted;
+		return granted;
+	}
+
+	void AiBudget::giveBack(unsigned long long unused)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (nodesPerSecond_ == 0)
+			return;
+
+		available_ = std::min<double>(available_ + unused, (double)nodesPerSecond_);
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+#ifndef AI_BUDGET_H
+#define AI_BUDGET_H
+
+#include <chrono>
+#include <mutex>
+
+namespace checkers
+{
+	// Caps how many positions all AI players sharing it may search per second. Unused allowance builds up for at most a second, so short bursts are absorbed but a sustained load is held to the rate.
+	// Thread safe
+	class AiBudget
+	{
+		static const unsigned long long kMaxGrantShare = 8; // No single reservation gets more than this fraction of a second's allowance, so a few deep searches can't take everything there is
+		std::mutex mutex_;
+		unsigned long long nodesPerSecond_;
+		double available_;
+		std::chrono::steady_clock::time_point lastRefill_;
+
+		// Adds the allowance earned since the last refill. Expects mutex_ to be held
+		void refill();
+	public:
+		// A rate of 0 doesn't limit anything
+		AiBudget(unsigned long long nodesPerSecond = 0);
+
+		void setNodesPerSecond(unsigned long long nodesPerSecond);
+		unsigned long long getNodesPerSecond();
+
+		// Takes up to the wanted number of nodes from what is available right now, but no more than a share of the rate. Returns how many were granted, which can be 0
+		unsigned long long reserve(unsigned long long wanted);
+		// Gives back nodes that were reserved but not searched
+		void giveBack(unsigned long long unused);
+	};
+}
+
+#endif // AI_BUDGET_H
@@ -1,16 +1,66 @@
 #include "ai_player.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include "move.h"
 #include "game.h"
+#include "metrics.h"
+#include "ai_budget.h"
+#include "ai_worker_pool.h"
+#include "transposition_table.h"
 
 namespace checkers
 {
+	const AiPlayer::LevelLimits AiPlayer::kLevelLimits[AiPlayer::kNumLevels] = {
+		// Depth, nodes, milliseconds. Up to level 4 the depth is what limits the search, past that each level buys a larger budget rather than a full extra move of lookahead, which would cost around five times as much each
+		{ 0, 100ULL, 50 },
+		{ 1, 1000ULL, 50 },
+		{ 2, 5000ULL, 100 },
+		{ 3, 20000ULL, 250 },
+		{ 4, 100000ULL, 500 },
+		{ 5, 200000ULL, 1000 },
+		{ 6, 400000ULL, 1500 },
+		{ 7, 600000ULL, 2000 },
+		{ 8, 800000ULL, 3000 },
+		{ 9, 1000000ULL, 4000 }
+	};
 	
 	AiPlayer::AiPlayer(int recurseLevels)
 	{
 		recurseLevels_ = recurseLevels;
+		currentHistoryIndex_ = 0;
+		for (int i = 0; i < kNumHistoryRemembered; i++)
+			historyRemembered_[i] = MoveHistory();
+		workerPool_ = nullptr;
+		priority_ = 0;
+		sharedBudget_ = nullptr;
+		sharedTable_ = nullptr;
+		tableProbes_ = 0;
+		tableHits_ = 0;
+		nodesSearched_ = 0;
+		nodeLimit_ = 0;
+		nodeAllowance_ = 0;
+		isOutOfBudget_ = false;
+		hasGameClock_ = false;
+		clockRemaining_ = 0;
+		clockIncrement_ = 0;
+	}
+
+	void AiPlayer::setSharedBudget(AiBudget * budget)
+	{
+		sharedBudget_ = budget;
+	}
+
+	void AiPlayer::setSharedTable(TranspositionTable * table)
+	{
+		sharedTable_ = table;
+	}
+
+	void AiPlayer::setWorkerPool(AiWorkerPool * workerPool, int priority)
+	{
+		workerPool_ = workerPool;
+		priority_ = priority;
 	}
 
 	double AiPlayer::evaluateBoardState(const Game * game) const
@@ -78,6 +128,14 @@ namespace checkers
 	{
 		Game * game = getGame();
 
+		// Looking any further ahead than this has to fit in the budget
+		nodesSearched_++;
+		if (recurseLevels > 0 && !isOutOfBudget_)
+		{
+			if (nodesSearched_ > nodeLimit_ || (nodesSearched_ % kClockCheckInterval == 0 && std::chrono::steady_clock::now() >= deadline_))
+				isOutOfBudget_ = true;
+		}
+
 		CheckerBoard simulatedBoard = CheckerBoard();
 		simulatedBoard.initialize(*game->checkerBoard_);
 
@@ -95,7 +153,7 @@ namespace checkers
 		if (winningMove)
 			score += (side == PieceSide::O) ? -100 : 100;
 
-		if (recurseLevels > 0 && !winningMove)
+		if (recurseLevels > 0 && !winningMove && !isOutOfBudget_)
 		{
 			// From this board state find all moves the opponent can make
 			
@@ -105,7 +163,26 @@ namespace checkers
 
 			PieceSide otherSide = (side == PieceSide::O) ? PieceSide::X : PieceSide::O;
 
-			findBestMove(moves, Game::kMoveArraySize, otherSide, boardScore, recurseLevels - 1, futureBestScore, futureWorstScore);
+			// How the opponent's replies play out only depends on the position, so it may already be known from another search
+			unsigned long long key = 0;
+			bool isKnown = false;
+			if (sharedTable_ != nullptr)
+			{
+				key = TranspositionTable::makeKey(simulatedBoard.zobristHash(), otherSide, recurseLevels - 1);
+				isKnown = sharedTable_->probe(key, futureBestScore, futureWorstScore);
+				tableProbes_++;
+				if (isKnown)
+					tableHits_++;
+			}
+
+			if (!isKnown)
+			{
+				findBestMove(moves, Game::kMoveArraySize, otherSide, boardScore, recurseLevels - 1, futureBestScore, futureWorstScore);
+
+				// A search cut short didn't see every reply
+				if (sharedTable_ != nullptr && !isOutOfBudget_)
+					sharedTable_->store(key, futureBestScore, futureWorstScore, recurseLevels - 1);
+			}
 
 			static double kUncertaintyPenalty = 0.95;
 			double predictScore = futureBestScore * kUncertaintyPenalty;
@@ -181,6 +258,9 @@ namespace checkers
 
 		for (int i = 0; i < numPossibleMoves; i++)
 		{
+			if (isOutOfBudget_)
+				break; // The search this is part of won't be used
+
 			if (useHistory && isMoveInHistory(moves[i + startIndex]))
 				continue; // Skip evaluating move if it's been made recently
 
@@ -218,11 +298,93 @@ namespace checkers
 
 	Move AiPlayer::requestMove()
 	{
+		if (workerPool_ == nullptr)
+			return searchMove();
+
+		// The game waits on this thread while a worker plays for it
+		Move move;
+		workerPool_->run([this, &move] { move = searchMove(); }, priority_);
+		return move;
+	}
+
+	void AiPlayer::requestMoveAsync(const MoveHandler & onMove)
+	{
+		if (workerPool_ == nullptr)
+		{
+			onMove(searchMove());
+			return;
+		}
+
+		workerPool_->post([this, onMove] {
+			Move move = searchMove();
+			onMove(move); // The game may be over and this player gone once the move is handed over
+		}, priority_);
+	}
+
+	void AiPlayer::reserveNodes()
+	{
+		unsigned long long wanted = nodeAllowance_ - std::min(nodesSearched_, nodeAllowance_);
+		nodeLimit_ = nodesSearched_ + ((sharedBudget_ != nullptr) ? sharedBudget_->reserve(wanted) : wanted);
+	}
+
+	void AiPlayer::returnUnusedNodes()
+	{
+		if (sharedBudget_ == nullptr || nodeLimit_ <= nodesSearched_)
+			return;
+
+		sharedBudget_->giveBack(nodeLimit_ - nodesSearched_);
+		nodeLimit_ = nodesSearched_;
+	}
+
+	Move AiPlayer::searchMove()
+	{
+		Stopwatch thinkTime;
+		const LevelLimits &limits = kLevelLimits[std::max(0, std::min(recurseLevels_, kNumLevels - 1))];
+
+		nodesSearched_ = 0;
+		nodeAllowance_ = limits.maxNodes;
+		nodeLimit_ = 0;
+		tableProbes_ = 0;
+		tableHits_ = 0;
+		if (sharedTable_ != nullptr)
+			sharedTable_->startSearch();
+
+		// On a game clock the search takes no more than its share of what is left, and never so much the clock runs out
+		unsigned int milliseconds = limits.maxMilliseconds;
+		if (hasGameClock_)
+		{
+			unsigned int share = clockRemaining_ / kGameClockMovesToGo + clockIncrement_;
+			unsigned int safe = (clockRemaining_ > kGameClockMarginMilliseconds) ? clockRemaining_ - kGameClockMarginMilliseconds : 0;
+			milliseconds = std::min(milliseconds, std::min(share, safe));
+		}
+		deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+
 		Move moves[Game::kMoveArraySize];
 		double score = 0;
 		double worstScore = 0;
 		double boardScore = evaluateBoardState(getGame());
- 		Move move = *findBestMove(moves, Game::kMoveArraySize, getControllingSide(), boardScore, recurseLevels_, score, worstScore, true);
+
+		// Looking at the immediate moves is always allowed so there is a move to make whatever the budget. Each deeper search replaces it only if it finishes
+		Move move;
+		for (int depth = 0; depth <= limits.maxDepth; depth++)
+		{
+			// Nodes are taken from a shared budget one depth at a time, and what that depth didn't use goes straight back, so a deep search only ever holds a little of what other games' searches are waiting on
+			reserveNodes();
+			isOutOfBudget_ = false;
+			Move *best = findBestMove(moves, Game::kMoveArraySize, getControllingSide(), boardScore, depth, score, worstScore, true);
+			returnUnusedNodes();
+			if (isOutOfBudget_)
+			{
+				ServerMetrics::get().aiSearchesCut++;
+				break;
+			}
+			move = *best;
+		}
+
+		ServerMetrics::get().aiNodesSearched += nodesSearched_;
+		ServerMetrics::get().aiTableProbes += tableProbes_;
+		ServerMetrics::get().aiTableHits += tableHits_;
+		ServerMetrics::get().recordAiThinkTime(recurseLevels_, thinkTime.elapsedMicroseconds());
 
 		// If this was an adjacent move, add it to the history
 		if (move.getNumCoords() == 2)
@@ -251,4 +413,11 @@ namespace checkers
 		message;
 		// Do nothing
 	}
+
+	void AiPlayer::setClock(unsigned int remaining, unsigned int increment)
+	{
+		hasGameClock_ = true;
+		clockRemaining_ = remaining;
+		clockIncrement_ = increment;
+	}
 }
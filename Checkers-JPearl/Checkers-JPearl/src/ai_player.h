@@ -2,12 +2,17 @@
 #ifndef AI_PLAYER_H
 #define AI_PLAYER_H
 
+#include <chrono>
+
 #include "checker_board.h"
 #include "player.h"
 namespace checkers
 {
 	class Game;
 	class CheckerBoard;
+	class AiWorkerPool;
+	class AiBudget;
+	class TranspositionTable;
 
 	struct MoveHistory
 	{
@@ -17,27 +22,76 @@ namespace checkers
 	
 	class AiPlayer : public Player
 	{
+	public:
+		static const int kNumLevels = 10;
+
+		// Most a difficulty level may spend finding one move. Searches deepen one move at a time up to the depth, and the deepest that finished within the node and time budgets is played
+		struct LevelLimits
+		{
+			int maxDepth;
+			unsigned long long maxNodes; // Positions evaluated, across every depth searched
+			unsigned int maxMilliseconds;
+		};
+		static const LevelLimits kLevelLimits[kNumLevels];
+	private:
 		static const int kNumHistoryRemembered = 32;
+		static const unsigned long long kClockCheckInterval = 256; // Positions evaluated between checks of the time budget
+		static const unsigned int kGameClockMovesToGo = 20; // Moves the time left on a game clock is spread over
+		static const unsigned int kGameClockMarginMilliseconds = 250; // Left on the game clock for the move to make it back to the game
 
 		int recurseLevels_;
 		int currentHistoryIndex_;
 		MoveHistory historyRemembered_[kNumHistoryRemembered];
 
+		AiWorkerPool *workerPool_;
+		int priority_;
+		AiBudget *sharedBudget_;
+		TranspositionTable *sharedTable_;
+
+		// Game clock, if the game has one. Searches are cut to a share of what is left on it
+		bool hasGameClock_;
+		unsigned int clockRemaining_;
+		unsigned int clockIncrement_;
+
+		// State of the search in progress
+		mutable unsigned long long nodesSearched_;
+		mutable unsigned long long nodeLimit_; // Nodes the search may have evaluated by the end of the depth being searched
+		mutable unsigned long long nodeAllowance_; // Most nodes the level allows the search, however much budget is available
+		mutable std::chrono::steady_clock::time_point deadline_;
+		mutable bool isOutOfBudget_;
+		mutable unsigned long long tableProbes_;
+		mutable unsigned long long tableHits_;
 
 		// Evaluates the value of a given board state. Negative in favor of O and positive in favor of X
 		double evaluateBoardState(const Game * game) const;
 		// Evaluates the value of a given move and how the game could play from that point on. Negative in favor of O and positive in favor of X
 		double evaluateMove(const Move& move, PieceSide side, double previousBoardScore, int recurseLevels, double &intrinsicScore) const;
+		// Sets the node limit for searching the next depth, taking what it can of the rest of the level's allowance from the shared budget
+		void reserveNodes();
+		// Gives back nodes taken from the shared budget for the depth just searched but not used
+		void returnUnusedNodes();
 		// Returns whether the given move has already been made recently
 		bool isMoveInHistory(const Move& move) const;
 		// Finds the best move in terms of possible value from all available moves. Returns the move most in favor of the given side and its score in the outBestScore parameter. Also keeps track of worst score
 		Move* findBestMove(Move *moves, int capacity, PieceSide side, double currentBoardScore, int recurseLevels, double& outBestScore, double& outWorstScore, bool useHistory = false ) const;
+		// Searches for the move to make this turn and remembers it
+		Move searchMove();
 	public:
 		AiPlayer(int recurseLevels);
 
+		// Runs searches on the pool at the given priority (0 being the highest) instead of the game's thread
+		void setWorkerPool(AiWorkerPool *workerPool, int priority);
+		// Draws the nodes each search may use from a budget shared with other players. Searches settle for a shallower move when it runs low
+		void setSharedBudget(AiBudget *budget);
+		// Looks up and stores the outcomes of searched positions in a table that may be shared with other players
+		void setSharedTable(TranspositionTable *table);
+
 		const char * getDescriptor() const override;
 		Move requestMove() override;
+		// Searches on the worker pool when there is one, handing the move over from the worker
+		void requestMoveAsync(const MoveHandler &onMove) override;
 		void sendMessage(const char * message) const override;
+		void setClock(unsigned int remaining, unsigned int increment) override;
 	};
 }
 
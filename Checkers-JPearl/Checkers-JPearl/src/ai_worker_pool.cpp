@@ -0,0 +1,125 @@
+#include "ai_worker_pool.h"
+
+#include <algorithm>
+
+#include "metrics.h"
+
+namespace checkers
+{
+	bool AiWorkerPool::RunsLater::operator()(const Task * a, const Task * b) const
+	{
+		if (a->dueAt != b->dueAt)
+			return a->dueAt > b->dueAt;
+		return a->sequence > b->sequence;
+	}
+
+	AiWorkerPool::AiWorkerPool()
+	{
+		isRunning_ = false;
+		nextSequence_ = 0;
+	}
+
+	AiWorkerPool::~AiWorkerPool()
+	{
+		stop();
+	}
+
+	bool AiWorkerPool::start(int numWorkers)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (isRunning_)
+			return false;
+
+		if (numWorkers <= 0)
+			numWorkers = (int)std::max(1u, std::thread::hardware_concurrency());
+
+		isRunning_ = true;
+		for (int i = 0; i < numWorkers; i++)
+			workers_.push_back(std::thread([this] { runWorker(); }));
+		return true;
+	}
+
+	void AiWorkerPool::stop()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!isRunning_)
+			return;
+		isRunning_ = false;
+		lock.unlock();
+
+		taskQueued_.notify_all();
+		for (unsigned int i = 0; i < workers_.size(); i++)
+			workers_[i].join();
+		workers_.clear();
+	}
+
+	void AiWorkerPool::runWorker()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			taskQueued_.wait(lock, [this] { return !queue_.empty() || !isRunning_; });
+			if (queue_.empty())
+				return; // Stopped with nothing left to run
+
+			Task *task = queue_.top();
+			queue_.pop();
+			lock.unlock();
+
+			ServerMetrics::get().aiQueueWait.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - task->queuedAt).count());
+			task->work();
+			delete task;
+
+			lock.lock();
+		}
+	}
+
+	void AiWorkerPool::post(const std::function<void()> &work, int priority)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!isRunning_)
+		{
+			lock.unlock();
+			work();
+			return;
+		}
+
+		Task *task = new Task();
+		task->work = work;
+		task->queuedAt = std::chrono::steady_clock::now();
+		task->dueAt = task->queuedAt + std::chrono::milliseconds(priority * kPriorityStepMilliseconds);
+		task->sequence = nextSequence_++;
+
+		queue_.push(task);
+		taskQueued_.notify_one();
+	}
+
+	void AiWorkerPool::run(const std::function<void()> &work, int priority)
+	{
+		std::mutex doneMutex;
+		std::condition_variable doneChanged;
+		bool isDone = false;
+
+		post([&] {
+			work();
+			std::lock_guard<std::mutex> lock(doneMutex);
+			isDone = true;
+			doneChanged.notify_all();
+		}, priority);
+
+		std::unique_lock<std::mutex> lock(doneMutex);
+		doneChanged.wait(lock, [&isDone] { return isDone; });
+	}
+
+	int AiWorkerPool::getQueueDepth()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return (int)queue_.size();
+	}
+
+	int AiWorkerPool::getNumWorkers()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return (int)workers_.size();
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef AI_WORKER_POOL_H
+#define AI_WORKER_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace checkers
+{
+	// A fixed set of threads that AI searches run on, so that however many AI games are going the CPU is never asked to search more than it has cores for.
+	// Waiting searches are run in order of when they are due: a search is due as soon as it is queued plus a delay for its priority. Higher priorities (lower numbers) go first, but a search is never passed by anything queued more than its delay after it
+	class AiWorkerPool
+	{
+		static const int kPriorityStepMilliseconds = 50; // How much later a search is due for each step down in priority
+
+		struct Task
+		{
+			std::function<void()> work;
+			std::chrono::steady_clock::time_point dueAt;
+			unsigned long long sequence; // Keeps searches due at the same time in the order they were queued
+			std::chrono::steady_clock::time_point queuedAt;
+		};
+
+		struct RunsLater
+		{
+			bool operator()(const Task *a, const Task *b) const;
+		};
+
+		bool isRunning_;
+		std::vector<std::thread> workers_;
+		std::mutex mutex_;
+		std::condition_variable taskQueued_;
+		std::priority_queue<Task*, std::vector<Task*>, RunsLater> queue_;
+		unsigned long long nextSequence_;
+
+		void runWorker();
+	public:
+		AiWorkerPool();
+		~AiWorkerPool();
+
+		// Starts the given number of workers, or one per core when 0. Returns false if already started
+		bool start(int numWorkers);
+		// Runs everything still queued, then stops the workers
+		void stop();
+
+		// Queues the work for a worker and returns without waiting for it. Priority 0 is the highest. Work is run on the calling thread when the pool isn't started
+		void post(const std::function<void()> &work, int priority);
+		// Same as post() but waits for the work to finish
+		void run(const std::function<void()> &work, int priority);
+
+		// Number of searches waiting for a worker
+		int getQueueDepth();
+		int getNumWorkers();
+	};
+}
+
+#endif // AI_WORKER_POOL_H
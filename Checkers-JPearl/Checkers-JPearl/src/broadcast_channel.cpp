@@ -0,0 +1,85 @@
+#include "broadcast_channel.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace checkers
+{
+	BroadcastChannel::BroadcastChannel()
+	{
+		isClosed_ = false;
+		result_ = -1;
+	}
+
+	bool BroadcastChannel::subscribe(Connection * connection)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (isClosed_)
+			return false;
+
+		subscribers_.push_back(connection);
+		return true;
+	}
+
+	void BroadcastChannel::unsubscribe(Connection * connection)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		subscribers_.erase(std::remove(subscribers_.begin(), subscribers_.end(), connection), subscribers_.end());
+	}
+
+	int BroadcastChannel::getNumSubscribers()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return (int)subscribers_.size();
+	}
+
+	void BroadcastChannel::publish(MessageType type, const char * data, unsigned int length)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (subscribers_.empty())
+			return; // Don't bother encoding for nobody
+
+		SharedFrame frame = Connection::encodeFrame(type, data, length);
+		if (!frame)
+			return;
+
+		for (unsigned int i = 0; i < subscribers_.size();)
+		{
+			Connection *subscriber = subscribers_[i];
+			if (!subscriber->sendFrame(frame) || subscriber->getNumSkippedFrames() > kMaxSkippedFrames)
+			{
+				// Failed or too far behind to be worth keeping up with
+				subscriber->disconnect(false);
+				subscribers_[i] = subscribers_.back();
+				subscribers_.pop_back();
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	void BroadcastChannel::close(int result)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			isClosed_ = true;
+			result_ = result;
+			subscribers_.clear();
+		}
+		closed_.notify_all();
+	}
+
+	bool BroadcastChannel::waitUntilClosed(unsigned int timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		return closed_.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return isClosed_; });
+	}
+
+	int BroadcastChannel::getResult()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return result_;
+	}
+}
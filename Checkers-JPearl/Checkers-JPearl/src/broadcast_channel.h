@@ -0,0 +1,47 @@
+#pragma once
+#ifndef BROADCAST_CHANNEL_H
+#define BROADCAST_CHANNEL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "connection.h"
+
+namespace checkers
+{
+	// Fans out updates to any number of subscribed connections. Each update is encoded once and the same frame is shared by every subscriber.
+	// Sending never blocks the publisher: subscribers that can't keep up have updates skipped, and are dropped once they fall too far behind
+	class BroadcastChannel
+	{
+		static const unsigned int kMaxSkippedFrames = 16; // Updates a subscriber may miss in a row before it is dropped
+
+		std::mutex mutex_;
+		std::condition_variable closed_;
+		std::vector<Connection*> subscribers_;
+		bool isClosed_;
+		int result_;
+	public:
+		BroadcastChannel();
+
+		// Adds a connection to receive updates. Returns false if the channel is already closed
+		bool subscribe(Connection *connection);
+		void unsubscribe(Connection *connection);
+
+		int getNumSubscribers();
+
+		// Encodes the message once and sends it to every subscriber
+		void publish(MessageType type, const char * data, unsigned int length);
+
+		// Stops the channel and records the outcome for subscribers. Wakes everyone waiting in waitUntilClosed()
+		void close(int result);
+
+		// Waits up to timeout (in milliseconds) for the channel to close. Returns whether it is closed
+		bool waitUntilClosed(unsigned int timeout);
+
+		// The result given to close()
+		int getResult();
+	};
+}
+
+#endif // BROADCAST_CHANNEL_H
@@ -219,6 +219,85 @@ namespace checkers
 	}
 
 
+	void CheckerBoard::writeSnapshot(char * outData) const
+	{
+		for (int i = 0; i < kNumCells; i++)
+		{
+			CheckerPiece *piece = board_[i];
+			outData[i] = (piece == nullptr) ? 0 : (char)(1 + (piece->getSide() & 1) + (piece->getIsKing() ? 2 : 0));
+		}
+	}
+
+	bool CheckerBoard::readSnapshot(const char * data)
+	{
+		int numPieces = 0;
+		for (int i = 0; i < kNumCells; i++)
+		{
+			if (data[i] < 0 || data[i] > 4)
+				return false;
+			if (data[i] != 0)
+				numPieces++;
+		}
+		if (numPieces > kNumPieces)
+			return false;
+
+		// Pieces are handed out in order, which piece sits where doesn't matter to the game
+		int nextPiece = 0;
+		pieceCount_[0] = 0;
+		pieceCount_[1] = 0;
+		for (int i = 0; i < kNumCells; i++)
+		{
+			if (data[i] == 0)
+			{
+				board_[i] = nullptr;
+				continue;
+			}
+
+			CheckerPiece *piece = pieces_ + nextPiece++;
+			piece->setSide((PieceSide)((data[i] - 1) & 1));
+			piece->setIsKing(data[i] > 2);
+			piece->setMark(0);
+			board_[i] = piece;
+			pieceCount_[piece->getSide()]++;
+		}
+		return true;
+	}
+
+	// Random keys for every kind of piece (side, and whether it is a king) on every square
+	struct ZobristKeys
+	{
+		uint_least64_t values[CheckerBoard::kNumCells][4];
+
+		ZobristKeys()
+		{
+			// SplitMix64, seeded the same every run so hashes are stable
+			uint_least64_t state = 0;
+			for (int cell = 0; cell < CheckerBoard::kNumCells; cell++)
+			{
+				for (int kind = 0; kind < 4; kind++)
+				{
+					uint_least64_t z = (state += 0x9E3779B97F4A7C15ULL);
+					z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+					z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+					values[cell][kind] = z ^ (z >> 31);
+				}
+			}
+		}
+	};
+	static const ZobristKeys kZobristKeys;
+
+	uint_least64_t CheckerBoard::zobristHash() const
+	{
+		uint_least64_t result = 0;
+		for (int i = 0; i < kNumCells; i++)
+		{
+			CheckerPiece *piece = board_[i];
+			if (piece != nullptr)
+				result ^= kZobristKeys.values[i][(piece->getSide() & 1) * 2 + (piece->getIsKing() ? 1 : 0)];
+		}
+		return result;
+	}
+
 	std::ostream & operator<<(std::ostream & stream, const CheckerBoard & board)
 	{
 		for (int y = CheckerBoard::kNumRows; y >= -1; y--)
@@ -24,6 +24,7 @@ namespace checkers
 		static const int kNumPiecesPerPlayer = kNumRowsPerPlayer * kNumActualColumns;
 		static const int kNumPieces = kNumSides * kNumPiecesPerPlayer;
 		static const int kNumCells = kNumRows * kNumActualColumns;
+		static const int kSnapshotSize = kNumCells; // Bytes written by writeSnapshot()
 
 	private:
 		CheckerPiece* pieces_;
@@ -62,6 +63,14 @@ namespace checkers
 		// Returns the current board state represented in binary -- useful for hashing. If board state cannot fully be represented in uint_least64_t returns 0
 		uint_least64_t currentBoardState() const;
 
+		// Writes a byte for every square: 0 if it's empty, otherwise 1 plus the piece's side plus 2 if it's a king
+		void writeSnapshot(char * outData) const;
+		// Sets the board up as written by writeSnapshot(). Returns false, leaving the board as it was, if the data isn't a board this one can hold
+		bool readSnapshot(const char * data);
+
+		// Returns a Zobrist hash of which piece (side and whether it's a king) is on every square. Unlike currentBoardState() it works for any board, but different boards can share a hash
+		uint_least64_t zobristHash() const;
+
 		// Inserts a textual representation of the board and its pieces into a stream
 		friend std::ostream& operator<< (std::ostream& stream, const CheckerBoard& board);
 	};
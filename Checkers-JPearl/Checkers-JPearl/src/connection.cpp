@@ -1,4 +1,6 @@
 #include "connection.h"
+#include "timer_wheel.h"
+#include "uring_reactor.h"
 
 #ifdef _WIN32
     #define _CRT_SECURE_NO_WARNINGS
@@ -10,16 +12,28 @@
 	#include <string.h>
 	#include <sys/types.h>
 	#include <sys/socket.h>
+	#include <sys/un.h>
 	#include <netinet/in.h>
 	#include <netinet/ip.h>
+	#include <netinet/tcp.h>
 	#include <arpa/inet.h>
 	#include <netdb.h>
 	#include <unistd.h> 
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sys/uio.h>
+	#include <poll.h>
+	#include <signal.h>
+	#include <pthread.h>
 #endif
 
+#include <algorithm>
+#include <cstring>
 #include <thread>
 #include <iostream>
 #include <chrono>
+#include <mutex>
+#include <vector>
 
 // Using WinSock interface, some defines here to keep things clean below
 #ifdef _WIN32
@@ -37,15 +51,22 @@
 	#define SOCKET int // Sockets are just file descriptors in BSD
 	#define SOCKADDR sockaddr
 	#define WSAECONNRESET ECONNRESET
+	#define WSAEWOULDBLOCK EWOULDBLOCK
+	#define WSAEADDRINUSE EADDRINUSE
+	#define WSAGetLastError() errno
+	#define MSG_NOSIGNAL_IF_AVAILABLE MSG_NOSIGNAL
 	
 #endif
+#ifdef _WIN32
+	#define MSG_NOSIGNAL_IF_AVAILABLE 0
+#endif
 
 #ifdef DEBUG
 	#define verboseInfo(message) std::cout << "\n" << message << std::endl;
 	#ifdef _WIN32
-		#define setLastError( message ) { lastError_ = WSAGetLastError(); Connection::connectionErrorMessage_ = message; }
+		#define setLastError( message ) { Connection::lastError_ = WSAGetLastError(); Connection::connectionErrorMessage_ = message; }
 	#else // _WIN32
-		#define setLastError( message ) { lastError_ = errno; Connection::connectionErrorMessage_ = message; }
+		#define setLastError( message ) { Connection::lastError_ = errno; Connection::connectionErrorMessage_ = message; }
 	#endif // _WIN32
 #else // DEBUG
 	#define verboseInfo(message)
@@ -57,7 +78,332 @@
 
 namespace checkers
 {
+	// Small frames are batched by the connection itself so Nagle's algorithm would only add delay
+	static bool disableNagle(SOCKET sock)
+	{
+		int noDelay = 1;
+		return setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&noDelay, sizeof noDelay) != SOCKET_ERROR;
+	}
+
+	// Switches a socket between blocking and non-blocking mode. Returns whether it was successful
+	static bool setBlocking(SOCKET sock, bool isBlocking)
+	{
+#ifdef _WIN32
+		u_long mode = isBlocking ? BLOCKING : NONBLOCKING;
+		return ioctlsocket(sock, FIONBIO, &mode) != SOCKET_ERROR;
+#else
+		int flags = fcntl(sock, F_GETFL, 0);
+		if (flags == -1)
+			return false;
+		flags = isBlocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+		return fcntl(sock, F_SETFL, flags) != -1;
+#endif
+	}
+
+	// Milliseconds left until the deadline, 0 if it has passed
+	static unsigned int millisecondsUntil(std::chrono::steady_clock::time_point deadline)
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+			return 0;
+		return (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+	}
+
+	// Milliseconds on the steady clock, for times kept in atomics
+	static long long nowMilliseconds()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Waits until the socket is ready to be read from (or written to) or timeout (in milliseconds) passes. Also stops waiting if wakeSocket becomes readable. Returns whether sock is ready.
+	// Uses poll rather than select, which can't wait on sockets numbered FD_SETSIZE or higher
+	static bool waitForSocket(SOCKET sock, bool forWrite, unsigned int timeout, SOCKET wakeSocket = INVALID_SOCKET)
+	{
+#ifdef _WIN32
+		WSAPOLLFD sockets[2];
+#else
+		struct pollfd sockets[2];
+#endif
+		sockets[0].fd = sock;
+		sockets[0].events = forWrite ? POLLOUT : POLLIN;
+		sockets[0].revents = 0;
+		sockets[1].fd = wakeSocket;
+		sockets[1].events = POLLIN;
+		sockets[1].revents = 0;
+		unsigned int numSockets = (wakeSocket != INVALID_SOCKET) ? 2 : 1;
+
+#ifdef _WIN32
+		int result = WSAPoll(sockets, numSockets, (INT)timeout);
+#else
+		int result = poll(sockets, numSockets, (int)timeout);
+#endif
+		if (result == SOCKET_ERROR || result == 0)
+			return false;
+
+		// Errors count as ready too, eg. a failed connect, whatever is done with the socket next reports them
+		return (sockets[0].revents & (sockets[0].events | POLLERR | POLLHUP)) != 0;
+	}
+
+	// Sends what the socket will take right away. Returns the number of bytes sent, 0 if it would have blocked, or SOCKET_ERROR
+	static int sendWithoutBlocking(SOCKET sock, const char * data, unsigned int length)
+	{
+#ifdef _WIN32
+		// Winsock has no per-call non-blocking flag, so only send once the socket reports room for more
+		if (!waitForSocket(sock, true, 0))
+			return 0;
+		return send(sock, data, length, 0);
+#else
+		int result = send(sock, data, length, MSG_DONTWAIT | MSG_NOSIGNAL_IF_AVAILABLE);
+		if (result == SOCKET_ERROR && (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR))
+			return 0;
+		return result;
+#endif
+	}
+
+	// Sends what the socket will take right away of all given buffers in order with one gathered send. Returns the number of bytes sent, 0 if it would have blocked, or SOCKET_ERROR
+	static int sendGatheredWithoutBlocking(SOCKET sock, const char * const * buffers, const unsigned int * lengths, int count)
+	{
+		static const int kMaxBuffers = 4;
+		if (count > kMaxBuffers)
+			return SOCKET_ERROR;
+
+#ifdef _WIN32
+		// Same as sendWithoutBlocking, only send once the socket reports room for more
+		if (!waitForSocket(sock, true, 0))
+			return 0;
+
+		WSABUF vectors[kMaxBuffers];
+		for (int i = 0; i < count; i++)
+		{
+			vectors[i].buf = const_cast<char*>(buffers[i]);
+			vectors[i].len = lengths[i];
+		}
+
+		DWORD bytesSent = 0;
+		if (WSASend(sock, vectors, count, &bytesSent, 0, NULL, NULL) == SOCKET_ERROR)
+			return SOCKET_ERROR;
+		return (int)bytesSent;
+#else
+		struct iovec vectors[kMaxBuffers];
+		for (int i = 0; i < count; i++)
+		{
+			vectors[i].iov_base = const_cast<char*>(buffers[i]);
+			vectors[i].iov_len = lengths[i];
+		}
+
+		struct msghdr header;
+		memset(&header, 0, sizeof header);
+		header.msg_iov = vectors;
+		header.msg_iovlen = count;
+
+		ssize_t written;
+		do
+		{
+			written = sendmsg(sock, &header, MSG_DONTWAIT | MSG_NOSIGNAL_IF_AVAILABLE);
+		} while (written == SOCKET_ERROR && errno == EINTR);
+
+		if (written == SOCKET_ERROR)
+			return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : SOCKET_ERROR;
+		return (int)written;
+#endif
+	}
+
+	// Writes out all given buffers in order with one gathered send, picking up where a partial write left off. Returns whether everything was written
+	static bool sendGathered(SOCKET sock, const char * const * buffers, const unsigned int * lengths, int count)
+	{
+		static const int kMaxBuffers = 4;
+		if (count > kMaxBuffers)
+			return false;
+
+#ifdef _WIN32
+		WSABUF vectors[kMaxBuffers];
+		for (int i = 0; i < count; i++)
+		{
+			vectors[i].buf = const_cast<char*>(buffers[i]);
+			vectors[i].len = lengths[i];
+		}
+
+		// On a blocking socket WSASend only completes once every buffer has been sent
+		DWORD bytesSent = 0;
+		return WSASend(sock, vectors, count, &bytesSent, 0, NULL, NULL) != SOCKET_ERROR;
+#else
+		struct iovec vectors[kMaxBuffers];
+		for (int i = 0; i < count; i++)
+		{
+			vectors[i].iov_base = const_cast<char*>(buffers[i]);
+			vectors[i].iov_len = lengths[i];
+		}
+
+		int index = 0;
+		while (index < count)
+		{
+			struct msghdr header;
+			memset(&header, 0, sizeof header);
+			header.msg_iov = vectors + index;
+			header.msg_iovlen = count - index;
+
+			// Same as writev but able to suppress SIGPIPE on a peer that has gone away
+			ssize_t written = sendmsg(sock, &header, MSG_NOSIGNAL_IF_AVAILABLE);
+			if (written == SOCKET_ERROR)
+			{
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+
+			while (index < count && (size_t)written >= vectors[index].iov_len)
+			{
+				written -= vectors[index].iov_len;
+				index++;
+			}
+			if (index < count)
+			{
+				vectors[index].iov_base = reinterpret_cast<char*>(vectors[index].iov_base) + written;
+				vectors[index].iov_len -= written;
+			}
+		}
+		return true;
+#endif
+	}
+
+	// Receives exactly length bytes, carrying on after a signal unless stopOnSignal is set and nothing has arrived yet. Returns the number of bytes received, less than length if the other end closed, or SOCKET_ERROR
+	static int receiveAll(SOCKET sock, char * buffer, int length, bool stopOnSignal)
+	{
+		int received = 0;
+		while (received < length)
+		{
+			int result = recv(sock, buffer + received, length - received, MSG_WAITALL);
+			if (result == SOCKET_ERROR)
+			{
+#ifndef _WIN32
+				// Part of a frame is already in, so the rest is right behind it
+				if (errno == EINTR && (received > 0 || !stopOnSignal))
+					continue;
+#endif
+				return SOCKET_ERROR;
+			}
+			if (result == 0)
+				break;
+			received += result;
+		}
+		return received;
+	}
+
+	// Buffers for frames waiting to be sent. They come back once nothing shares the frame anymore and are reused, so queueing a frame doesn't allocate its bytes once there are enough to go around
+	struct FramePool
+	{
+		static const size_t kMaxBuffers = 4096;
+		static const size_t kMaxBufferCapacity = 4 * 1024; // Larger ones, eg. a whole corked batch, are freed rather than kept
+
+		std::mutex mutex;
+		std::vector<std::string*> buffers;
+
+		// Never destroyed, frames may still be handed back while the process exits
+		static FramePool& get()
+		{
+			static FramePool *pool = new FramePool();
+			return *pool;
+		}
+
+		// An empty buffer with room for at least capacity bytes
+		std::string * take(size_t capacity)
+		{
+			std::string *buffer = nullptr;
+			mutex.lock();
+			if (!buffers.empty())
+			{
+				buffer = buffers.back();
+				buffers.pop_back();
+			}
+			mutex.unlock();
+
+			if (buffer == nullptr)
+				buffer = new std::string();
+			buffer->reserve(capacity);
+			return buffer;
+		}
+
+		static void giveBack(const std::string * frame)
+		{
+			std::string *buffer = const_cast<std::string*>(frame);
+			FramePool &pool = get();
+			if (buffer->capacity() <= kMaxBufferCapacity)
+			{
+				buffer->clear();
+				std::lock_guard<std::mutex> lock(pool.mutex);
+				if (pool.buffers.size() < kMaxBuffers)
+				{
+					pool.buffers.push_back(buffer);
+					return;
+				}
+			}
+			delete buffer;
+		}
+
+		// Shares a buffer taken from the pool as a frame, which hands it back once it is done with
+		static SharedFrame share(std::string * buffer)
+		{
+			return SharedFrame(buffer, giveBack);
+		}
+	};
+
+	static const char kUnixAddressPrefix[] = "unix:";
+	static const size_t kUnixAddressPrefixLength = sizeof kUnixAddressPrefix - 1;
+
+#ifndef _WIN32
+	// Fills in the address of the socket file at path. Returns false if the path doesn't fit
+	static bool makeUnixAddress(const char * path, sockaddr_un &outAddress)
+	{
+		memset(&outAddress, 0, sizeof outAddress);
+		outAddress.sun_family = AF_UNIX;
+		if (*path == '\0' || strlen(path) >= sizeof outAddress.sun_path)
+			return false;
+		strcpy(outAddress.sun_path, path);
+		return true;
+	}
+
+	// Whether something is still accepting connections on the socket file, as opposed to it being left behind by a listener that is gone
+	static bool isUnixAddressInUse(const sockaddr_un &address)
+	{
+		SOCKET sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock == INVALID_SOCKET)
+			return true;
+
+		// Non-blocking so a listener with a full backlog counts as in use rather than holding us up
+		bool isInUse = true;
+		if (setBlocking(sock, false) && connect(sock, (const SOCKADDR*)&address, sizeof address) == SOCKET_ERROR)
+			isInUse = errno != ECONNREFUSED && errno != ENOENT;
+		closesocket(sock);
+		return isInUse;
+	}
+
+	// Sent to a receiving thread to cut its wait on the socket short
+	static const int kInterruptSignal = SIGUSR1;
+
+	// Does nothing, it is only there so the signal interrupts a blocking receive rather than ending the process
+	static void onInterruptSignal(int)
+	{
+	}
+
+	static void installInterruptHandler()
+	{
+		static std::once_flag installed;
+		std::call_once(installed, []
+		{
+			struct sigaction action;
+			memset(&action, 0, sizeof action);
+			action.sa_handler = onInterruptSignal;
+			sigemptyset(&action.sa_mask);
+			action.sa_flags = 0; // Without SA_RESTART, so the receive returns
+			sigaction(kInterruptSignal, &action, nullptr);
+		});
+	}
+#endif
+
 	bool Connection::isInit_ = false;
+	static ConnectionTotals processTotals;
+	ConnectionTotals * Connection::totals_ = &processTotals;
+	std::atomic<unsigned int> Connection::heartbeatTimeout_(Connection::kDefaultHeartbeatTimeoutMilliseconds);
 	int Connection::lastError_ = 0;
 	const char * Connection::connectionErrorMessage_ = nullptr;
 #ifdef _WIN32
@@ -134,226 +480,857 @@ namespace checkers
 	}
 #endif
 
+	ConnectionTotals::ConnectionTotals()
+	{
+		bytesSent = 0;
+		bytesReceived = 0;
+		slowReceiversDropped = 0;
+		deadPeersDropped = 0;
+	}
+
 	Connection::Connection()
 	{
 		waitingForAck_ = false;
+		isCorked_ = false;
+		for (int i = 0; i < kMaxNumberOfMessages; i++)
+			queuedMessages_[i] = messageBuffers_ + kMaxMessageSize * i;
+		currentMessage_ = messageBuffers_ + kMaxMessageSize * kMaxNumberOfMessages;
 		idxQueuedMessagesStart_ = 0;
 		idxQueuedMessagesEnd_ = 0;
+		outgoingLength_ = 0;
+		pendingOffset_ = 0;
+		pendingBytes_ = 0;
+		numSkippedFrames_ = 0;
+		isBackedUp_ = false;
+		isFlushing_ = false;
+		isTooSlow_ = false;
+		numActiveThreads_ = 0;
+		lastReceivedAt_ = 0;
+		lastSentAt_ = 0;
+		heartbeatTimer_ = 0;
+		ackTimer_ = 0;
+		tap_ = nullptr;
+		tapSessionId_ = 0;
+		isDetaching_ = false;
+		isReceiveThreadDone_ = true;
+		isUringBacked_ = false;
+		uringId_ = 0;
+		isReceiveDone_ = false;
+		isInputWaiting_ = false;
+		isReceiveStopped_ = true;
+		isSocketClosePending_ = false;
+		lastSessionId_ = 0;
+		isCarrier_ = false;
+		carrier_ = nullptr;
+		sessionId_ = 0;
+		numSending_ = 0;
+		sessionBacklogBytes_ = 0;
 	}
 
 	void Connection::run()
 	{
 		idxQueuedMessagesStart_ = 0;
 		idxQueuedMessagesEnd_ = 0;
-		std::thread runningThread = std::thread([this] {runLoop(); });
+		outgoingLength_ = 0;
+		pendingFrames_.clear();
+		pendingOffset_ = 0;
+		pendingBytes_ = 0;
+		numSkippedFrames_ = 0;
+		isBackedUp_ = false;
+		isTooSlow_ = false;
+		isCarrier_ = false;
+		carrier_ = nullptr;
+		lastReceivedAt_ = nowMilliseconds();
+		lastSentAt_ = nowMilliseconds();
+
+		numActiveThreads_++;
+		timerMutex_.lock();
+		heartbeatTimer_ = TimerWheel::get().schedule(kHeartbeatIntervalMilliseconds, [this] { onHeartbeatTimer(); });
+		timerMutex_.unlock();
+
+		numActiveThreads_++;
+		std::lock_guard<std::mutex> lock(receiveThreadMutex_);
+		isReceiveThreadDone_ = false;
+
+		UringReactor *reactor = UringReactor::get();
+		isUringBacked_ = reactor != nullptr;
+		if (isUringBacked_)
+		{
+			inputBuffer_.clear();
+			isReceiveDone_ = false;
+			isInputWaiting_ = false;
+			isReceiveStopped_ = false;
+			isSocketClosePending_ = false;
+			uringId_ = reactor->add(this);
+			return;
+		}
+
+		std::thread runningThread = std::thread([this]
+		{
+			runLoop();
+			receiveThreadMutex_.lock();
+			isReceiveThreadDone_ = true;
+			receiveThreadMutex_.unlock();
+			numActiveThreads_--;
+		});
+		receiveThread_ = runningThread.native_handle();
 		runningThread.detach();
 	}
 
+	void Connection::onHeartbeatTimer()
+	{
+		long long now = nowMilliseconds();
+
+		// A full queue stops us from reading, so silence then says nothing about the other end
+		if (idxQueuedMessagesStart_ == (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages)
+			lastReceivedAt_ = now;
+
+		unsigned int timeout = heartbeatTimeout_;
+		if (timeout > 0 && now - lastReceivedAt_ > timeout && isConnected())
+		{
+			setLastError("Nothing heard from the other end");
+			verboseInfo("dropping connection that went silent");
+			totals_->deadPeersDropped++;
+			disconnect(false);
+		}
+		else if (now - lastSentAt_ >= kHeartbeatIntervalMilliseconds)
+		{
+			sendPayload(MessageType::HEARTBEAT);
+		}
+
+		// A send the receiver never makes room for doesn't complete, so it is checked on from here too
+		sendMutex.lock();
+		if (isBackedUp_ && std::chrono::steady_clock::now() - backedUpSince_ > std::chrono::milliseconds(kSlowReceiverMilliseconds))
+			isTooSlow_ = true;
+		sendMutex.unlock();
+		dropIfTooSlow();
+
+		timerMutex_.lock();
+		heartbeatTimer_ = 0;
+		bool isStillConnected = isConnected();
+		if (isStillConnected)
+			heartbeatTimer_ = TimerWheel::get().schedule(kHeartbeatIntervalMilliseconds, [this] { onHeartbeatTimer(); });
+		timerMutex_.unlock();
+
+		if (!isStillConnected)
+			numActiveThreads_--;
+	}
+
+	void Connection::onAckTimeout()
+	{
+		timerMutex_.lock();
+		ackTimer_ = 0;
+		timerMutex_.unlock();
+
+		disconnect(false);
+		numActiveThreads_--;
+	}
+
+	void Connection::stopTimers()
+	{
+		// A timer that can't be cancelled is already running and will see the connection is closed
+		std::lock_guard<std::mutex> lock(timerMutex_);
+		if (heartbeatTimer_ != 0 && TimerWheel::get().cancel(heartbeatTimer_))
+			numActiveThreads_--;
+		heartbeatTimer_ = 0;
+
+		if (ackTimer_ != 0 && TimerWheel::get().cancel(ackTimer_))
+			numActiveThreads_--;
+		ackTimer_ = 0;
+	}
+
 	void Connection::runLoop()
 	{
-		while (isConnected_ || waitingForAck_)
+		while ((isConnected_ || waitingForAck_) && !isDetaching_)
 		{
+			// Once our FIN is out nothing still queued will be read, so make room for the ACK rather than wait on a reader
+			if (waitingForAck_ && !isConnected_ && idxQueuedMessagesStart_ == (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages)
+			{
+				processMutex.lock();
+				idxQueuedMessagesStart_ = (idxQueuedMessagesStart_ + 1) % kMaxNumberOfMessages;
+				processMutex.unlock();
+			}
+
 			// As long as we haven't wrapped fully around the circular buffer
 			if (idxQueuedMessagesStart_ != (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages)
 			{
-				char * packet = queuedMessages_ + kMaxMessageSize * idxQueuedMessagesEnd_;
+				char * packet = queuedMessages_[idxQueuedMessagesEnd_];
 
 				bool success = false;
 				int meta = 3;
-				int bytesReceived = recv(socket_, packet, meta, 0);
-				if (bytesReceived != SOCKET_ERROR && (bytesReceived != 0 || meta == 0))
-				{
-					unsigned char type = *reinterpret_cast<unsigned char*>(packet);
-					if (type == MessageType::FIN && isConnected_)
-					{
-						verboseInfo("raw received FIN packet");
-						sendPayload(checkers::MessageType::FINACK);
-						disconnect(true);
-						std::thread ackTimeOut = std::thread([this] {
-							std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
-							std::chrono::steady_clock::time_point endTime = startTime + std::chrono::milliseconds(kAckTimeoutMilliseconds);
-
-							while (waitingForAck_ && std::chrono::steady_clock::now() < endTime)
-							{
-								std::this_thread::yield();
-							}
-
-							disconnect(false);
-						});
-						ackTimeOut.detach();
-						break;
-					}
-					if (type == MessageType::FINACK)
-					{
-						verboseInfo("raw received FINACK packet");
-						disconnect(false);
-						break;
-					}
+				int bytesReceived = receiveAll(socket_, packet, meta, true);
+
+				// Interrupted between frames to hand the socket over, so leave it open for whoever takes it
+				if (bytesReceived == SOCKET_ERROR && isDetaching_)
+					break;
 
+				if (bytesReceived == meta)
+				{
+					// Frames for a session have its id after the length
 					unsigned short length = ntohs(*reinterpret_cast<unsigned short*>(packet + 1));
-					if (length == 0 || recv(socket_, packet + meta, length, 0) == length)
+					int headerLength = (packet[0] & kSessionFlag) ? kSessionHeaderLength : meta;
+					if (length <= kMaxMessageSize - headerLength
+						&& (headerLength == meta || receiveAll(socket_, packet + meta, headerLength - meta, false) == headerLength - meta)
+						&& (length == 0 || receiveAll(socket_, packet + headerLength, length, false) == length))
 					{
-						processMutex.lock();
-						idxQueuedMessagesEnd_ = (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages;
-						verboseInfo("raw received packet type:" << (int)*reinterpret_cast<unsigned char*>(packet) << " length:" << length);
-						processMutex.unlock();
 						success = true;
+						if (!handleReceivedFrame(length))
+							break;
 					}
 				}
 
 				if( !success )
 				{
-					disconnect(true);
+					// The other end is gone, so there is no one left to acknowledge a FIN
 					setLastError("Error on receive");
+					disconnect(false);
 				}
 			}
 			std::this_thread::yield();
 		}
 	}
 
-	bool Connection::listenTo(const char * port, ConnectionListener &outListener, unsigned int timeout)
+	bool Connection::handleReceivedFrame(unsigned short length)
 	{
-		timeout; // TODO: nonblocking sockets
- 
-		if (!isInit_)
-			init();
-
-		struct addrinfo hints, *results;
-		memset(&hints, 0, sizeof hints);
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_protocol = IPPROTO_TCP;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = AI_PASSIVE;
+		const int meta = 3;
+		char * packet = queuedMessages_[idxQueuedMessagesEnd_];
 
-		int getAddrResult = getaddrinfo(NULL, port, &hints, &results);
-		getAddrResult;
-		SOCKET sockListen;
-		sockListen = socket(results->ai_family, results->ai_socktype, results->ai_protocol);
-		if (sockListen == INVALID_SOCKET)
-		{
-			// Clean up
-			setLastError("Error creating listen socket");
-			freeaddrinfo(results);
-			return false;
-		}
-
-		int reuseAddress = 1;
-		if ( setsockopt(sockListen, SOL_SOCKET, SO_REUSEADDR, (char*)&reuseAddress, sizeof reuseAddress) == SOCKET_ERROR)
-		{
-			setLastError("Error setting SO_REUSEADDR");
-			printSockError("");
-		}
-		int ipv6only = 0;
-		if( setsockopt(sockListen, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&ipv6only, sizeof ipv6only) == SOCKET_ERROR)
+		lastReceivedAt_ = nowMilliseconds();
+		unsigned char type = *reinterpret_cast<unsigned char*>(packet);
+		if (type & kSessionFlag)
 		{
-			setLastError("Error setting IPV6_V6ONLY");
-			printSockError("");
+			totals_->bytesReceived += kSessionHeaderLength + length;
+			unsigned short sessionId = ntohs(*reinterpret_cast<unsigned short*>(packet + meta));
+			routeSessionFrame(sessionId, (MessageType)(type & ~kSessionFlag), packet + kSessionHeaderLength, length);
+			return true;
 		}
-		
-		if (bind(sockListen, results->ai_addr, results->ai_addrlen) == SOCKET_ERROR)
+		if (type == MessageType::FIN && isConnected_)
 		{
-			// Clean up
-			setLastError("Error binding listen socket");
-			closesocket(sockListen);
-			freeaddrinfo(results);
+			verboseInfo("raw received FIN packet");
+			sendPayload(checkers::MessageType::FINACK);
+			disconnect(true); // Closed by the acknowledgement timer from here on
 			return false;
 		}
-		
-		if (listen(sockListen, SOMAXCONN) == SOCKET_ERROR)
+		// Both ends sent a FIN at the same time and each is waiting on the other, so the close is complete
+		if (type == MessageType::FINACK || (type == MessageType::FIN && waitingForAck_))
 		{
-			// Clean up
-			setLastError("Error listening listen socket");
-			closesocket(sockListen);
-			freeaddrinfo(results);
+			verboseInfo("raw received FINACK packet");
+			disconnect(false);
 			return false;
 		}
 
-		outListener.socket_ = sockListen;
-		outListener.isListening_ = true;
-		*reinterpret_cast<sockaddr*>(outListener.address_) = *results->ai_addr;
-		
-		freeaddrinfo(results);
+		totals_->bytesReceived += meta + length;
+
+		// Heartbeats have done their job once received, and are left in the free slot to be overwritten. So is everything for the connection itself once it carries sessions
+		if (type != MessageType::HEARTBEAT && !isCarrier_)
+		{
+			if (tap_ != nullptr)
+				tap_->onFrame(tapSessionId_, true, (MessageType)type, packet + meta, length);
+
+			processMutex.lock();
+			idxQueuedMessagesEnd_ = (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages;
+			verboseInfo("raw received packet type:" << (int)type << " length:" << length);
+			processMutex.unlock();
+			notifyMessageWaiters();
+			dispatchInput();
+		}
 		return true;
 	}
 
-	bool Connection::connectTo(const char * host, const char * port, Connection &outConnection, unsigned int timeout)
+	void Connection::onReceived(const char * data, unsigned int length)
 	{
-		timeout; // TODO: nonblocking sockets
-
-		if (!isInit_)
-			init();
-
-		struct addrinfo hints, *results;
-		memset(&hints, 0, sizeof hints);
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_protocol = IPPROTO_TCP;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = AI_PASSIVE;
-
-		int getAddrResult = getaddrinfo(host, port, &hints, &results);
-		getAddrResult;
-		SOCKET sock = 0;
-
-		bool success = false;
-
-		for (addrinfo* addressToTest = results; addressToTest != nullptr; addressToTest = addressToTest->ai_next )
+		if (isReceiveDone_)
+			return;
+
+		// Frames are taken straight from the reactor's buffer unless part of one was left over from before
+		if (!inputBuffer_.empty() && length > 0)
+			inputBuffer_.append(data, length);
+		bool isBuffered = !inputBuffer_.empty();
+		const char * input = isBuffered ? inputBuffer_.data() : data;
+		unsigned int available = isBuffered ? (unsigned int)inputBuffer_.size() : length;
+
+		const unsigned int meta = 3;
+		unsigned int used = 0;
+		while (!isReceiveDone_ && available - used >= meta)
 		{
-			sock = socket(results->ai_family, results->ai_socktype, results->ai_protocol);
-			if (sock == INVALID_SOCKET)
+			unsigned short frameLength;
+			memcpy(&frameLength, input + used + 1, sizeof frameLength);
+			frameLength = ntohs(frameLength);
+			unsigned int headerLength = (input[used] & kSessionFlag) ? kSessionHeaderLength : meta;
+			if (frameLength > kMaxMessageSize - headerLength)
 			{
-				setLastError("Error creating connecting socket");
-				printSockError("");
-				closesocket(sock);
-				continue;
+				isReceiveDone_ = true;
+				setLastError("Error on receive");
+				disconnect(false);
+				break;
 			}
+			if (available - used < headerLength + frameLength)
+				break;
 
-			if (connect(sock, results->ai_addr, results->ai_addrlen) == SOCKET_ERROR)
+			// Once our FIN is out nothing still queued will be read, so make room for the ACK rather than wait on a reader
+			if (waitingForAck_ && !isConnected_ && idxQueuedMessagesStart_ == (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages)
 			{
-				setLastError("Error connecting to socket");
-				printSockError("");
-				closesocket(sock);
-				continue;
+				processMutex.lock();
+				idxQueuedMessagesStart_ = (idxQueuedMessagesStart_ + 1) % kMaxNumberOfMessages;
+				processMutex.unlock();
 			}
 
-			success = true;
-			break;
+			// Hold the rest back until the reader makes room, processMessage() has the reactor carry on
+			processMutex.lock();
+			bool isFull = idxQueuedMessagesStart_ == (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages;
+			isInputWaiting_ = isFull;
+			processMutex.unlock();
+			if (isFull)
+				break;
+
+			memcpy(queuedMessages_[idxQueuedMessagesEnd_], input + used, headerLength + frameLength);
+			used += headerLength + frameLength;
+			if (!handleReceivedFrame(frameLength))
+				isReceiveDone_ = true;
 		}
 
-		if (success)
-		{
-			outConnection.isConnected_ = true;
-			outConnection.socket_ = sock;
-			outConnection.isHosting_ = false;
-			outConnection.run();
-		}
+		if (isBuffered)
+			inputBuffer_.erase(0, used);
+		else if (used < length)
+			inputBuffer_.assign(data + used, length - used);
+	}
 
-		freeaddrinfo(results);
+	unsigned int Connection::getBufferedInput() const
+	{
+		return (unsigned int)inputBuffer_.size();
+	}
 
-		return success;
+	void Connection::onReceiveFailed()
+	{
+		if (isReceiveDone_ || isDetaching_)
+			return;
+
+		// The other end is gone, so there is no one left to acknowledge a FIN
+		isReceiveDone_ = true;
+		setLastError("Error on receive");
+		disconnect(false);
 	}
 
-	void Connection::disconnect(bool waitForAck)
+	void Connection::onReceiveStopped()
 	{
+		// The socket can only be closed once nothing is being sent on it either, or it could be reused underneath the reactor
+		sendMutex.lock();
+		isReceiveStopped_ = true;
+		bool shouldClose = !isDetaching_ && !isFlushing_;
+		isSocketClosePending_ = !isDetaching_ && isFlushing_;
+		sendMutex.unlock();
+
+		if (shouldClose)
+			closesocket(socket_);
+
+		receiveThreadMutex_.lock();
+		isReceiveThreadDone_ = true;
+		receiveThreadMutex_.unlock();
+		numActiveThreads_--;
+	}
+
+	unsigned int Connection::takePendingFrames(SharedFrame * outFrames, unsigned int maxFrames, unsigned int & outOffset)
+	{
+		sendMutex.lock();
+		unsigned int count = 0;
+		if (isConnected() && !isReceiveStopped_ && !isTooSlow_)
+		{
+			for (; count < maxFrames && count < pendingFrames_.size(); count++)
+				outFrames[count] = pendingFrames_[count];
+			outOffset = pendingOffset_;
+		}
+
+		bool shouldClose = false;
+		if (count == 0)
+		{
+			isFlushing_ = false;
+			shouldClose = isSocketClosePending_;
+			isSocketClosePending_ = false;
+		}
+		sendMutex.unlock();
+
+		if (count == 0)
+		{
+			if (shouldClose)
+				closesocket(socket_);
+			numActiveThreads_--;
+		}
+		return count;
+	}
+
+	void Connection::onFramesSent(int result, const SharedFrame & firstFrame)
+	{
+		sendMutex.lock();
+		// Pending frames dropped in the meantime have nothing left to account for
+		if (result > 0 && !pendingFrames_.empty() && pendingFrames_.front() == firstFrame)
+		{
+			unsigned int sent = (unsigned int)result;
+			pendingBytes_ -= sent;
+			totals_->bytesSent += sent;
+			if (isBackedUp_ && pendingBytes_ <= kSendLowWatermark)
+				isBackedUp_ = false;
+
+			while (sent > 0 && !pendingFrames_.empty())
+			{
+				unsigned int remaining = (unsigned int)pendingFrames_.front()->size() - pendingOffset_;
+				if (sent < remaining)
+				{
+					pendingOffset_ += sent;
+					break;
+				}
+				sent -= remaining;
+				pendingFrames_.pop_front();
+				pendingOffset_ = 0;
+			}
+		}
+
+		if (isBackedUp_ && std::chrono::steady_clock::now() - backedUpSince_ > std::chrono::milliseconds(kSlowReceiverMilliseconds))
+			isTooSlow_ = true;
+		sendMutex.unlock();
+
+		if (result < 0 && isConnected())
+		{
+			setLastError("Error flushing pending frames");
+			disconnect(false);
+		}
+		dropIfTooSlow();
+	}
+
+	void Connection::closeSocket()
+	{
+		shutdown(socket_, SHUT_RDWR);
+		if (isUringBacked_)
+			UringReactor::get()->remove(uringId_);
+		else
+			closesocket(socket_);
+	}
+
+	bool Connection::listenTo(const char * port, ConnectionListener &outListener, unsigned int timeout, bool loopbackOnly, bool sharePort)
+	{
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+		if (!isInit_)
+			init();
+
+		// Only ever reachable from this machine anyway
+		if (isUnixAddress(port))
+			return listenToUnix(port + kUnixAddressPrefixLength, outListener, deadline, sharePort);
+
+		struct addrinfo hints, *results;
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		int getAddrResult = getaddrinfo(loopbackOnly ? "127.0.0.1" : NULL, port, &hints, &results);
+		if (getAddrResult != 0)
+		{
+			setLastError("Error resolving listen address");
+			return false;
+		}
+		SOCKET sockListen;
+		sockListen = socket(results->ai_family, results->ai_socktype, results->ai_protocol);
+		if (sockListen == INVALID_SOCKET)
+		{
+			// Clean up
+			setLastError("Error creating listen socket");
+			freeaddrinfo(results);
+			return false;
+		}
+
+		int reuseAddress = 1;
+		if ( setsockopt(sockListen, SOL_SOCKET, SO_REUSEADDR, (char*)&reuseAddress, sizeof reuseAddress) == SOCKET_ERROR)
+		{
+			setLastError("Error setting SO_REUSEADDR");
+			printSockError("");
+		}
+#ifdef SO_REUSEPORT
+		int reusePort = 1;
+		if (sharePort && setsockopt(sockListen, SOL_SOCKET, SO_REUSEPORT, (char*)&reusePort, sizeof reusePort) == SOCKET_ERROR)
+		{
+			setLastError("Error setting SO_REUSEPORT");
+			closesocket(sockListen);
+			freeaddrinfo(results);
+			return false;
+		}
+#else
+		if (sharePort)
+		{
+			setLastError("Sharing a port isn't supported");
+			closesocket(sockListen);
+			freeaddrinfo(results);
+			return false;
+		}
+#endif
+		int ipv6only = 0;
+		if (results->ai_family == AF_INET6 && setsockopt(sockListen, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&ipv6only, sizeof ipv6only) == SOCKET_ERROR)
+		{
+			setLastError("Error setting IPV6_V6ONLY");
+			printSockError("");
+		}
+		
+		// A listener from a process that is just shutting down may still hold the port for a moment
+		int bindResult;
+		while ((bindResult = bind(sockListen, results->ai_addr, results->ai_addrlen)) == SOCKET_ERROR && WSAGetLastError() == WSAEADDRINUSE && millisecondsUntil(deadline) > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(kBindRetryMilliseconds));
+		}
+
+		if (bindResult == SOCKET_ERROR)
+		{
+			// Clean up
+			setLastError("Error binding listen socket");
+			closesocket(sockListen);
+			freeaddrinfo(results);
+			return false;
+		}
+		
+		if (listen(sockListen, SOMAXCONN) == SOCKET_ERROR)
+		{
+			// Clean up
+			setLastError("Error listening listen socket");
+			closesocket(sockListen);
+			freeaddrinfo(results);
+			return false;
+		}
+
+		// Non-blocking so a connection that is dropped between select and accept can't hang the acceptor
+		if (!setBlocking(sockListen, false))
+		{
+			setLastError("Error setting listen socket non-blocking");
+			printSockError("");
+		}
+
+		outListener.socket_ = sockListen;
+		outListener.wakeSocket_ = ConnectionListener::makeWakeSocket();
+		outListener.isListening_ = true;
+		outListener.unixPath_.clear();
+		*reinterpret_cast<sockaddr*>(outListener.address_) = *results->ai_addr;
+		
+		freeaddrinfo(results);
+		return true;
+	}
+
+	bool Connection::connectTo(const char * host, const char * port, Connection &outConnection, unsigned int timeout)
+	{
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+		if (!isInit_)
+			init();
+
+		if (isUnixAddress(host))
+			return connectToUnix(host + kUnixAddressPrefixLength, outConnection, deadline);
+
+		struct addrinfo hints, *results;
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		int getAddrResult = getaddrinfo(host, port, &hints, &results);
+		if (getAddrResult != 0)
+		{
+			setLastError("Error resolving host");
+			return false;
+		}
+		SOCKET sock = 0;
+
+		bool success = false;
+
+		for (addrinfo* addressToTest = results; addressToTest != nullptr && !success; addressToTest = addressToTest->ai_next )
+		{
+			sock = socket(addressToTest->ai_family, addressToTest->ai_socktype, addressToTest->ai_protocol);
+			if (sock == INVALID_SOCKET)
+			{
+				setLastError("Error creating connecting socket");
+				printSockError("");
+				continue;
+			}
+
+			// Connect without blocking so an unreachable host only costs us up to the deadline
+			if (!setBlocking(sock, false))
+			{
+				setLastError("Error setting connecting socket non-blocking");
+				printSockError("");
+				closesocket(sock);
+				continue;
+			}
+
+			if (connect(sock, addressToTest->ai_addr, addressToTest->ai_addrlen) == SOCKET_ERROR)
+			{
+				int error = WSAGetLastError();
+				if (error != WSAEWOULDBLOCK && error != WSAEINPROGRESS)
+				{
+					setLastError("Error connecting to socket");
+					printSockError("");
+					closesocket(sock);
+					continue;
+				}
+
+				if (!waitForSocket(sock, true, millisecondsUntil(deadline)))
+				{
+					setLastError("Timed out connecting to socket");
+					printSockError("");
+					closesocket(sock);
+					continue;
+				}
+
+				// Writable doesn't mean connected, the outcome of the connect is left in SO_ERROR
+				int connectError = 0;
+				AddressLength connectErrorLength = sizeof connectError;
+				if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&connectError, &connectErrorLength) == SOCKET_ERROR || connectError != 0)
+				{
+					setLastError("Error connecting to socket");
+					printSockError("");
+					closesocket(sock);
+					continue;
+				}
+			}
+
+			if (!setBlocking(sock, true))
+			{
+				setLastError("Error setting connected socket blocking");
+				printSockError("");
+				closesocket(sock);
+				continue;
+			}
+
+			success = true;
+		}
+
+		if (success)
+		{
+			if (!disableNagle(sock))
+			{
+				setLastError("Error setting TCP_NODELAY");
+				printSockError("");
+			}
+			outConnection.isConnected_ = true;
+			outConnection.socket_ = sock;
+			outConnection.isHosting_ = false;
+			outConnection.run();
+		}
+
+		freeaddrinfo(results);
+
+		return success;
+	}
+
+	bool Connection::isUnixAddress(const char * address)
+	{
+		return address != nullptr && strncmp(address, kUnixAddressPrefix, kUnixAddressPrefixLength) == 0;
+	}
+
+	bool Connection::listenToUnix(const char * path, ConnectionListener & outListener, std::chrono::steady_clock::time_point deadline, bool sharePort)
+	{
+#ifdef _WIN32
+		path; outListener; deadline; sharePort;
+		setLastError("Unix domain sockets aren't supported");
+		return false;
+#else
+		if (sharePort)
+		{
+			setLastError("Sharing a unix socket path isn't supported");
+			return false;
+		}
+
+		sockaddr_un address;
+		if (!makeUnixAddress(path, address))
+		{
+			setLastError("Unix socket path is empty or too long");
+			return false;
+		}
+
+		SOCKET sockListen = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sockListen == INVALID_SOCKET)
+		{
+			setLastError("Error creating listen socket");
+			return false;
+		}
+
+		// The socket file outlives a listener that wasn't ended, eg. after a crash, and has to be removed before binding again. One still in use may just be shutting down
+		int bindResult;
+		while ((bindResult = bind(sockListen, (SOCKADDR*)&address, sizeof address)) == SOCKET_ERROR && errno == EADDRINUSE)
+		{
+			if (!isUnixAddressInUse(address))
+			{
+				if (unlink(path) == SOCKET_ERROR && errno != ENOENT)
+					break;
+				continue;
+			}
+
+			if (millisecondsUntil(deadline) == 0)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(kBindRetryMilliseconds));
+		}
+
+		if (bindResult == SOCKET_ERROR)
+		{
+			setLastError("Error binding listen socket");
+			closesocket(sockListen);
+			return false;
+		}
+
+		if (listen(sockListen, SOMAXCONN) == SOCKET_ERROR)
+		{
+			setLastError("Error listening listen socket");
+			closesocket(sockListen);
+			unlink(path);
+			return false;
+		}
+
+		if (!setBlocking(sockListen, false))
+		{
+			setLastError("Error setting listen socket non-blocking");
+			printSockError("");
+		}
+
+		outListener.socket_ = sockListen;
+		outListener.wakeSocket_ = ConnectionListener::makeWakeSocket();
+		outListener.isListening_ = true;
+		outListener.unixPath_ = path;
+		return true;
+#endif
+	}
+
+	bool Connection::connectToUnix(const char * path, Connection & outConnection, std::chrono::steady_clock::time_point deadline)
+	{
+#ifdef _WIN32
+		path; outConnection; deadline;
+		setLastError("Unix domain sockets aren't supported");
+		return false;
+#else
+		sockaddr_un address;
+		if (!makeUnixAddress(path, address))
+		{
+			setLastError("Unix socket path is empty or too long");
+			return false;
+		}
+
+		SOCKET sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock == INVALID_SOCKET)
+		{
+			setLastError("Error creating connecting socket");
+			return false;
+		}
+
+		// Connects right away or not at all, except that a listener with a full backlog makes us try again
+		int connectResult = SOCKET_ERROR;
+		if (setBlocking(sock, false))
+		{
+			while ((connectResult = connect(sock, (SOCKADDR*)&address, sizeof address)) == SOCKET_ERROR && (errno == EAGAIN || errno == EINTR) && millisecondsUntil(deadline) > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(kBindRetryMilliseconds));
+		}
+
+		if (connectResult == SOCKET_ERROR || !setBlocking(sock, true))
+		{
+			setLastError("Error connecting to socket");
+			closesocket(sock);
+			return false;
+		}
+
+		outConnection.isConnected_ = true;
+		outConnection.socket_ = sock;
+		outConnection.isHosting_ = false;
+		outConnection.run();
+		return true;
+#endif
+	}
+
+	void Connection::disconnect(bool waitForAck)
+	{
+		if (carrier_ != nullptr)
+		{
+			closeSession(true);
+			return;
+		}
+
 		if (isConnected_)
 		{
 			if (waitForAck)
 			{
 				waitingForAck_ = true;
 				sendPayload(MessageType::FIN);
+
+				// Stop waiting on an ACK that isn't coming
+				timerMutex_.lock();
+				if (ackTimer_ == 0)
+				{
+					numActiveThreads_++;
+					ackTimer_ = TimerWheel::get().schedule(kAckTimeoutMilliseconds, [this] { onAckTimeout(); });
+				}
+				timerMutex_.unlock();
 			}
 			else
 			{
-				shutdown(socket_, SHUT_RDWR);
-				closesocket(socket_);
+				closeSocket();
 			}
 			isConnected_ = false;
+
+			if (tap_ != nullptr)
+				tap_->onClose(tapSessionId_);
 		}
 		if (waitingForAck_ && !waitForAck)
 		{
-			shutdown(socket_, SHUT_RDWR);
-			closesocket(socket_);
+			closeSocket();
 			waitingForAck_ = false;
 		}
+		if (!isConnected())
+			stopTimers();
+		// Nothing more can be sent for them once our FIN is out
+		if (!isConnected_)
+			closeSessions();
+		notifyMessageWaiters();
+		dispatchInput();
+
+		if (!isConnected_)
+		{
+			std::lock_guard<std::recursive_mutex> lock(closeMutex_);
+			std::function<void()> handler;
+			handler.swap(closeHandler_);
+			if (handler)
+				handler();
+		}
+	}
+
+	void Connection::dispatchInput()
+	{
+		std::function<void(bool, const std::string&)> handler;
+		messageMutex_.lock();
+		if (inputHandler_ && (!isConnected_ || hasMessageWaiting()))
+			handler.swap(inputHandler_);
+		messageMutex_.unlock();
+
+		if (!handler)
+			return;
+
+		bool received = false;
+		std::string response;
+
+		MessageType type = MessageType::SEND_MESSAGE;
+		unsigned int length = 0;
+		const char * message = processMessage(type, length);
+		if (message != nullptr && length != 0 && type == MessageType::SEND_MESSAGE)
+		{
+			response.assign(message, strnlen(message, length));
+			received = true;
+		}
+		else if (message != nullptr)
+		{
+			verboseInfo("received packet discarded type:" << type << " length:" << length);
+		}
+
+		handler(received, response);
+	}
+
+	void Connection::notifyMessageWaiters()
+	{
+		// Taking the lock makes sure a waiter is either already asleep or hasn't checked its condition yet
+		messageMutex_.lock();
+		messageMutex_.unlock();
+		messageArrived_.notify_all();
 	}
 
 	bool Connection::sendPayload(MessageType type, const char * data, unsigned int length)
@@ -362,6 +1339,9 @@ namespace checkers
 		// Length	SHORT	2 hton
 		// Message	CHAR*	X
 
+		if (carrier_ != nullptr)
+			return sendSessionPayload(type, data, length);
+
 		if (!isConnected_)
 			return false;
 
@@ -371,37 +1351,462 @@ namespace checkers
 		if (length + 3 > kMaxMessageSize)
 			return false; // Too long of a message
 
-		char buffer[kMaxMessageSize];
+		if (tap_ != nullptr && type != MessageType::HEARTBEAT)
+			tap_->onFrame(tapSessionId_, false, type, data, length);
+
+		lastSentAt_ = nowMilliseconds();
+
+		const unsigned int kHeaderLength = 3;
+		char header[kHeaderLength];
+		header[0] = type;
+		*(reinterpret_cast<unsigned short*>(header + 1)) = htons( (unsigned short) length );
+
+		bool result = true;
+
+		sendMutex.lock();
+		// Plain messages can wait for the next frame that has to go out now, everything else carries the held back messages with it
+		if (isCorked_ && type == MessageType::SEND_MESSAGE)
+		{
+			if (outgoingLength_ + kHeaderLength + length > kMaxOutgoingSize)
+				result = writeOutgoing();
+
+			memcpy(outgoing_ + outgoingLength_, header, kHeaderLength);
+			memcpy(outgoing_ + outgoingLength_ + kHeaderLength, data, length);
+			outgoingLength_ += kHeaderLength + length;
+		}
+		else
+		{
+			result = writeOutgoing(header, kHeaderLength, data, length);
+		}
+		sendMutex.unlock();
+
+		if (!result)
+		{
+			dropIfTooSlow();
+			setLastError("Error on send payload");
+			return false;
+		}
+
+		verboseInfo("raw sent packet type:" << type << " length:" << length);
+
+		return true;
+	}
+
+	bool Connection::sendSessionPayload(MessageType type, const char * data, unsigned int length, bool mayHoldBack)
+	{
+		// Type		CHAR	1 | kSessionFlag
+		// Length	SHORT	2 hton
+		// Session	SHORT	2 hton
+		// Message	CHAR*	X
+
+		if (data == nullptr)
+			length = 0;
+
+		if (length + kSessionHeaderLength > kMaxMessageSize)
+			return false; // Too long of a message
+
+		// The carrier is kept while this is counted, and isn't touched at all once the session is closed
+		numSending_++;
+		if (!isConnected_)
+		{
+			numSending_--;
+			return false;
+		}
+
+		if (tap_ != nullptr && type != MessageType::HEARTBEAT)
+			tap_->onFrame(tapSessionId_, false, type, data, length);
+
+		carrier_->lastSentAt_ = nowMilliseconds();
+
+		char header[kSessionHeaderLength];
+		header[0] = (char)(type | kSessionFlag);
+		*(reinterpret_cast<unsigned short*>(header + 1)) = htons((unsigned short)length);
+		*(reinterpret_cast<unsigned short*>(header + 3)) = htons(sessionId_);
+
+		bool result = true;
+
+		// The session holds back its own messages while corked, so they still go out in the order it sent them
+		carrier_->sendMutex.lock();
+		if (isCorked_ && mayHoldBack && type == MessageType::SEND_MESSAGE)
+		{
+			if (outgoingLength_ + kSessionHeaderLength + length > kMaxOutgoingSize)
+			{
+				result = carrier_->writeOutgoing(nullptr, 0, nullptr, 0, outgoing_, outgoingLength_);
+				outgoingLength_ = 0;
+			}
+
+			memcpy(outgoing_ + outgoingLength_, header, kSessionHeaderLength);
+			memcpy(outgoing_ + outgoingLength_ + kSessionHeaderLength, data, length);
+			outgoingLength_ += kSessionHeaderLength + length;
+		}
+		else
+		{
+			result = carrier_->writeOutgoing(header, kSessionHeaderLength, data, length, outgoing_, outgoingLength_);
+			outgoingLength_ = 0;
+		}
+		carrier_->sendMutex.unlock();
+		numSending_--;
+
+		// A carrier that fell too far behind is dropped by its own heartbeat, never from here where it could be closing this session
+		if (!result)
+		{
+			setLastError("Error on send payload");
+			return false;
+		}
+
+		verboseInfo("raw sent packet type:" << type << " length:" << length << " session:" << sessionId_);
+
+		return true;
+	}
+
+	bool Connection::writeOutgoing(const char * header, unsigned int headerLength, const char * data, unsigned int length, const char * held, unsigned int heldLength)
+	{
+		const int kNumBuffers = 4;
+		const char * buffers[] = { outgoing_, held, header, data };
+		const unsigned int lengths[] = { outgoingLength_, heldLength, headerLength, length };
+		unsigned int total = outgoingLength_ + heldLength + headerLength + length;
+		outgoingLength_ = 0;
+
+		// Nothing may overtake the frames already waiting, so only go straight to the socket when there are none
+		unsigned int sent = 0;
+		if (pendingFrames_.empty() && !isUringBacked_)
+		{
+			int result = sendGatheredWithoutBlocking(socket_, buffers, lengths, kNumBuffers);
+			if (result == SOCKET_ERROR)
+				return false;
+
+			sent = (unsigned int)result;
+			totals_->bytesSent += sent;
+		}
+		if (sent == total)
+			return true;
+
+		// The buffers don't outlive this call, so keep a copy of what is left
+		std::string * rest = FramePool::get().take(total - sent);
+		for (int i = 0; i < kNumBuffers; i++)
+		{
+			if (sent >= lengths[i])
+			{
+				sent -= lengths[i];
+				continue;
+			}
+			rest->append(buffers[i] + sent, lengths[i] - sent);
+			sent = 0;
+		}
+		return queuePending(FramePool::share(rest));
+	}
+
+	bool Connection::queuePending(const SharedFrame & frame)
+	{
+		if (pendingBytes_ + frame->size() > kMaxPendingBytes)
+		{
+			isTooSlow_ = true;
+			return false;
+		}
+
+		pendingFrames_.push_back(frame);
+		pendingBytes_ += (unsigned int)frame->size();
+		if (!isBackedUp_ && pendingBytes_ > kSendHighWatermark)
+		{
+			isBackedUp_ = true;
+			backedUpSince_ = std::chrono::steady_clock::now();
+		}
+
+		// The reactor sends everything, batched with what every other connection queued meanwhile
+		if (isUringBacked_)
+		{
+			if (!isFlushing_)
+			{
+				isFlushing_ = true;
+				numActiveThreads_++;
+				UringReactor::get()->flush(this);
+			}
+			return true;
+		}
+
+		if (!sendPendingFrames(0))
+			return false;
+
+		if (!pendingFrames_.empty() && !isFlushing_)
+		{
+			isFlushing_ = true;
+			numActiveThreads_++;
+			std::thread flushingThread = std::thread([this] { flushLoop(); numActiveThreads_--; });
+			flushingThread.detach();
+		}
+		return true;
+	}
+
+	void Connection::flushLoop()
+	{
+		std::unique_lock<std::mutex> lock(sendMutex);
+		while (isConnected() && !pendingFrames_.empty())
+		{
+			if (!sendPendingFrames(0))
+			{
+				setLastError("Error flushing pending frames");
+				break;
+			}
+
+			if (isBackedUp_ && std::chrono::steady_clock::now() - backedUpSince_ > std::chrono::milliseconds(kSlowReceiverMilliseconds))
+			{
+				isTooSlow_ = true;
+				break;
+			}
+
+			if (pendingFrames_.empty())
+				break;
+
+			// Wait for room without holding up anyone queueing more
+			lock.unlock();
+			waitForSocket(socket_, true, kFlushWaitMilliseconds);
+			lock.lock();
+		}
+		isFlushing_ = false;
+		lock.unlock();
+
+		dropIfTooSlow();
+	}
+
+	void Connection::dropIfTooSlow()
+	{
+		sendMutex.lock();
+		bool isTooSlow = isTooSlow_;
+		isTooSlow_ = false;
+		if (isTooSlow)
+		{
+			// Nothing queued is going to be read anymore
+			pendingFrames_.clear();
+			pendingOffset_ = 0;
+			pendingBytes_ = 0;
+			isBackedUp_ = false;
+		}
+		sendMutex.unlock();
+
+		if (!isTooSlow || !isConnected())
+			return;
+
+		setLastError("Receiver too slow");
+		verboseInfo("dropping receiver that isn't keeping up");
+		totals_->slowReceiversDropped++;
+		disconnect(false);
+	}
+
+	bool Connection::sendPendingFrames(unsigned int timeout)
+	{
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+		while (!pendingFrames_.empty())
+		{
+			const std::string &frame = *pendingFrames_.front();
+			int sent = sendWithoutBlocking(socket_, frame.data() + pendingOffset_, (unsigned int)frame.size() - pendingOffset_);
+			if (sent == SOCKET_ERROR)
+				return false;
+
+			pendingOffset_ += sent;
+			pendingBytes_ -= sent;
+			totals_->bytesSent += sent;
+			if (isBackedUp_ && pendingBytes_ <= kSendLowWatermark)
+				isBackedUp_ = false;
+
+			if (pendingOffset_ == frame.size())
+			{
+				pendingFrames_.pop_front();
+				pendingOffset_ = 0;
+			}
+			else if (sent == 0)
+			{
+				// The receiver isn't keeping up, wait for room only as long as allowed
+				unsigned int remaining = millisecondsUntil(deadline);
+				if (remaining == 0 || !waitForSocket(socket_, true, remaining))
+					return true;
+			}
+		}
+		return true;
+	}
+
+	SharedFrame Connection::encodeFrame(MessageType type, const char * data, unsigned int length)
+	{
+		if (data == nullptr)
+			length = 0;
+
+		if (length + 3 > kMaxMessageSize)
+			return nullptr; // Too long of a message
+
+		std::string * frame = FramePool::get().take(length + 3);
+		unsigned short networkLength = htons((unsigned short)length);
+		frame->push_back((char)type);
+		frame->append(reinterpret_cast<const char*>(&networkLength), sizeof networkLength);
+		frame->append(data, length);
+
+		return FramePool::share(frame);
+	}
+
+	bool Connection::sendFrame(const SharedFrame & frame)
+	{
+		if (!isConnected_ || !frame)
+			return false;
+
+		// Shared frames carry no session id, so a session sends the payload again under its own, skipped just the same while the carrier is backed up
+		if (carrier_ != nullptr)
+		{
+			numSending_++;
+			bool isBackedUp = true;
+			if (isConnected_)
+			{
+				carrier_->sendMutex.lock();
+				isBackedUp = carrier_->isBackedUp_;
+				carrier_->sendMutex.unlock();
+			}
+			numSending_--;
+
+			if (isBackedUp)
+			{
+				numSkippedFrames_++;
+				return isConnected_;
+			}
+			numSkippedFrames_ = 0;
+			return sendSessionPayload((MessageType)(*frame)[0], frame->data() + 3, (unsigned int)frame->size() - 3, false);
+		}
+
+		bool result = true;
+		lastSentAt_ = nowMilliseconds();
+
+		sendMutex.lock();
+		// Anything held back while corked was meant to arrive before this
+		if (outgoingLength_ > 0)
+			result = writeOutgoing();
+
+		if (result)
+		{
+			if (!isBackedUp_)
+			{
+				numSkippedFrames_ = 0;
+
+				if (tap_ != nullptr)
+					tap_->onFrame(tapSessionId_, false, (MessageType)(*frame)[0], frame->data() + 3, (unsigned int)frame->size() - 3);
+
+				result = queuePending(frame);
+			}
+			else
+			{
+				numSkippedFrames_++;
+			}
+		}
+		sendMutex.unlock();
+
+		if (!result)
+		{
+			dropIfTooSlow();
+			setLastError("Error on send frame");
+		}
+
+		return result;
+	}
+
+	bool Connection::flushFrames(unsigned int timeout)
+	{
+		if (carrier_ != nullptr)
+		{
+			numSending_++;
+			bool result = isConnected_ && carrier_->flushFrames(timeout);
+			numSending_--;
+			return result;
+		}
+
+		// The reactor is already sending them, all there is to do is wait
+		if (isUringBacked_)
+		{
+			std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+			while (true)
+			{
+				sendMutex.lock();
+				bool isSent = pendingFrames_.empty();
+				bool isStillConnected = isConnected_;
+				sendMutex.unlock();
+
+				if (!isStillConnected || isSent)
+					return isStillConnected;
+				if (millisecondsUntil(deadline) == 0)
+					return false;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+
+		sendMutex.lock();
+		bool result = isConnected_ && sendPendingFrames(timeout) && pendingFrames_.empty();
+		sendMutex.unlock();
+		return result;
+	}
 
-		int index = 0;
+	unsigned int Connection::getNumSkippedFrames() const
+	{
+		return numSkippedFrames_;
+	}
+
+	void Connection::setTap(ConnectionTap * tap, unsigned int sessionId)
+	{
+		tap_ = tap;
+		tapSessionId_ = sessionId;
+	}
 
-		buffer[index++] = type;
-		*(reinterpret_cast<unsigned short*>(buffer+index)) = htons( (unsigned short) length );
-		index += 2;
+	void Connection::setCorked(bool isCorked)
+	{
+		isCorked_ = isCorked;
+		if (!isCorked)
+			flush();
+	}
 
-		for (unsigned int i = 0; i < length; i++)
+	bool Connection::flush()
+	{
+		bool result = true;
+		if (carrier_ != nullptr)
 		{
-			buffer[index++] = data[i];
+			// The session's held back frames go out through the carrier, after anything it held back itself
+			numSending_++;
+			if (isConnected_)
+			{
+				carrier_->sendMutex.lock();
+				if (outgoingLength_ > 0)
+					result = carrier_->writeOutgoing(nullptr, 0, nullptr, 0, outgoing_, outgoingLength_);
+				outgoingLength_ = 0;
+				carrier_->sendMutex.unlock();
+			}
+			numSending_--;
+
+			if (!result)
+				setLastError("Error on flush");
+			return result;
 		}
 
 		sendMutex.lock();
-		int result = send(socket_, buffer, index, 0);
+		if (isConnected_ && outgoingLength_ > 0)
+			result = writeOutgoing();
 		sendMutex.unlock();
 
-		if (result == SOCKET_ERROR)
+		if (!result)
 		{
-			setLastError("Error on send payload");
-			return false;
+			dropIfTooSlow();
+			setLastError("Error on flush");
 		}
 
-		verboseInfo("raw sent packet type:" << type << " length:" << length);
+		return result;
+	}
 
-		return true;
+	bool Connection::sendMessage(const std::string & message)
+	{
+		return sendMessage(message.c_str(), (unsigned int)message.length());
+	}
+
+	bool Connection::sendMessage(const char * message)
+	{
+		return sendMessage(message, (unsigned int)strlen(message));
 	}
 
-	bool Connection::sendMessage(std::string message)
+	bool Connection::sendMessage(const char * message, unsigned int length)
 	{
-		return sendPayload(MessageType::SEND_MESSAGE, message.c_str(), message.length() + 1);
+		// The terminator goes out too
+		return sendPayload(MessageType::SEND_MESSAGE, message, length + 1);
 	}
 
 	bool Connection::sendWinner(int result)
@@ -426,7 +1831,7 @@ namespace checkers
 
 				if (message != nullptr && length != 0 && type == MessageType::SEND_MESSAGE)
 				{
-					outResponse = std::string(message);
+					outResponse.assign(message, strnlen(message, length));
 					return true;
 				}
 				else
@@ -439,9 +1844,67 @@ namespace checkers
 		return false;
 	}
 
+	void Connection::requestInputAsync(const std::function<void(bool received, const std::string &response)> &onResponse)
+	{
+		if (!isHosting_)
+		{
+			onResponse(false, std::string()); // Can't request input from host
+			return;
+		}
+
+		// Set before asking so the reply can't arrive before there's anyone to take it
+		messageMutex_.lock();
+		inputHandler_ = onResponse;
+		messageMutex_.unlock();
+
+		if (!sendPayload(MessageType::REQUEST_INPUT))
+		{
+			std::function<void(bool, const std::string&)> handler;
+			messageMutex_.lock();
+			handler.swap(inputHandler_);
+			messageMutex_.unlock();
+
+			if (handler)
+				handler(false, std::string());
+			return;
+		}
+
+		// The reply, or the connection closing, may have come in already
+		dispatchInput();
+	}
+
+	void Connection::cancelInputRequest()
+	{
+		std::function<void(bool, const std::string&)> handler;
+		messageMutex_.lock();
+		handler.swap(inputHandler_);
+		messageMutex_.unlock();
+
+		if (handler)
+			handler(false, std::string());
+	}
+
+	void Connection::setCloseHandler(const std::function<void()>& onClose)
+	{
+		std::lock_guard<std::recursive_mutex> lock(closeMutex_);
+		closeHandler_ = onClose;
+	}
+
 	bool Connection::waitUntilHasMessage() const
 	{
-		while (isConnected_ && !hasMessageWaiting()) { std::this_thread::yield(); }
+		std::unique_lock<std::mutex> lock(messageMutex_);
+		while (isConnected_ && !hasMessageWaiting())
+			messageArrived_.wait_for(lock, std::chrono::milliseconds(kMessageWaitMilliseconds));
+		return hasMessageWaiting();
+	}
+
+	bool Connection::waitUntilHasMessage(unsigned int timeout) const
+	{
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+		std::unique_lock<std::mutex> lock(messageMutex_);
+		while (isConnected_ && !hasMessageWaiting() && millisecondsUntil(deadline) > 0)
+			messageArrived_.wait_for(lock, std::chrono::milliseconds(std::min<unsigned int>(millisecondsUntil(deadline), kMessageWaitMilliseconds)));
 		return hasMessageWaiting();
 	}
 
@@ -456,18 +1919,37 @@ namespace checkers
 		const char * result = nullptr;
 		if (hasMessageWaiting())
 		{
-			char * buffer = queuedMessages_ + kMaxMessageSize * idxQueuedMessagesStart_;
+			char * buffer = queuedMessages_[idxQueuedMessagesStart_];
 			outType = (MessageType)buffer[0];
 			outLength = ntohs(*reinterpret_cast<unsigned short*>(buffer + 1));
-                        
-			memcpy(currentMessage_, buffer, outLength + 3);
+
+			// The reader takes the slot's buffer as it is, and the slot gets the one the reader is done with
+			queuedMessages_[idxQueuedMessagesStart_] = currentMessage_;
+			currentMessage_ = buffer;
 
 			verboseInfo("received packet processed type:" << outType << " length:" << outLength);
 			
 			idxQueuedMessagesStart_ = (idxQueuedMessagesStart_ + 1) % kMaxNumberOfMessages;
 			result = currentMessage_ + 3;
+
+			// A session's backlog moves into the slot just freed
+			if (!sessionBacklog_.empty())
+			{
+				const std::string &frame = sessionBacklog_.front();
+				memcpy(queuedMessages_[idxQueuedMessagesEnd_], frame.data(), frame.size());
+				idxQueuedMessagesEnd_ = (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages;
+				sessionBacklogBytes_ -= (unsigned int)frame.size();
+				sessionBacklog_.pop_front();
+			}
 		}
+		bool isInputWaiting = isInputWaiting_ && result != nullptr;
+		if (isInputWaiting)
+			isInputWaiting_ = false;
 		processMutex.unlock();
+
+		// There is room for what the reactor held back now
+		if (isInputWaiting)
+			UringReactor::get()->resume(uringId_);
 		return result;
 	}
 
@@ -481,13 +1963,424 @@ namespace checkers
 		return isHosting_;
 	}
 
+	unsigned long long Connection::getTotalBytesSent()
+	{
+		return totals_->bytesSent;
+	}
+
+	unsigned long long Connection::getTotalBytesReceived()
+	{
+		return totals_->bytesReceived;
+	}
+
+	unsigned long long Connection::getTotalSlowReceiversDropped()
+	{
+		return totals_->slowReceiversDropped;
+	}
+
+	unsigned long long Connection::getTotalDeadPeersDropped()
+	{
+		return totals_->deadPeersDropped;
+	}
+
+	void Connection::shareTotals(ConnectionTotals * totals)
+	{
+		totals_ = totals;
+	}
+
+	void Connection::setHeartbeatTimeout(unsigned int timeout)
+	{
+		heartbeatTimeout_ = timeout;
+	}
+
+	bool Connection::isIdle() const
+	{
+		return !isConnected() && numActiveThreads_ == 0;
+	}
+
+	bool Connection::openSession(Connection & outSession)
+	{
+		if (!isConnected_ || carrier_ != nullptr)
+			return false;
+
+		becomeCarrier();
+
+		// Ids still in use are skipped, and 0 is never handed out
+		unsigned short sessionId = 0;
+		sessionsMutex_.lock();
+		for (unsigned int i = 0; i < 0xFFFF && sessionId == 0; i++)
+		{
+			lastSessionId_++;
+			if (lastSessionId_ != 0 && sessions_.find(lastSessionId_) == sessions_.end())
+				sessionId = lastSessionId_;
+		}
+		if (sessionId != 0)
+			attachSession(outSession, sessionId);
+		sessionsMutex_.unlock();
+
+		if (sessionId == 0)
+		{
+			setLastError("No session ids left");
+			return false;
+		}
+
+		if (!outSession.sendPayload(MessageType::OPEN_SESSION))
+		{
+			outSession.closeSession(false);
+			return false;
+		}
+		return true;
+	}
+
+	void Connection::setSessionHandler(const std::function<void(unsigned short sessionId)>& onOpen)
+	{
+		std::lock_guard<std::mutex> lock(sessionsMutex_);
+		sessionHandler_ = onOpen;
+	}
+
+	bool Connection::acceptSession(unsigned short sessionId, Connection & outSession)
+	{
+		std::lock_guard<std::mutex> lock(sessionsMutex_);
+		if (!isConnected_ || sessionId == 0 || sessions_.find(sessionId) != sessions_.end())
+			return false;
+
+		attachSession(outSession, sessionId);
+		return true;
+	}
+
+	void Connection::becomeCarrier()
+	{
+		processMutex.lock();
+		bool isInputWaiting = isInputWaiting_ && !isCarrier_;
+		if (!isCarrier_)
+		{
+			isCarrier_ = true;
+			idxQueuedMessagesStart_ = idxQueuedMessagesEnd_;
+			isInputWaiting_ = false;
+		}
+		processMutex.unlock();
+
+		// What the reactor held back can come in now that nothing is kept
+		if (isInputWaiting)
+			UringReactor::get()->resume(uringId_);
+		notifyMessageWaiters();
+	}
+
+	void Connection::attachSession(Connection & session, unsigned short sessionId)
+	{
+		session.carrier_ = this;
+		session.sessionId_ = sessionId;
+		session.isHosting_ = isHosting_;
+		session.waitingForAck_ = false;
+		session.idxQueuedMessagesStart_ = 0;
+		session.idxQueuedMessagesEnd_ = 0;
+		session.sessionBacklog_.clear();
+		session.sessionBacklogBytes_ = 0;
+		session.outgoingLength_ = 0;
+		session.numSkippedFrames_ = 0;
+		session.isConnected_ = true;
+		sessions_[sessionId] = &session;
+
+		// The carrier stays until every session over it has closed
+		numActiveThreads_++;
+	}
+
+	void Connection::routeSessionFrame(unsigned short sessionId, MessageType type, const char * data, unsigned int length)
+	{
+		if (type == MessageType::OPEN_SESSION)
+		{
+			if (tap_ != nullptr)
+				tap_->onFrame(tapSessionId_, true, type, nullptr, 0);
+			becomeCarrier();
+
+			sessionsMutex_.lock();
+			std::function<void(unsigned short)> handler = sessionHandler_;
+			sessionsMutex_.unlock();
+			if (handler)
+				handler(sessionId);
+
+			// Not taken by the handler, so let the other end know it is closed
+			sessionsMutex_.lock();
+			bool isOpen = sessions_.find(sessionId) != sessions_.end();
+			sessionsMutex_.unlock();
+			if (!isOpen)
+			{
+				char header[kSessionHeaderLength];
+				header[0] = (char)(MessageType::FIN | kSessionFlag);
+				*(reinterpret_cast<unsigned short*>(header + 1)) = 0;
+				*(reinterpret_cast<unsigned short*>(header + 3)) = htons(sessionId);
+
+				sendMutex.lock();
+				bool result = writeOutgoing(header, kSessionHeaderLength);
+				sendMutex.unlock();
+				if (!result)
+					setLastError("Error refusing session");
+			}
+			return;
+		}
+
+		// Counted so the session can't be reused while the frame is handed to it
+		Connection *session = nullptr;
+		sessionsMutex_.lock();
+		std::map<unsigned short, Connection*>::iterator found = sessions_.find(sessionId);
+		if (found != sessions_.end())
+		{
+			session = found->second;
+			session->numActiveThreads_++;
+		}
+		sessionsMutex_.unlock();
+
+		// Already closed at this end, so whatever was on its way is dropped
+		if (session == nullptr)
+			return;
+
+		session->receiveSessionFrame(type, data, length);
+		session->numActiveThreads_--;
+	}
+
+	void Connection::receiveSessionFrame(MessageType type, const char * data, unsigned int length)
+	{
+		// Sessions are closed one way, there is nothing to acknowledge
+		if (type == MessageType::FIN || type == MessageType::FINACK)
+		{
+			verboseInfo("raw received FIN packet session:" << sessionId_);
+			closeSession(false);
+			return;
+		}
+		if (type == MessageType::HEARTBEAT || type == MessageType::OPEN_SESSION)
+			return;
+
+		if (tap_ != nullptr)
+			tap_->onFrame(tapSessionId_, true, type, data, length);
+
+		const unsigned int meta = 3;
+		char frame[kMaxMessageSize];
+		frame[0] = type;
+		*(reinterpret_cast<unsigned short*>(frame + 1)) = htons((unsigned short)length);
+		memcpy(frame + meta, data, length);
+
+		// Only this session waits on a slow reader, its frames pile up in the backlog until it has taken in too much
+		processMutex.lock();
+		bool isOverflowing = false;
+		if (sessionBacklog_.empty() && idxQueuedMessagesStart_ != (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages)
+		{
+			memcpy(queuedMessages_[idxQueuedMessagesEnd_], frame, meta + length);
+			idxQueuedMessagesEnd_ = (idxQueuedMessagesEnd_ + 1) % kMaxNumberOfMessages;
+		}
+		else if (sessionBacklogBytes_ + meta + length <= kMaxSessionBacklog)
+		{
+			sessionBacklog_.push_back(std::string(frame, meta + length));
+			sessionBacklogBytes_ += meta + length;
+		}
+		else
+		{
+			isOverflowing = true;
+		}
+		verboseInfo("raw received packet type:" << (int)type << " length:" << length << " session:" << sessionId_);
+		processMutex.unlock();
+
+		if (isOverflowing)
+		{
+			setLastError("Session reader too slow");
+			verboseInfo("closing session that isn't keeping up");
+			closeSession(true);
+			return;
+		}
+
+		notifyMessageWaiters();
+		dispatchInput();
+	}
+
+	void Connection::closeSession(bool notify)
+	{
+		// Whoever takes the session out of the carrier closes it, anyone else finds it closed already
+		bool isClosing = false;
+		numSending_++;
+		if (isConnected_)
+		{
+			carrier_->sessionsMutex_.lock();
+			std::map<unsigned short, Connection*>::iterator found = carrier_->sessions_.find(sessionId_);
+			isClosing = found != carrier_->sessions_.end() && found->second == this;
+			if (isClosing)
+				carrier_->sessions_.erase(found);
+			carrier_->sessionsMutex_.unlock();
+		}
+
+		if (isClosing)
+		{
+			if (notify)
+				sendSessionPayload(MessageType::FIN, nullptr, 0);
+			isConnected_ = false;
+		}
+		numSending_--;
+
+		if (isClosing)
+		{
+			// Sends already under way finish with the carrier before it is let go
+			while (numSending_ > 0)
+				std::this_thread::yield();
+			carrier_->numActiveThreads_--;
+
+			if (tap_ != nullptr)
+				tap_->onClose(tapSessionId_);
+		}
+
+		notifyMessageWaiters();
+		dispatchInput();
+
+		if (!isConnected_)
+		{
+			std::lock_guard<std::recursive_mutex> lock(closeMutex_);
+			std::function<void()> handler;
+			handler.swap(closeHandler_);
+			if (handler)
+				handler();
+		}
+	}
+
+	void Connection::closeSessions()
+	{
+		// Counted so none of them can be reused before it is closed here
+		std::vector<Connection*> sessions;
+		sessionsMutex_.lock();
+		for (std::map<unsigned short, Connection*>::iterator it = sessions_.begin(); it != sessions_.end(); ++it)
+		{
+			it->second->numActiveThreads_++;
+			sessions.push_back(it->second);
+		}
+		sessionsMutex_.unlock();
+
+		for (unsigned int i = 0; i < sessions.size(); i++)
+		{
+			sessions[i]->closeSession(false);
+			sessions[i]->numActiveThreads_--;
+		}
+	}
+
+	unsigned int Connection::detachSocket()
+	{
+#ifdef _WIN32
+		setLastError("Detaching a socket isn't supported");
+		return INVALID_SOCKET;
+#else
+		installInterruptHandler();
+
+		// Sessions can't follow the socket anywhere
+		if (carrier_ != nullptr || isCarrier_)
+			return INVALID_SOCKET;
+
+		// Anything partly written would be cut off mid frame
+		sendMutex.lock();
+		bool canDetach = isConnected_ && !waitingForAck_ && !isDetaching_ && outgoingLength_ == 0 && pendingFrames_.empty();
+		if (canDetach)
+		{
+			isDetaching_ = true;
+			isConnected_ = false;
+		}
+		sendMutex.unlock();
+
+		if (!canDetach)
+			return INVALID_SOCKET;
+
+		// Keep interrupting the receiving thread until it has left, a signal landing just before it starts waiting is missed
+		if (isUringBacked_)
+			UringReactor::get()->remove(uringId_);
+		while (true)
+		{
+			receiveThreadMutex_.lock();
+			bool isDone = isReceiveThreadDone_;
+			if (!isDone && !isUringBacked_)
+				pthread_kill(receiveThread_, kInterruptSignal);
+			receiveThreadMutex_.unlock();
+
+			if (isDone)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		// A heartbeat already being sent has to finish before anyone else writes to the socket
+		stopTimers();
+		while (numActiveThreads_ > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		isDetaching_ = false;
+		if (tap_ != nullptr)
+			tap_->onClose(tapSessionId_);
+		notifyMessageWaiters();
+		dispatchInput();
+
+		// The heartbeat only went partly out, or the reactor already took in part of the next frame, so the stream can't be picked up anywhere else
+		if (!pendingFrames_.empty() || !inputBuffer_.empty())
+		{
+			setLastError("Socket detached mid frame");
+			shutdown(socket_, SHUT_RDWR);
+			closesocket(socket_);
+			return INVALID_SOCKET;
+		}
+		return socket_;
+#endif
+	}
+
+	bool Connection::adoptSocket(unsigned int socket, Connection & outConnection)
+	{
+		if (socket == (unsigned int)INVALID_SOCKET)
+			return false;
+
+		if (!isInit_)
+			init();
+
+		outConnection.isConnected_ = true;
+		outConnection.socket_ = socket;
+		outConnection.isHosting_ = true;
+		outConnection.run();
+		return true;
+	}
+
+	ConnectionListener::ConnectionListener()
+	{
+		socket_ = INVALID_SOCKET;
+		wakeSocket_ = INVALID_SOCKET;
+		isListening_ = false;
+	}
+
+	unsigned int ConnectionListener::makeWakeSocket()
+	{
+		SOCKET sockWake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (sockWake != INVALID_SOCKET)
+		{
+			SOCKADDR_IN wakeAddress;
+			memset(&wakeAddress, 0, sizeof wakeAddress);
+			wakeAddress.sin_family = AF_INET;
+			wakeAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			wakeAddress.sin_port = 0;
+			if (bind(sockWake, (SOCKADDR*)&wakeAddress, sizeof wakeAddress) == SOCKET_ERROR || !setBlocking(sockWake, false))
+			{
+				setLastError("Error binding wake socket");
+				printSockError("");
+				closesocket(sockWake);
+				sockWake = INVALID_SOCKET;
+			}
+		}
+		return sockWake;
+	}
+
 	void ConnectionListener::end()
 	{
 		if (isListening_)
 		{
 			shutdown(socket_, SHUT_RDWR);
 			closesocket(socket_);
+			if (wakeSocket_ != (unsigned int)INVALID_SOCKET)
+				closesocket(wakeSocket_);
+			wakeSocket_ = INVALID_SOCKET;
 			isListening_ = false;
+
+#ifndef _WIN32
+			// Leaves nothing behind for the next listener on the path to clean up
+			if (!unixPath_.empty())
+				unlink(unixPath_.c_str());
+#endif
+			unixPath_.clear();
 		}
 	}
 
@@ -496,27 +2389,93 @@ namespace checkers
 		return isListening_;
 	}
 
-	bool ConnectionListener::acceptConnection(Connection & outConnection, unsigned int timeout)
+	unsigned int ConnectionListener::acceptSocket(unsigned int timeout)
 	{
-		timeout;
+		if (!waitForSocket(socket_, false, timeout, wakeSocket_))
+		{
+			// Drain any wake up so the next wait isn't cut short by it
+			char drain[16];
+			while (wakeSocket_ != (unsigned int)INVALID_SOCKET && recv(wakeSocket_, drain, sizeof drain, 0) > 0) {}
+			return INVALID_SOCKET;
+		}
 
 		struct sockaddr_storage incAddr;
-		socklen_t incAddrSize = sizeof incAddr;
-
+		AddressLength incAddrSize = sizeof incAddr;
 
 		SOCKET sockIncomingConnection = accept(socket_, (sockaddr*)&incAddr, &incAddrSize);
-		if (sockIncomingConnection != INVALID_SOCKET)
+		if (sockIncomingConnection == INVALID_SOCKET)
 		{
-			outConnection.isConnected_ = true;
-			outConnection.socket_ = sockIncomingConnection;
-			outConnection.isHosting_ = true;
-			outConnection.run();
-			return true;
+			int error = WSAGetLastError();
+			if (error != WSAEWOULDBLOCK)
+			{
+				setLastError("Error on accepting");
+				printSockError("");
+			}
+			return INVALID_SOCKET;
 		}
-		else
+
+		// Accepted sockets may inherit the listener's non-blocking mode
+		if (!setBlocking(sockIncomingConnection, true))
+		{
+			setLastError("Error setting accepted socket blocking");
+			printSockError("");
+			closesocket(sockIncomingConnection);
+			return INVALID_SOCKET;
+		}
+		return sockIncomingConnection;
+	}
+
+	bool ConnectionListener::acceptConnection(Connection & outConnection, unsigned int timeout)
+	{
+		SOCKET sockIncomingConnection = acceptSocket(timeout);
+		if (sockIncomingConnection == INVALID_SOCKET)
+			return false;
+
+		// Unix domain sockets have no Nagle's algorithm to disable
+		if (unixPath_.empty() && !disableNagle(sockIncomingConnection))
 		{
+			setLastError("Error setting TCP_NODELAY");
+			printSockError("");
+		}
+		outConnection.isConnected_ = true;
+		outConnection.socket_ = sockIncomingConnection;
+		outConnection.isHosting_ = true;
+		outConnection.run();
+		return true;
+	}
+
+	bool ConnectionListener::acceptAndReply(const std::function<std::string()>& makeReply, unsigned int timeout)
+	{
+		SOCKET sockIncomingConnection = acceptSocket(timeout);
+		if (sockIncomingConnection == INVALID_SOCKET)
 			return false;
+
+		std::string reply = makeReply();
+		const char * buffers[] = { reply.data() };
+		const unsigned int lengths[] = { (unsigned int)reply.size() };
+		if (!sendGathered(sockIncomingConnection, buffers, lengths, 1))
+		{
+			setLastError("Error sending reply");
+			printSockError("");
+		}
+
+		shutdown(sockIncomingConnection, SHUT_RDWR);
+		closesocket(sockIncomingConnection);
+		return true;
+	}
+
+	void ConnectionListener::interrupt()
+	{
+		if (wakeSocket_ == (unsigned int)INVALID_SOCKET)
+			return;
+
+		SOCKADDR_IN wakeAddress;
+		AddressLength wakeAddressLength = sizeof wakeAddress;
+		if (getsockname(wakeSocket_, (SOCKADDR*)&wakeAddress, &wakeAddressLength) != SOCKET_ERROR)
+		{
+			char poke = 0;
+			sendto(wakeSocket_, &poke, sizeof poke, 0, (SOCKADDR*)&wakeAddress, wakeAddressLength);
 		}
 	}
 
-}
+}
\ No newline at end of file
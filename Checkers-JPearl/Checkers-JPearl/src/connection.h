@@ -4,6 +4,14 @@
 
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <map>
 
 #ifdef DEBUG
 	#include <iostream>
@@ -20,35 +28,208 @@ namespace checkers
 		REQUEST_INPUT = 1,
 		WINNER_RESULT = 2,
 		FIN = 3,
-		FINACK = 4
+		FINACK = 4,
+		HEARTBEAT = 5, // Sent when nothing else has gone out for a while. Never queued or handed to the reader
+		OPEN_SESSION = 6 // Opens the session it is sent on. Never queued or handed to the reader
 	};
+	// A complete frame (header and payload) encoded once and shared by everyone it is sent to. Never modified once encoded
+	typedef std::shared_ptr<const std::string> SharedFrame;
+
+	// Gets a copy of every frame a connection sends or receives, eg. to record sessions. Called from whichever thread sent or received the frame
+	class ConnectionTap
+	{
+	public:
+		virtual ~ConnectionTap() {}
+
+		// isIncoming is set for frames received from the other end. Data is the frame's payload
+		virtual void onFrame(unsigned int sessionId, bool isIncoming, MessageType type, const char * data, unsigned int length) = 0;
+		virtual void onClose(unsigned int sessionId) = 0;
+	};
+
+	// Counts kept across every connection in the process. Only atomics, so they may be placed in memory shared with other processes
+	struct ConnectionTotals
+	{
+		std::atomic<unsigned long long> bytesSent, bytesReceived; // Framing included
+		std::atomic<unsigned long long> slowReceiversDropped; // Dropped for not keeping up with what was sent to them
+		std::atomic<unsigned long long> deadPeersDropped; // Dropped for not being heard from within the heartbeat timeout
+
+		ConnectionTotals();
+	};
+
 	class ConnectionListener;
 	class Connection
 	{
 		static const int kMaxMessageSize = 1280;
 		static const int kMaxNumberOfMessages = 3;
+		static const int kMaxOutgoingSize = kMaxMessageSize * 4; // How much can be held back while corked before it is forced out
 		static int lastError_;
 		static bool isInit_;
 		static const char * connectionErrorMessage_;
 		static const int kAckTimeoutMilliseconds = 1000; // Wait 1 second and assume ACK was received
+		static const int kHeartbeatIntervalMilliseconds = 1000; // How often the connection is checked on, and a heartbeat sent if nothing else was
+		static const unsigned int kDefaultHeartbeatTimeoutMilliseconds = 10000;
+		static const int kBindRetryMilliseconds = 50; // How long to wait before trying to bind to a port that is still in use
+		static const unsigned int kSendHighWatermark = 64 * 1024; // Bytes waiting on a slow receiver before shared frames are skipped and it is counted as backed up
+		static const unsigned int kSendLowWatermark = 16 * 1024; // Bytes it has to get back under to stop counting as backed up
+		static const unsigned int kMaxPendingBytes = 256 * 1024; // Most that may ever wait on a receiver. Going over drops it
+		static const int kSlowReceiverMilliseconds = 5000; // Longest a receiver may stay backed up before it is dropped
+		static const int kFlushWaitMilliseconds = 100; // Longest the flushing thread waits on the socket before checking the connection again
+		static const int kMessageWaitMilliseconds = 100; // Longest waitUntilHasMessage() sleeps before checking the connection again on its own
+		static const unsigned char kSessionFlag = 0x80; // Set in the type of frames that belong to a session. Their header has the session id (2 bytes, network order) after the length
+		static const unsigned int kSessionHeaderLength = 5;
+		static const unsigned int kMaxSessionBacklog = 64 * 1024; // Bytes a session may receive beyond what fits in its queue before it is closed
 		
 		unsigned int socket_;
 		bool isHosting_:1;
 		bool isConnected_:1;
 		bool waitingForAck_:1;
+		bool isCorked_:1;
 
-		// Circular buffer of messages
+		// Circular buffer of messages. Each slot and the message the reader is on point into messageBuffers_, so taking a message swaps pointers instead of copying it
 		unsigned char idxQueuedMessagesStart_, idxQueuedMessagesEnd_;
-		char queuedMessages_[kMaxMessageSize * kMaxNumberOfMessages];
-		char currentMessage_[kMaxMessageSize];
+		char *queuedMessages_[kMaxNumberOfMessages];
+		char *currentMessage_;
+		char messageBuffers_[kMaxMessageSize * (kMaxNumberOfMessages + 1)];
+
+		// Frames held back while corked, written out together with the next frame that needs to go out immediately
+		unsigned int outgoingLength_;
+		char outgoing_[kMaxOutgoingSize];
+
+		// Frames that couldn't be sent without blocking, written out by a flushing thread. The front one may be partially sent already. Guarded by sendMutex
+		std::deque<SharedFrame> pendingFrames_;
+		unsigned int pendingOffset_;
+		unsigned int pendingBytes_; // Not yet sent of the pending frames
+		unsigned int numSkippedFrames_; // Frames skipped in a row because too many were pending
+		bool isBackedUp_; // Went over the high watermark and hasn't come back under the low one yet
+		std::chrono::steady_clock::time_point backedUpSince_;
+		bool isFlushing_; // A thread, or the io_uring reactor, is writing out the pending frames
+		bool isTooSlow_; // Fell too far behind and should be dropped as soon as sendMutex is released
 
 		std::mutex sendMutex, processMutex;
 
+		// Signalled when a message is queued or the connection closes, so waiting threads can sleep instead of spinning
+		mutable std::mutex messageMutex_;
+		mutable std::condition_variable messageArrived_;
+
+		// Waiting on the reply to requestInputAsync(). Guarded by messageMutex_
+		std::function<void(bool, const std::string&)> inputHandler_;
+
+		// Called once the connection closes. Held while it runs so clearing it waits for a call in progress, except from the handler itself
+		std::recursive_mutex closeMutex_;
+		std::function<void()> closeHandler_;
+
+		// Number of threads and timers (receiving, flushing, heartbeats or waiting on a FIN acknowledgement) still using this connection
+		std::atomic<int> numActiveThreads_;
+
+		// Set while detachSocket() stops the receiving thread without closing the socket
+		std::atomic<bool> isDetaching_;
+		// The receiving thread, which may only be signalled while it hasn't finished. Guarded by receiveThreadMutex_
+		std::mutex receiveThreadMutex_;
+		std::thread::native_handle_type receiveThread_;
+		bool isReceiveThreadDone_;
+
+		// Received for and sent from by the io_uring reactor rather than threads of its own
+		bool isUringBacked_;
+		unsigned long long uringId_;
+		// Received bytes not yet making up a whole frame, or waiting for room in the queue. Only touched by the reactor
+		std::string inputBuffer_;
+		bool isReceiveDone_; // Nothing more received will be looked at. Only touched by the reactor
+		bool isInputWaiting_; // The reactor is holding frames back until the reader makes room. Guarded by processMutex
+		bool isReceiveStopped_; // The reactor won't touch the socket again to receive. Guarded by sendMutex
+		bool isSocketClosePending_; // The socket is closed once the send in flight completes. Guarded by sendMutex
+
+		// Times (in milliseconds on the steady clock) anything was last received from or sent to the other end
+		std::atomic<long long> lastReceivedAt_, lastSentAt_;
+
+		// Pending timers on the timer wheel, 0 when none. Guarded by timerMutex_
+		std::mutex timerMutex_;
+		unsigned long long heartbeatTimer_;
+		unsigned long long ackTimer_;
+
+		ConnectionTap *tap_;
+		unsigned int tapSessionId_;
+
+		// Sessions carried over this connection, by id. Guarded by sessionsMutex_
+		std::mutex sessionsMutex_;
+		std::map<unsigned short, Connection*> sessions_;
+		unsigned short lastSessionId_; // Last id openSession() handed out
+		std::function<void(unsigned short)> sessionHandler_;
+		bool isCarrier_; // Sessions were opened over it, so nothing received for the connection itself is kept anymore
+
+		// Set on a session carried over another connection, which sends and receives for it
+		Connection *carrier_;
+		unsigned short sessionId_;
+		std::atomic<int> numSending_; // Calls using the carrier in progress. The carrier is kept until they are done
+		// Frames received for the session while its queue was full, moved in as the reader makes room. Guarded by processMutex
+		std::deque<std::string> sessionBacklog_;
+		unsigned int sessionBacklogBytes_;
+
+		static ConnectionTotals *totals_;
+		static std::atomic<unsigned int> heartbeatTimeout_;
+
 		bool sendPayload(MessageType type, const char * data = nullptr, unsigned int length = 0);
+		// sendPayload() for a session, through its carrier. Plain messages are held back while corked unless mayHoldBack is cleared
+		bool sendSessionPayload(MessageType type, const char * data, unsigned int length, bool mayHoldBack = true);
+		// Writes out anything held back, then the frames in held (eg. a session's held back frames), followed by the given frame in a single call without blocking. Whatever the socket won't take right away is queued. Expects sendMutex to be held
+		bool writeOutgoing(const char * header = nullptr, unsigned int headerLength = 0, const char * data = nullptr, unsigned int length = 0, const char * held = nullptr, unsigned int heldLength = 0);
+		// Queues a frame behind the pending ones and starts a thread flushing them if there isn't one. Returns false if the receiver has fallen too far behind. Expects sendMutex to be held
+		bool queuePending(const SharedFrame &frame);
+		// Sends as much of the pending frames as possible, waiting for up to timeout (in milliseconds) for the socket to take more. Returns false on a socket error. Expects sendMutex to be held
+		bool sendPendingFrames(unsigned int timeout);
+		// Writes out the pending frames as the socket takes them, until there are none left, the connection closes, or the receiver stays backed up too long
+		void flushLoop();
+		// Drops the connection if it was found to be too slow
+		void dropIfTooSlow();
 
 		// Starts running this connection on a new thread and keeping track of new messages
 		void run();
 		void runLoop();
+		// Acts on the frame received into the end of the queue, and queues it if it is for the reader. Returns false if nothing more should be received
+		bool handleReceivedFrame(unsigned short length);
+		// Shuts the socket down and closes it, or has the reactor close it once it stops using it
+		void closeSocket();
+
+		// Stops keeping anything received for the connection itself, once it carries sessions
+		void becomeCarrier();
+		// Makes session the one with the id over this connection. Expects sessionsMutex_ to be held
+		void attachSession(Connection &session, unsigned short sessionId);
+		// Hands a frame received for a session over this connection to it, or opens it
+		void routeSessionFrame(unsigned short sessionId, MessageType type, const char * data, unsigned int length);
+		// Queues a frame received for this session
+		void receiveSessionFrame(MessageType type, const char * data, unsigned int length);
+		// Closes this session, telling the other end if notify is set
+		void closeSession(bool notify);
+		// Closes every session carried over this connection
+		void closeSessions();
+
+		// Called by the io_uring reactor
+
+		// Takes in received bytes and queues every whole frame there is room for. Called with no data to carry on once the reader made room
+		void onReceived(const char * data, unsigned int length);
+		// Bytes received but not yet queued
+		unsigned int getBufferedInput() const;
+		// The other end closed or receiving failed
+		void onReceiveFailed();
+		// The reactor stopped receiving for this connection and won't call it again
+		void onReceiveStopped();
+		// Hands out up to maxFrames of the pending frames to send, the first from outOffset on. Returns how many, 0 if there is nothing (more) to send, in which case flushing is over
+		unsigned int takePendingFrames(SharedFrame * outFrames, unsigned int maxFrames, unsigned int &outOffset);
+		// A send of the pending frames starting with firstFrame completed, with the bytes sent or a negative error
+		void onFramesSent(int result, const SharedFrame &firstFrame);
+		// Wakes up everyone in waitUntilHasMessage()
+		void notifyMessageWaiters();
+		// Hands the next message to the input handler, if there is one and a message is waiting or the connection has closed
+		void dispatchInput();
+		// Sends a heartbeat if nothing else went out lately and drops the other end if it hasn't been heard from within the timeout
+		void onHeartbeatTimer();
+		// Closes the connection if the other end never acknowledged our FIN
+		void onAckTimeout();
+		// Cancels the heartbeat and FIN acknowledgement timers once the connection is closed
+		void stopTimers();
+
+		// listenTo() and connectTo() for a unix domain socket at path
+		static bool listenToUnix(const char * path, ConnectionListener &outListener, std::chrono::steady_clock::time_point deadline, bool sharePort);
+		static bool connectToUnix(const char * path, Connection &outConnection, std::chrono::steady_clock::time_point deadline);
 	public:
 		static void init();
 		static void cleanup();
@@ -56,46 +237,136 @@ namespace checkers
 
 		Connection();
 		
-		// Listens on the port given for any incoming connection and will write it to the given outConnection parameter. Returns whether a connection was found before timeout (in milliseconds)
-		static bool listenTo(const char * port, ConnectionListener &outListener, unsigned int timeout = 1000);
+		// Addresses of the form "unix:<path>" are unix domain sockets at path rather than TCP, for clients on the same machine (POSIX only). Frames are the same over either
+		static bool isUnixAddress(const char * address);
 
+		// Starts listening on the port given, or the unix domain socket if it is a unix address, and writes the listener to outListener. Keeps retrying while the port is still held by a previous listener until timeout (in milliseconds). Only accepts connections from this machine if loopbackOnly is set.
+		// With sharePort set, other listeners that also share it may listen on the same port at once and the system spreads incoming connections across them (POSIX only). Returns whether it is listening
+		static bool listenTo(const char * port, ConnectionListener &outListener, unsigned int timeout = 1000, bool loopbackOnly = false, bool sharePort = false);
+
+		// Connects to the host, or the unix domain socket if it is a unix address in which case port is ignored, and writes the connection to outConnection. Gives up on the host if it can't be reached before timeout (in milliseconds). Returns whether it is connected
 		static bool connectTo(const char * host, const char * port, Connection &outConnection, unsigned int timeout = 1000);
 
 		void disconnect(bool waitForSendToComplete = true);
 
+		// While corked, messages are held back and sent together with the next input request, winner result, or call to flush(). Connections are uncorked by default
+		void setCorked(bool isCorked);
+
+		// Hands every frame sent or received from now on to the tap under the given session id. Pass nullptr to stop. Set it before the connection is made to see every frame
+		void setTap(ConnectionTap *tap, unsigned int sessionId);
+
+		// Sends out any messages held back while corked. Returns whether it was successful
+		bool flush();
+
+		// Messages are sent without ever blocking the caller. What the socket won't take right away is queued and written out by a separate thread, or by the io_uring reactor when it is running. A receiver that stays backed up for too long, or lets too much pile up, is dropped
+
 		// Sends a message to the other end. Returns whether it was successful
-		bool sendMessage(std::string message);
+		bool sendMessage(const std::string &message);
+		bool sendMessage(const char * message);
+		// Sends length characters of message, written out straight from the caller's buffer. It must be followed by a terminator, as C strings and std::string are
+		bool sendMessage(const char * message, unsigned int length);
+
+		// Encodes a frame once so it can be handed to any number of connections with sendFrame(). Returns nullptr if the payload is too large
+		static SharedFrame encodeFrame(MessageType type, const char * data, unsigned int length);
+
+		// Queues a shared frame and sends what it can without blocking. If the receiver is backed up, the frame is skipped instead. Returns false if the connection failed
+		bool sendFrame(const SharedFrame &frame);
+
+		// Waits up to timeout (in milliseconds) for frames queued by sendFrame() to be sent. Returns whether everything was sent
+		bool flushFrames(unsigned int timeout);
+
+		// Number of frames skipped in a row because the receiver couldn't keep up
+		unsigned int getNumSkippedFrames() const;
 
 		// Sends the winner index to the other end. Returns whether it was successful
 		bool sendWinner(int result);
 
 		// Requests a message from the other end. Returns whether it was successful
 		bool requestInput(std::string &outResponse);
+		// Requests a message from the other end without waiting for it. onResponse is called exactly once with whether a message was received and the message, on whichever thread receives it or notices the connection close
+		void requestInputAsync(const std::function<void(bool received, const std::string &response)> &onResponse);
+		// Gives up on the reply to requestInputAsync(), calling its onResponse with nothing received. Does nothing if no reply is awaited
+		void cancelInputRequest();
 
-		// Yields current thread until this connection has a message or disconnects. Returns whether there is a message.
+		// Has onClose called once, on whichever thread closes the connection. Pass nullptr to stop, which waits for a call already in progress
+		void setCloseHandler(const std::function<void()> &onClose);
+
+		// Sleeps until this connection has a message or disconnects. Returns whether there is a message.
 		bool waitUntilHasMessage() const;
+		// Same as above, but gives up after timeout (in milliseconds)
+		bool waitUntilHasMessage(unsigned int timeout) const;
 
 		// Returns whether the connection has a message waiting and prepare it
 		bool hasMessageWaiting() const;
 
-		// If a message is waiting return it. Pointer is to the start of the payload. Payload is invalidated on next call to processMessage(). Meta information is returned through the parameters. If no message is waiting will return nullptr
+		// If a message is waiting return it. Pointer is to the start of the payload, read in place where it was received. Payload is invalidated on next call to processMessage(). Meta information is returned through the parameters. If no message is waiting will return nullptr
 		const char * processMessage(MessageType &outType, unsigned int &outLength);
 
 		bool isConnected() const;
 		bool isHosting() const;
 
+		// Bytes sent and received so far by all connections in the process
+		static unsigned long long getTotalBytesSent();
+		static unsigned long long getTotalBytesReceived();
+		// Connections dropped so far for not keeping up with what was sent to them
+		static unsigned long long getTotalSlowReceiversDropped();
+		// Connections dropped so far for going silent
+		static unsigned long long getTotalDeadPeersDropped();
+		// Counts into totals from now on instead of the process' own, eg. to count with other processes in shared memory. Set before any connection is made
+		static void shareTotals(ConnectionTotals *totals);
+
+		// Every connection sends a heartbeat each second nothing else is sent. A connection that hears nothing from the other end for timeout (in milliseconds) drops it. 0 never drops. Affects connections already made
+		static void setHeartbeatTimeout(unsigned int timeout);
+
+		// Returns whether the connection is closed and none of its threads are still running, meaning it can be safely destroyed or reused
+		bool isIdle() const;
+
+		// Any number of sessions can be carried over one connection. Each is a Connection of its own to send and receive messages on, with its own queue, but no socket or threads. A session that lets too much pile up unread is closed without holding up the others.
+		// A connection carrying sessions keeps nothing received for itself and stays open until every session has closed. Sessions close when either end disconnects them or the connection closes, and are never waited on for an acknowledgement
+
+		// Opens a session over this connection and writes it to outSession, which must be idle. Returns whether it was opened
+		bool openSession(Connection &outSession);
+		// Has onOpen called with the id of every session the other end opens, on the receiving thread. The handler takes it with acceptSession(), otherwise it is refused
+		void setSessionHandler(const std::function<void(unsigned short sessionId)> &onOpen);
+		// Takes a session the other end opened and writes it to outSession, which must be idle. Returns whether it was taken
+		bool acceptSession(unsigned short sessionId, Connection &outSession);
+
+		// Stops the connection without closing it and returns its socket, eg. to hand it to another process which takes it over with adoptSocket(). Messages received but not yet processed are lost and the close handler isn't called.
+		// Returns an invalid socket, leaving the connection as it was, if it is closing, carries sessions, is a session, or something sent is still waiting to go out. Not supported on Windows
+		unsigned int detachSocket();
+		// Takes over a connected socket, eg. one detached in another process, as the hosting end and writes the connection to outConnection. Returns whether it was taken over
+		static bool adoptSocket(unsigned int socket, Connection &outConnection);
+
 		friend class ConnectionListener;
+		friend class UringReactor;
 	};
 	class ConnectionListener
 	{
 		unsigned int socket_;
+		unsigned int wakeSocket_; // Loopback datagram socket that interrupt() pokes to cut a wait in acceptConnection short
 		bool isListening_;
 		char address_[32];
+		std::string unixPath_; // Socket file removed when the listener ends, empty when listening on a port
+
+		// Waits up to timeout (in milliseconds) for an incoming connection and accepts it. Returns the new socket or an invalid socket if nothing was accepted
+		unsigned int acceptSocket(unsigned int timeout);
+		// Binds a loopback datagram socket for interrupt() to poke. Returns an invalid socket if it couldn't
+		static unsigned int makeWakeSocket();
 	public:
+		ConnectionListener();
+
 		void end();
 
 		bool isListening() const;
+
+		// Waits up to timeout (in milliseconds) for an incoming connection and writes it to outConnection. Returns whether a connection was accepted before timeout or interrupt()
 		bool acceptConnection(Connection &outConnection, unsigned int timeout = 1000);
+
+		// Waits up to timeout (in milliseconds) for an incoming connection, writes the text from makeReply to it as is (unframed) and closes it. For plain text endpoints that can be read with any TCP client. Returns whether a connection was served
+		bool acceptAndReply(const std::function<std::string()> &makeReply, unsigned int timeout = 1000);
+
+		// Wakes up any thread waiting in acceptConnection. Safe to call from any thread
+		void interrupt();
 	
 		friend class Connection;
 	};
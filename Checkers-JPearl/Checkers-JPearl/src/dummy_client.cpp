@@ -1,14 +1,72 @@
 #include "dummy_client.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 
 #include "connection.h"
+#include "move.h"
 
 namespace checkers
 {
 	const char * DummyClient::kDefaultPort = "32123";
 
+	std::vector<std::string> DummyClient::parseAvailableMoves(const std::string & text)
+	{
+		std::vector<std::string> moves;
+
+		size_t section = text.rfind("Available Moves:");
+		if (section == std::string::npos)
+			return moves;
+
+		// Moves are listed one per line as "\t<number>) <move>"
+		size_t lineStart = text.find('\n', section);
+		while (lineStart != std::string::npos && lineStart + 1 < text.size() && text[lineStart + 1] == '\t')
+		{
+			size_t lineEnd = text.find('\n', lineStart + 1);
+			std::string line = text.substr(lineStart + 2, (lineEnd == std::string::npos) ? std::string::npos : lineEnd - lineStart - 2);
+
+			size_t separator = line.find(") ");
+			if (separator != std::string::npos)
+				moves.push_back(line.substr(separator + 2));
+
+			lineStart = lineEnd;
+		}
+		return moves;
+	}
+
+	std::string DummyClient::readResponse(const std::vector<std::string>& availableMoves)
+	{
+		std::string response = std::string();
+		while (std::getline(std::cin, response))
+		{
+			// Prompts without moves aren't for a move, and forfeiting is always allowed
+			if (availableMoves.empty() || response.find("FORFEIT") != std::string::npos || response.find("forfeit") != std::string::npos)
+				break;
+
+			// Same checks the server makes, the moves it listed are every move it will accept. Moves planned for later turns can only be checked once they come up
+			try
+			{
+				std::vector<std::pair<Move, Move>> conditionalMoves;
+				std::ostringstream move = std::ostringstream();
+				move << Move::parseWithConditionalMoves(response.c_str(), conditionalMoves);
+				if (std::find(availableMoves.begin(), availableMoves.end(), move.str()) != availableMoves.end())
+					break;
+
+				std::cout << "Not a valid move. " << move.str() << " isn't one of the available moves\nTry again > " << std::flush;
+			}
+			catch (std::exception& e)
+			{
+				std::cout << "Invalid formatting: " << e.what() << "\nTry again > " << std::flush;
+			}
+		}
+		return response;
+	}
+
 	int DummyClient::run()
 	{
 		std::cout << "Enter Host Address (default \"localhost\") > ";
@@ -17,16 +75,20 @@ namespace checkers
 		if (host.empty())
 			host = "localhost";
 
-		std::cout << "Enter Port (default " << kDefaultPort << ") > ";
+		// A unix domain socket is all there is to its address
 		std::string port = std::string();
-		std::getline(std::cin, port);
-		if (port.empty())
-			port = kDefaultPort;
+		if (!Connection::isUnixAddress(host.c_str()))
+		{
+			std::cout << "Enter Port (default " << kDefaultPort << ") > ";
+			std::getline(std::cin, port);
+			if (port.empty())
+				port = kDefaultPort;
+		}
 
 		int winner = -1;
 
 		Connection conn;
-		if (Connection::connectTo(host.c_str(), port.c_str(), conn))
+		if (Connection::connectTo(host.c_str(), port.c_str(), conn, kConnectTimeoutMilliseconds))
 		{
 			while (conn.isConnected())
 			{
@@ -44,11 +106,12 @@ namespace checkers
 						{
 						case MessageType::SEND_MESSAGE:
 							std::cout << data << std::flush;
+							transcript_.append(data);
 							break;
 						case MessageType::REQUEST_INPUT:
 						{
-							std::string response = std::string();
-							std::getline(std::cin, response);
+							std::string response = readResponse(parseAvailableMoves(transcript_));
+							transcript_.clear();
 							conn.sendMessage(response);
 							break;
 						}
@@ -60,6 +123,10 @@ namespace checkers
 				}
 			}
 			std::cout << "Connection to server terminated " << std::endl;
+
+			// Its threads may still be finishing up with it, eg. after the server went away
+			while (!conn.isIdle())
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
 		}
 		else
 		{
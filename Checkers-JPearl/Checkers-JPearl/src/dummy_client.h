@@ -2,12 +2,24 @@
 #ifndef DUMMY_CLIENT_H
 #define DUMMY_CLIENT_H
 
+#include <string>
+#include <vector>
+
 namespace checkers
 {
 	class DummyClient
 	{
+		// Text received since the last input was sent, which holds the board and moves for the current prompt
+		std::string transcript_;
+
+		// Returns the moves listed as available in the text, as the server writes them. Empty if it lists none
+		static std::vector<std::string> parseAvailableMoves(const std::string &text);
+		// Reads lines until one the server would accept for the prompt. Moves are checked against the available moves so a mistake is caught without asking the server
+		static std::string readResponse(const std::vector<std::string> &availableMoves);
+
 	public:
 		static const char * kDefaultPort;
+		static const int kConnectTimeoutMilliseconds = 5000;
 
 		int run();
 	};
@@ -1,19 +1,45 @@
 #include "game.h"
 
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #include "player.h"
 #include "ai_player.h"
+#include "broadcast_channel.h"
+#include "game_snapshot.h"
+#include "game_scheduler.h"
 #include "local_player.h"
+#include "metrics.h"
 #include "move.h"
+#include "timer_wheel.h"
 
 namespace checkers
 {
 	Game::Game(bool echoMessagesToConsole)
 	{
 		currentPlayerTurn_ = 0;
+		step_ = Step::NOT_STARTED;
+		winner_ = -1;
+		ending_ = Ending::PLAYED_OUT;
+		leavingPlayer_ = -1;
+		hasClock_ = false;
+		clockIncrement_ = 0;
+		clockPlayer_ = 0;
+		clockTimer_ = 0;
+		clockGeneration_ = 0;
+		numClockCallbacks_ = 0;
+		isOutOfTime_ = false;
+		autoPlaysForcedMoves_ = false;
+		keepsSnapshot_ = false;
+		keepsMoveHistory_ = false;
 		echoMessagesToConsole_ = echoMessagesToConsole;
+		checkerBoard_ = nullptr;
+		for (int i = 0; i < kNumPlayers; i++)
+			players_[i] = nullptr;
+		spectators_ = std::make_shared<BroadcastChannel>();
 	}
 
 	void Game::initialize()
@@ -43,6 +69,108 @@ namespace checkers
 		}
 	}
 
+	void Game::setClock(unsigned int baseTime, unsigned int increment)
+	{
+		hasClock_ = true;
+		clockIncrement_ = increment;
+		for (int i = 0; i < kNumPlayers; i++)
+			timeLeft_[i] = baseTime;
+	}
+
+	void Game::setAutoPlayForcedMoves(bool autoPlay)
+	{
+		autoPlaysForcedMoves_ = autoPlay;
+	}
+
+	void Game::setKeepsSnapshot(bool keepsSnapshot)
+	{
+		keepsSnapshot_ = keepsSnapshot;
+	}
+
+	std::string Game::getSnapshot()
+	{
+		std::lock_guard<std::mutex> lock(snapshotMutex_);
+		return snapshot_;
+	}
+
+	void Game::updateSnapshot()
+	{
+		if (!keepsSnapshot_)
+			return;
+
+		std::string snapshot;
+		SnapshotEncoder encoder(snapshot);
+		encoder.writeNumber(currentPlayerTurn_);
+		encoder.writeNumber(currentTurn_);
+		encoder.writeNumber(hasClock_ ? 1 : 0);
+		encoder.writeNumber(clockIncrement_);
+		for (int i = 0; i < kNumPlayers; i++)
+			encoder.writeNumber(std::max(0LL, timeLeft_[i]));
+
+		char board[CheckerBoard::kSnapshotSize];
+		checkerBoard_->writeSnapshot(board);
+		encoder.writeBytes(board, sizeof board);
+
+		// Needed to tell when a position has come up often enough for a draw
+		encoder.writeNumber(boardStateOccurences_.size());
+		for (std::map<uint_least64_t, unsigned char>::const_iterator it = boardStateOccurences_.begin(); it != boardStateOccurences_.end(); ++it)
+		{
+			encoder.writeNumber(it->first);
+			encoder.writeNumber(it->second);
+		}
+		encoder.writeString(moveHistory_);
+
+		std::lock_guard<std::mutex> lock(snapshotMutex_);
+		snapshot_.swap(snapshot);
+	}
+
+	bool Game::restoreSnapshot(const std::string & snapshot)
+	{
+		SnapshotDecoder decoder(snapshot);
+		unsigned long long playerTurn = decoder.readNumber();
+		unsigned long long turn = decoder.readNumber();
+		bool hasClock = decoder.readNumber() != 0;
+		unsigned long long clockIncrement = decoder.readNumber();
+		long long timeLeft[kNumPlayers];
+		for (int i = 0; i < kNumPlayers; i++)
+			timeLeft[i] = (long long)decoder.readNumber();
+		const char * board = decoder.readBytes(CheckerBoard::kSnapshotSize);
+
+		std::map<uint_least64_t, unsigned char> occurences;
+		unsigned long long numOccurences = decoder.readNumber();
+		for (unsigned long long i = 0; i < numOccurences && decoder.isValid(); i++)
+		{
+			uint_least64_t state = decoder.readNumber();
+			occurences[state] = (unsigned char)decoder.readNumber();
+		}
+		// Snapshots from before moves were kept end here
+		std::string moveHistory = decoder.isAtEnd() ? std::string() : decoder.readString();
+
+		if (!decoder.isValid() || !decoder.isAtEnd() || playerTurn >= kNumPlayers || !checkerBoard_->readSnapshot(board))
+			return false;
+
+		currentPlayerTurn_ = (unsigned char)playerTurn;
+		currentTurn_ = (int)turn;
+		hasClock_ = hasClock;
+		clockIncrement_ = (unsigned int)clockIncrement;
+		for (int i = 0; i < kNumPlayers; i++)
+			timeLeft_[i] = timeLeft[i];
+		boardStateOccurences_.swap(occurences);
+		if (keepsMoveHistory_)
+			moveHistory_.swap(moveHistory);
+		return true;
+	}
+
+	void Game::setKeepsMoveHistory(bool keepsMoveHistory)
+	{
+		keepsMoveHistory_ = keepsMoveHistory;
+	}
+
+	const std::string & Game::getMoveHistory() const
+	{
+		return moveHistory_;
+	}
+
 	std::ostream& Game::messageWriter()
 	{
 		return currentMessage_;
@@ -50,18 +178,42 @@ namespace checkers
 
 	void Game::sendMessageToPlayers(bool excludeCurrent)
 	{
+		// Copied out of the stream once, every player and spectator is sent the same bytes
+		const std::string message = currentMessage_.str();
 		for (int i = 0; i < kNumPlayers; i++)
 		{
 			if(!excludeCurrent || currentPlayerTurn_ != i)
-				players_[i]->sendMessage(currentMessage_.str().c_str());
+				players_[i]->sendMessage(message.c_str());
 		}
 
+		if (!excludeCurrent && spectators_->getNumSubscribers() > 0)
+			spectators_->publish(MessageType::SEND_MESSAGE, message.c_str(), (unsigned int)message.length() + 1);
+
 		if (echoMessagesToConsole_)
-			std::cout << currentMessage_.str() << std::flush;
+			std::cout << message << std::flush;
 
 		currentMessage_.str(std::string());
 	}
 
+	std::shared_ptr<BroadcastChannel> Game::getSpectators() const
+	{
+		return spectators_;
+	}
+
+	int Game::getCurrentTurn() const
+	{
+		return currentTurn_;
+	}
+
+	void Game::flushMessagesToPlayers(bool excludeCurrent)
+	{
+		for (int i = 0; i < kNumPlayers; i++)
+		{
+			if (!excludeCurrent || currentPlayerTurn_ != i)
+				players_[i]->flushMessages();
+		}
+	}
+
 	void Game::registerPlayer(Player * player, PieceSide side)
 	{
 		if (players_[side])
@@ -415,68 +567,280 @@ namespace checkers
 
 	int Game::run()
 	{
-		bool gameIsRunning = true;
-		int winner = -1;
+		start();
+		while (step_ == Step::AWAITING_MOVE)
+			submitMove(players_[currentPlayerTurn_]->requestMove());
+		return winner_;
+	}
 
-		while (gameIsRunning)
+	void Game::playAsync(GameScheduler & scheduler, const std::function<void(int winner)> & onFinished)
+	{
+		scheduler.post([this, &scheduler, onFinished] {
+			for (int i = 0; i < kNumPlayers; i++)
+				players_[i]->setOnDisconnect([this, i] { onPlayerLeft(i); });
+
+			start();
+			requestNextMove(scheduler, onFinished);
+		});
+	}
+
+	void Game::requestNextMove(GameScheduler & scheduler, const std::function<void(int)> & onFinished)
+	{
+		if (step_ != Step::AWAITING_MOVE)
 		{
-			messageWriter() << *checkerBoard_;
+			// Waits out anyone still reporting a player leaving, or a clock running out, so nothing touches the game after this
+			for (int i = 0; i < kNumPlayers; i++)
+				players_[i]->setOnDisconnect(nullptr);
+			while (numClockCallbacks_ > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+			onFinished(winner_);
+			return;
+		}
 
-			bool validMoveReceived = false;
-			while (!validMoveReceived)
-			{
-				// Prints available moves
-				messageWriter() << "Enter a move as {start} {destination1} {destinationX...}  Eg: c3 d4 or e3 c5 e7\n";
-				writeAllMovesAvailable(players_[currentPlayerTurn_]->getControllingSide());
-				messageWriter() << "You can also forfeit by typing 'FORFEIT'\n";
-
-				// Request move from player 
-				messageWriter() << players_[currentPlayerTurn_]->getDescriptor() << "Player '" << players_[currentPlayerTurn_]->getSymbol() << "'> ";
-				sendMessageToPlayers();
-				players_[currentPlayerTurn_]->sendMessage("[YOU] > ");
-				Move move = players_[currentPlayerTurn_]->requestMove();
-
-				// Display current move
-				messageWriter() << move << " -- Move provided\n";
-
-				// Check for forfeit
-				if (move.isForfeit())
-				{
-					messageWriter() << players_[currentPlayerTurn_]->getDescriptor() << "Player '" << players_[currentPlayerTurn_]->getSymbol() << "' forfeits...\n";
-					winner = ( (currentPlayerTurn_ + 1) % kNumPlayers ) + 1;
-					gameIsRunning = false;
-					break;
-				}
+		updateSnapshot();
 
-				// Attempt to take turn with the move
-				const char * error = attemptTurn(move);
-				if (error)
-					messageWriter() << "Not a valid move. " << error << '\n';
-				else
-					validMoveReceived = true;
-				sendMessageToPlayers();
+		std::lock_guard<std::recursive_mutex> lock(leavingMutex_);
+		Player::MoveHandler playMove = [this, &scheduler, onFinished](const Move &move) {
+			scheduler.post([this, &scheduler, onFinished, move] {
+				stopClock();
+				submitMove(move);
+				requestNextMove(scheduler, onFinished);
+			});
+		};
+
+		// Nobody is asked for a move once a player has left, the forfeit goes straight through
+		if (leavingPlayer_ >= 0)
+		{
+			Move forfeit;
+			forfeit.makeForfeit();
+			playMove(forfeit);
+			return;
+		}
+
+		// A move that's already decided is played straight away, without a round trip or the clock running
+		Move unaskedMove;
+		if (findUnaskedMove(unaskedMove))
+		{
+			ServerMetrics::get().movesPlayedUnasked++;
+			playMove(unaskedMove);
+			return;
+		}
+
+		// Moves come in on whatever thread the player made them on, the game itself is only ever played on the scheduler
+		startClock();
+		getCurrentPlayer()->requestMoveAsync(playMove);
+	}
+
+	bool Game::findUnaskedMove(Move & outMove)
+	{
+		if (getCurrentPlayer()->takeConditionalMove(lastMove_, outMove))
+		{
+			messageWriter() << "Conditional move: ";
+			return true;
+		}
+
+		if (!autoPlaysForcedMoves_)
+			return false;
+
+		Move moves[Game::kMoveArraySize];
+		int startIndex = 0;
+		if (findAllMoves(players_[currentPlayerTurn_]->getControllingSide(), moves, Game::kMoveArraySize, startIndex) != 1)
+			return false;
+
+		outMove = moves[startIndex];
+		messageWriter() << "Only move: ";
+		return true;
+	}
+
+	void Game::startClock()
+	{
+		if (!hasClock_)
+			return;
+
+		clockPlayer_ = currentPlayerTurn_;
+		long long remaining = std::max(0LL, timeLeft_[clockPlayer_]);
+		players_[clockPlayer_]->setClock((unsigned int)remaining, clockIncrement_);
+
+		clockStartedAt_ = std::chrono::steady_clock::now();
+		unsigned int generation = ++clockGeneration_;
+		numClockCallbacks_++;
+		clockTimer_ = TimerWheel::get().schedule((unsigned int)remaining, [this, generation] { onClockExpired(generation); });
+	}
+
+	void Game::stopClock()
+	{
+		std::lock_guard<std::recursive_mutex> lock(leavingMutex_);
+		if (clockTimer_ == 0)
+			return;
+
+		// A timer that can't be cancelled is already running and will see the clock was stopped
+		if (TimerWheel::get().cancel(clockTimer_))
+			numClockCallbacks_--;
+		clockTimer_ = 0;
+		timeLeft_[clockPlayer_] -= std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - clockStartedAt_).count();
+	}
+
+	void Game::onClockExpired(unsigned int generation)
+	{
+		leavingMutex_.lock();
+		if (clockTimer_ != 0 && generation == clockGeneration_)
+		{
+			clockTimer_ = 0;
+			timeLeft_[clockPlayer_] = 0;
+
+			// Loses just like a player that left, unless someone already has. Their own move request is cut short too, as it's the one being waited on
+			int noneLeft = -1;
+			if (leavingPlayer_ == noneLeft)
+			{
+				isOutOfTime_ = true;
+				leavingPlayer_.compare_exchange_strong(noneLeft, clockPlayer_);
+				ServerMetrics::get().gamesTimedOut++;
 			}
-			
-			if (checkForWinCondition(currentPlayerTurn_))
+			for (int i = 0; i < kNumPlayers; i++)
+				players_[i]->cancelMoveRequest();
+		}
+		leavingMutex_.unlock();
+
+		numClockCallbacks_--;
+	}
+
+	void Game::writeClockTime(std::ostream & stream, long long milliseconds)
+	{
+		long long seconds = std::max(0LL, milliseconds) / 1000;
+		stream << seconds / 60 << ':' << std::setw(2) << std::setfill('0') << seconds % 60 << std::setfill(' ');
+	}
+
+	void Game::onPlayerLeft(int playerIndex)
+	{
+		std::lock_guard<std::recursive_mutex> lock(leavingMutex_);
+		int noneLeft = -1;
+		if (!leavingPlayer_.compare_exchange_strong(noneLeft, playerIndex))
+			return;
+
+		for (int i = 0; i < kNumPlayers; i++)
+		{
+			if (i != playerIndex)
+				players_[i]->cancelMoveRequest();
+		}
+	}
+
+	void Game::start()
+	{
+		winner_ = -1;
+		step_ = Step::AWAITING_MOVE;
+
+		messageWriter() << *checkerBoard_;
+		promptCurrentPlayer();
+	}
+
+	void Game::promptCurrentPlayer()
+	{
+		if (hasClock_)
+		{
+			messageWriter() << "Clock: ";
+			for (int i = 0; i < kNumPlayers; i++)
 			{
-				gameIsRunning = false;
-				winner = currentPlayerTurn_ + 1;
+				messageWriter() << ((i > 0) ? "  " : "") << "'" << players_[i]->getSymbol() << "' ";
+				writeClockTime(messageWriter(), timeLeft_[i]);
 			}
-			if (checkForDrawCondition())
+			messageWriter() << '\n';
+		}
+
+		// Prints available moves
+		messageWriter() << "Enter a move as {start} {destination1} {destinationX...}  Eg: c3 d4 or e3 c5 e7\n";
+		writeAllMovesAvailable(players_[currentPlayerTurn_]->getControllingSide());
+		messageWriter() << "You can also forfeit by typing 'FORFEIT'\n";
+
+		// Request move from player 
+		messageWriter() << players_[currentPlayerTurn_]->getDescriptor() << "Player '" << players_[currentPlayerTurn_]->getSymbol() << "'> ";
+		sendMessageToPlayers();
+		players_[currentPlayerTurn_]->sendMessage("[YOU] > ");
+		// Everything for this turn goes out at once -- the current player's messages go with the request for their move
+		flushMessagesToPlayers(true);
+	}
+
+	bool Game::submitMove(const Move & move)
+	{
+		if (step_ != Step::AWAITING_MOVE)
+			return false;
+
+		// Display current move
+		messageWriter() << move << " -- Move provided\n";
+
+		// Check for forfeit. A player that left forfeits whatever move comes in
+		int leavingPlayer = leavingPlayer_;
+		if (move.isForfeit() || leavingPlayer >= 0)
+		{
+			int forfeiting = (leavingPlayer >= 0) ? leavingPlayer : currentPlayerTurn_;
+			messageWriter() << players_[forfeiting]->getDescriptor() << "Player '" << players_[forfeiting]->getSymbol() << ((leavingPlayer >= 0 && isOutOfTime_) ? "' ran out of time...\n" : "' forfeits...\n");
+			winner_ = ( (forfeiting + 1) % kNumPlayers ) + 1;
+			ending_ = (leavingPlayer < 0) ? Ending::FORFEIT : (isOutOfTime_ ? Ending::OUT_OF_TIME : Ending::LEFT);
+			endTurn();
+			return true;
+		}
+
+		// Attempt to take turn with the move
+		const char * error = attemptTurn(move);
+		if (error)
+			messageWriter() << "Not a valid move. " << error << '\n';
+		sendMessageToPlayers();
+
+		if (error)
+			promptCurrentPlayer();
+		else
+		{
+			lastMove_ = move;
+			if (keepsMoveHistory_)
 			{
-				gameIsRunning = false;
-				winner = 0;
+				moveHistory_.push_back((char)move.getNumCoords());
+				for (int i = 0; i < move.getNumCoords(); i++)
+					moveHistory_.push_back((char)(move.getCoordinate(i).row << 4 | move.getCoordinate(i).column));
 			}
-			
-			currentTurn_++;
-			currentPlayerTurn_ = (currentPlayerTurn_ + 1) % kNumPlayers;
+			endTurn();
+		}
+		return true;
+	}
+
+	void Game::endTurn()
+	{
+		bool gameIsRunning = (winner_ == -1);
+
+		if (checkForWinCondition(currentPlayerTurn_))
+		{
+			gameIsRunning = false;
+			winner_ = currentPlayerTurn_ + 1;
+		}
+		if (checkForDrawCondition())
+		{
+			gameIsRunning = false;
+			winner_ = 0;
+		}
+		
+		if (hasClock_)
+			timeLeft_[currentPlayerTurn_] += clockIncrement_;
 
-			messageWriter() << "\n\n\n";
+		currentTurn_++;
+		currentPlayerTurn_ = (currentPlayerTurn_ + 1) % kNumPlayers;
+
+		messageWriter() << "\n\n\n";
+
+		if (gameIsRunning)
+		{
+			messageWriter() << *checkerBoard_;
+			promptCurrentPlayer();
 		}
+		else
+		{
+			finish();
+		}
+	}
 
+	void Game::finish()
+	{
 		// Write out final board state
 		messageWriter() << *checkerBoard_;
-		switch (winner)
+		switch (winner_)
 		{
 		case -1:
 			messageWriter() << "Game stopped unexpectedly. Closing!\n";
@@ -485,13 +849,34 @@ namespace checkers
 			messageWriter() << "The game was a draw! This board state has occured " << kNumSameBoardStatesForDraw << " times.\n";
 			break;
 		default:
-			messageWriter() << players_[winner-1]->getDescriptor() << "Player '" << players_[winner-1]->getSymbol() << "' wins!\n";
+			messageWriter() << players_[winner_-1]->getDescriptor() << "Player '" << players_[winner_-1]->getSymbol() << "' wins!\n";
 			
 			break;
 		}
 
 		sendMessageToPlayers();
-		return winner;
+		spectators_->close(winner_);
+		step_ = Step::FINISHED;
+	}
+
+	Game::Step Game::getStep() const
+	{
+		return step_;
+	}
+
+	Player * Game::getCurrentPlayer() const
+	{
+		return players_[currentPlayerTurn_];
+	}
+
+	int Game::getWinner() const
+	{
+		return winner_;
+	}
+
+	Game::Ending Game::getEnding() const
+	{
+		return ending_;
 	}
 
 	int Game::findAllMoves(PieceSide side, Move * moves, int moveCapacity, int& outStartPosition) const
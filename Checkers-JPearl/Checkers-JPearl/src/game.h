@@ -3,17 +3,42 @@
 #define GAME_H
 
 #include "checker_board.h"
+#include "move.h"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <sstream>
 #include <map>
+#include <memory>
+#include <mutex>
 
 namespace checkers
 {
 	class Player;
+	class BroadcastChannel;
+	class GameScheduler;
 	enum PieceSide : unsigned char;
 	class Game
 	{
 		friend class AiPlayer;
+	public:
+		// Where a game is between calls. Games wait in AWAITING_MOVE for the current player's move to be submitted
+		enum Step : unsigned char
+		{
+			NOT_STARTED,
+			AWAITING_MOVE,
+			FINISHED
+		};
+		// How a finished game came to an end
+		enum Ending : unsigned char
+		{
+			PLAYED_OUT, // Won on the board or drawn
+			FORFEIT,
+			LEFT, // A player went away
+			OUT_OF_TIME
+		};
+	private:
 
 		static const int kNumPlayers = 2;
 		static const int kNumSameBoardStatesForDraw = 4;
@@ -22,12 +47,46 @@ namespace checkers
 		Player *players_[kNumPlayers];
 		unsigned char currentPlayerTurn_;
 		int currentTurn_ = 0;
+		Step step_;
+		int winner_;
+		Ending ending_;
+
+		// Index of a player that left mid game, -1 if none has. They lose as soon as the game gets a move, whoever's turn it is
+		std::atomic<int> leavingPlayer_;
+		// Keeps a player leaving from missing the move being asked for. Recursive as asking can itself notice the player has gone
+		std::recursive_mutex leavingMutex_;
+
+		// Game clock, kept by playAsync() only. Each player has milliseconds left, and the current player's runs while their move is waited on. The running clock is guarded by leavingMutex_
+		bool hasClock_;
+		unsigned int clockIncrement_; // Milliseconds added for each move made
+		long long timeLeft_[kNumPlayers];
+		int clockPlayer_; // Whose clock is running
+		std::chrono::steady_clock::time_point clockStartedAt_;
+		unsigned long long clockTimer_; // 0 while no clock is running
+		unsigned int clockGeneration_; // Tells a timer that ran out from the one started after it
+		std::atomic<int> numClockCallbacks_; // Timers that may still run, which the game waits out before it is handed back
+		bool isOutOfTime_; // The player leaving ran out of time rather than went away
+
+		Move lastMove_; // Last move played, which the next player's conditional moves are matched against
+		bool autoPlaysForcedMoves_;
+
+		// The game as the current turn started, kept by playAsync() for getSnapshot() to hand to other threads
+		bool keepsSnapshot_;
+		std::mutex snapshotMutex_;
+		std::string snapshot_; // Guarded by snapshotMutex_
+
+		// Every move played so far, kept for getMoveHistory()
+		bool keepsMoveHistory_;
+		std::string moveHistory_;
 
 		std::map<uint_least64_t, unsigned char> boardStateOccurences_;
 
 		std::ostringstream currentMessage_;
 		bool echoMessagesToConsole_;
 
+		// Everything sent to all players is also published here for spectators
+		std::shared_ptr<BroadcastChannel> spectators_;
+
 		// Returns whether a piece has any valid moves from a given position. If no piece is given, it runs the check on the piece at the given position returning false if no piece is there. Can also restrict to only consider jump moves.
 		// If given an array of coordinates and its, will return all spaces the piece can move to and update the numCoordinates to reflect how many were returned
 		bool canMovePieceAt(CompactCoordinate coord, CheckerPiece *piece = nullptr, bool onlyJumpMoves = false, bool ignoreMarked = true, CompactCoordinate * coordinates = nullptr, int * numCoordinates = nullptr) const;
@@ -45,6 +104,29 @@ namespace checkers
 		bool checkForDrawCondition();
 		// Writes out all moves available to the current message
 		void writeAllMovesAvailable(PieceSide side);
+
+		// Sends the board and moves to everyone and asks the current player for a move
+		void promptCurrentPlayer();
+		// Checks for a win or draw once the current player is done and either hands the turn over or finishes the game. The game was forfeit if a winner is already set
+		void endTurn();
+		// Sends the final board and result and closes the game to spectators
+		void finish();
+		// Asks the current player for their move and has the scheduler play it once it's made, or reports the winner if the game is over
+		void requestNextMove(GameScheduler &scheduler, const std::function<void(int)> &onFinished);
+		// Ends the game as a loss for the player (0-based) that left, cutting short the wait on anyone else's move. Safe to call from any thread
+		void onPlayerLeft(int playerIndex);
+		// Finds a move for the current player that needn't be asked for: one they planned in reply to the last move, or the only move they have if forced moves are played for them
+		bool findUnaskedMove(Move &outMove);
+		// Captures the game for getSnapshot(), if it keeps one. Called as each turn starts
+		void updateSnapshot();
+		// Starts the current player's clock, if the game has one. Expects leavingMutex_ to be held
+		void startClock();
+		// Stops the running clock, taking the time used off its player
+		void stopClock();
+		// Ends the game as a loss for the player whose clock ran out, unless the clock was stopped since. Called on the timer wheel
+		void onClockExpired(unsigned int generation);
+		// Writes milliseconds as minutes and seconds
+		static void writeClockTime(std::ostream &stream, long long milliseconds);
 	public:
 		static const int kMaxMovesPerPiece = 4;
 		static const int kMoveArraySize = CheckerBoard::kNumPiecesPerPlayer*kMaxMovesPerPiece;
@@ -54,21 +136,65 @@ namespace checkers
 		void initialize();
 		void release();
 
+		// Gives each player baseTime (in milliseconds) on their clock plus increment for every move they make. A player whose clock runs out while their move is waited on loses. Only kept by playAsync(). Set before the game starts
+		void setClock(unsigned int baseTime, unsigned int increment);
+		// Has playAsync() play a player's move without asking when it is the only one they have. Set before the game starts
+		void setAutoPlayForcedMoves(bool autoPlay);
+
+		// Has playAsync() keep a snapshot of the game as each turn starts. Set before the game starts
+		void setKeepsSnapshot(bool keepsSnapshot);
+		// Returns the board, whose turn it is, the clocks and the positions seen so far as they were when the current turn started. Empty if the game doesn't keep a snapshot or hasn't started. Safe to call from any thread
+		std::string getSnapshot();
+		// Picks the game up where a snapshot left it, clocks included. Call after initialize() and setClock(), before the game starts. Returns false if the snapshot can't be read, leaving the game as it was
+		bool restoreSnapshot(const std::string &snapshot);
+
+		// Has the game keep every move played, see getMoveHistory(). Set before the game starts
+		void setKeepsMoveHistory(bool keepsMoveHistory);
+		// Returns every move played so far, each as its number of coordinates then a byte for each coordinate with the row in the high 4 bits and the column in the low 4. Empty if the game doesn't keep its moves
+		const std::string& getMoveHistory() const;
+
 		// Get the messageWriter
 		std::ostream& messageWriter();
 
 		// Sends message to players
 		void sendMessageToPlayers(bool excludeCurrent = false);
 
+		// Returns the channel spectators can subscribe to for every update sent to all players. It is closed with the winner once the game ends
+		std::shared_ptr<BroadcastChannel> getSpectators() const;
+
+		// Returns the number of turns played so far
+		int getCurrentTurn() const;
+
+		// Has players push out any messages they've held back
+		void flushMessagesToPlayers(bool excludeCurrent = false);
+
 		// Transfers ownership of player to game to use. Game will then take over freeing memory of the player in release() or when another player is registerred to that spot
 		void registerPlayer(Player *player, PieceSide side);
 
 		// For debug -- will run moves
 		void runMoves(char ** moves, int numMoves);
 
-		// The main game loop plays through the game and returns the index (1-based) of the player that won or 0 if there was a draw
+		// The main game loop plays through the game and returns the index (1-based) of the player that won or 0 if there was a draw.
+		// Waits on each player's requestMove() in turn. Callers that can't wait on a player drive the game with start() and submitMove() instead
 		int run();
 
+		// Plays the game through on the scheduler, asking players for their moves with requestMoveAsync() so no thread waits on them. A player that goes away loses right away, even while waiting on the other player's move.
+		// onFinished is called on the scheduler with the winner (as returned by run()) once the game is over, and the game isn't touched after
+		void playAsync(GameScheduler &scheduler, const std::function<void(int winner)> &onFinished);
+
+		// Sends the opening board and asks the first player for their move
+		void start();
+		// Plays the current player's move. Invalid moves ask the same player again. Returns false if the game wasn't waiting for a move
+		bool submitMove(const Move& move);
+
+		Step getStep() const;
+		// The player whose move the game is waiting for
+		Player* getCurrentPlayer() const;
+		// Index (1-based) of the player that won, 0 for a draw, or -1 if the game hasn't finished
+		int getWinner() const;
+		// How the game ended, once it has finished
+		Ending getEnding() const;
+
 		// Find all valid moves for the given side, returns the number of moves available and stored starting from the index returned in outStartPosition
 		int findAllMoves(PieceSide side, Move * moves, int moveCapacity, int& outStartPosition) const;
 	};
@@ -38,7 +38,7 @@ namespace checkers
 
 	int GameMenu::playGame(Player *playerOs, Player *playerXs) const
 	{
-		checkers::Game game = checkers::Game(true);
+		checkers::Game game(true);
 		game.registerPlayer(playerOs, PieceSide::O);
 		game.registerPlayer(playerXs, PieceSide::X);
 		game.initialize();
@@ -104,8 +104,7 @@ namespace checkers
 					}
 					break;
 				case '5':
-					DummyClient dummy;
-					winner = dummy.run();
+					winner = DummyClient().run();
 					break;
 				case '6':
 					repeat = false;
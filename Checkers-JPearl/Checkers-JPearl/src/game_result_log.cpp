@@ -0,0 +1,286 @@
+#include "game_result_log.h"
+
+#include <iostream>
+
+#include "metrics.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace checkers
+{
+	const char GameResultLog::kMagic[4] = { 'C', 'K', 'G', 'R' };
+
+	static std::FILE* openFile(const std::string &path, const char * mode)
+	{
+#ifdef _WIN32
+		std::FILE *file = nullptr;
+		return (fopen_s(&file, path.c_str(), mode) == 0) ? file : nullptr;
+#else
+		return std::fopen(path.c_str(), mode);
+#endif
+	}
+
+	// Returns the size of the file in bytes, or -1 if there isn't one
+	static long getFileSize(const std::string &path)
+	{
+		std::FILE *file = openFile(path, "rb");
+		if (file == nullptr)
+			return -1;
+		long size = (std::fseek(file, 0, SEEK_END) == 0) ? std::ftell(file) : -1;
+		std::fclose(file);
+		return size;
+	}
+
+	// Cuts the file back to its first size bytes. Returns whether it was
+	static bool truncateFile(const std::string &path, unsigned long long size)
+	{
+#ifdef _WIN32
+		int file = -1;
+		if (_sopen_s(&file, path.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0)
+			return false;
+		bool isTruncated = _chsize_s(file, (long long)size) == 0;
+		_close(file);
+		return isTruncated;
+#else
+		return truncate(path.c_str(), (off_t)size) == 0;
+#endif
+	}
+
+	// Pushes everything written so far through to the disk
+	static bool syncFile(std::FILE *file)
+	{
+		if (std::fflush(file) != 0)
+			return false;
+#ifdef _WIN32
+		return _commit(_fileno(file)) == 0;
+#else
+		return fsync(fileno(file)) == 0;
+#endif
+	}
+
+	GameResultLog::GameResultLog()
+	{
+		numPending_ = 0;
+		isOpen_ = false;
+		rotateSize_ = 0;
+		file_ = nullptr;
+		fileSize_ = 0;
+		nextRotation_ = 1;
+	}
+
+	GameResultLog::~GameResultLog()
+	{
+		close();
+	}
+
+	bool GameResultLog::open(const std::string & path, unsigned long long rotateSize)
+	{
+		close();
+
+		path_ = path;
+		rotateSize_ = rotateSize;
+		nextRotation_ = 1;
+		while (getFileSize(getRotatedPath(nextRotation_)) >= 0)
+			nextRotation_++;
+
+		// Games logged by an earlier run are kept whole in a file of their own, so a file can only ever be cut short at its end. A log with just its header is carried on with
+		long existingSize = getFileSize(path_);
+		if (existingSize > 0 && existingSize != (long)sizeof kMagic + 1)
+		{
+			if (std::rename(path_.c_str(), getRotatedPath(nextRotation_).c_str()) != 0)
+				return false;
+			nextRotation_++;
+		}
+
+		if (!startFile())
+			return false;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_.clear();
+		numPending_ = 0;
+		isOpen_ = true;
+		writerThread_ = std::thread([this] { runWriter(); });
+		return true;
+	}
+
+	void GameResultLog::close()
+	{
+		mutex_.lock();
+		bool wasOpen = isOpen_;
+		isOpen_ = false;
+		mutex_.unlock();
+
+		if (!wasOpen)
+			return;
+
+		// The writer drains what's waiting before it stops
+		pendingChanged_.notify_all();
+		writerThread_.join();
+
+		if (file_ != nullptr)
+		{
+			std::fclose(file_);
+			file_ = nullptr;
+		}
+	}
+
+	bool GameResultLog::isOpen()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return isOpen_;
+	}
+
+	bool GameResultLog::append(const GameResult & result)
+	{
+		// Encoded before taking the lock, so games finishing together only wait on each other to copy the bytes in
+		std::string record;
+		SnapshotEncoder encoder(record);
+		encoder.writeNumber(result.finishedAt);
+		encoder.writeNumber(result.duration);
+		encoder.writeString(result.description);
+		for (int seat = 0; seat < GameSnapshot::kNumSeats; seat++)
+		{
+			encoder.writeNumber(result.seats[seat].isAi ? 1 : 0);
+			encoder.writeNumber(result.seats[seat].aiLevel);
+			encoder.writeString(result.seats[seat].playerName);
+		}
+		encoder.writeNumber(result.winner);
+		encoder.writeNumber(result.ending);
+		encoder.writeNumber(result.numTurns);
+		encoder.writeString(result.moves);
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!isOpen_ || pending_.size() + record.size() > kMaxPendingSize)
+		{
+			lock.unlock();
+			ServerMetrics::get().gameResultsDropped++;
+			return false;
+		}
+
+		SnapshotEncoder(pending_).writeString(record);
+		numPending_++;
+		lock.unlock();
+
+		pendingChanged_.notify_one();
+		return true;
+	}
+
+	void GameResultLog::runWriter()
+	{
+		std::string batch;
+		bool wasWritten = true;
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			pendingChanged_.wait(lock, [this] { return !pending_.empty() || !isOpen_; });
+			if (pending_.empty())
+				break; // Closed with nothing left to write
+
+			// Everything that came in while the last batch was being synced goes out in this one
+			batch.swap(pending_);
+			unsigned int numGames = numPending_;
+			numPending_ = 0;
+			lock.unlock();
+
+			Stopwatch stopwatch;
+			bool isWritten = commit(batch);
+			ServerMetrics::get().resultLogCommitTime.record(stopwatch.elapsedMicroseconds());
+			if (isWritten)
+				ServerMetrics::get().gameResultsLogged += numGames;
+			else
+				ServerMetrics::get().gameResultsDropped += numGames;
+
+			// Only reported as writing starts failing, not for every batch after
+			if (wasWritten && !isWritten)
+				std::cout << "Couldn't write game results to " << path_ << std::endl;
+			wasWritten = isWritten;
+			batch.clear();
+
+			lock.lock();
+		}
+	}
+
+	bool GameResultLog::commit(const std::string & batch)
+	{
+		// A file that couldn't be started or set right before is tried again
+		if (file_ == nullptr && !recoverFile())
+			return false;
+
+		if (std::fwrite(batch.data(), 1, batch.size(), file_) != batch.size() || !syncFile(file_))
+		{
+			std::fclose(file_);
+			file_ = nullptr;
+			recoverFile();
+			return false;
+		}
+
+		fileSize_ += batch.size();
+		if (rotateSize_ > 0 && fileSize_ >= rotateSize_)
+			rotate();
+		return true;
+	}
+
+	bool GameResultLog::recoverFile()
+	{
+		// Whatever part of a failed write made it is cut off, so the file still ends on a whole game. Failing that, the file is moved aside to end where it is. Nothing more is written to it until one or the other works
+		if (getFileSize(path_) > (long)fileSize_ && !truncateFile(path_, fileSize_))
+		{
+			if (std::rename(path_.c_str(), getRotatedPath(nextRotation_).c_str()) != 0)
+				return false;
+			nextRotation_++;
+		}
+		return startFile();
+	}
+
+	void GameResultLog::rotate()
+	{
+		std::fclose(file_);
+		file_ = nullptr;
+		if (std::rename(path_.c_str(), getRotatedPath(nextRotation_).c_str()) == 0)
+		{
+			nextRotation_++;
+			fileSize_ = 0;
+		}
+		startFile();
+	}
+
+	bool GameResultLog::startFile()
+	{
+		// Appended to rather than replaced, so a file that couldn't be moved aside is carried on with
+		file_ = openFile(path_, "ab");
+		if (file_ == nullptr)
+			return false;
+
+		long size = (std::fseek(file_, 0, SEEK_END) == 0) ? std::ftell(file_) : -1;
+		if (size > 0)
+		{
+			fileSize_ = (unsigned long long)size;
+			return true;
+		}
+
+		// Until the header has made it, none of the file is any good
+		fileSize_ = 0;
+		if (size < 0 || std::fwrite(kMagic, 1, sizeof kMagic, file_) != sizeof kMagic || std::fputc(kVersion, file_) == EOF || !syncFile(file_))
+		{
+			std::fclose(file_);
+			file_ = nullptr;
+			return false;
+		}
+
+		fileSize_ = sizeof kMagic + 1;
+		return true;
+	}
+
+	std::string GameResultLog::getRotatedPath(unsigned int rotation) const
+	{
+		return path_ + "." + std::to_string(rotation);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef GAME_RESULT_LOG_H
+#define GAME_RESULT_LOG_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "game_snapshot.h"
+
+namespace checkers
+{
+	// A finished game as it is written to a result log
+	struct GameResult
+	{
+		unsigned long long finishedAt; // Seconds since the Unix epoch
+		unsigned long long duration; // Milliseconds from the game starting, or being resumed, to it finishing
+		std::string description;
+		SnapshotSeat seats[GameSnapshot::kNumSeats]; // Resume tokens aren't written
+		int winner; // Index (1-based) of the side that won, 0 for a draw
+		unsigned char ending; // How the game ended, see Game::Ending
+		unsigned int numTurns;
+		std::string moves; // As returned by Game::getMoveHistory()
+	};
+
+	// Appends finished games to a log file from a thread of its own, so finishing a game never waits on the disk.
+	// Games are queued as they finish and written out in batches, each synced to disk with a single fsync. Once the file grows past its size limit it is moved aside to <path>.1, <path>.2 and so on, and a new one is started.
+	// Each file starts with a short header, then each game is its length followed by its finish time, duration, description, each seat's AI flag, AI level and player name, winner, ending, number of turns and moves. Numbers are written as variable length integers, 7 bits per byte
+	class GameResultLog
+	{
+		static const unsigned int kMaxPendingSize = 4 * 1024 * 1024; // Games finishing while this much is still waiting to be written, eg. while the disk has stalled, are dropped rather than held
+
+		std::mutex mutex_;
+		std::condition_variable pendingChanged_;
+		std::string pending_; // Games waiting for the writer. Guarded by mutex_
+		unsigned int numPending_; // Guarded by mutex_
+		bool isOpen_; // Guarded by mutex_
+		std::thread writerThread_;
+
+		// Only used by the writer thread while it runs
+		std::string path_;
+		unsigned long long rotateSize_;
+		std::FILE *file_;
+		unsigned long long fileSize_; // Bytes of the file that hold whole games
+		unsigned int nextRotation_; // Number the current file is moved aside under
+
+		void runWriter();
+		// Writes out a batch of games and syncs it to disk. Returns whether it made it there
+		bool commit(const std::string &batch);
+		// Gets a file to write to again once writing to it failed, without writing after a game that was cut short. Returns whether there is one
+		bool recoverFile();
+		// Moves the current file aside and starts a new one
+		void rotate();
+		// Opens the file at the path to write to, starting it with the header if it's new
+		bool startFile();
+		std::string getRotatedPath(unsigned int rotation) const;
+	public:
+		static const char kMagic[4];
+		static const unsigned char kVersion = 1;
+
+		GameResultLog();
+		~GameResultLog();
+
+		// Starts a new log at the path and the thread writing to it. A log with games already at the path is moved aside first, as though it had been rotated. Files are rotated once they reach rotateSize bytes, 0 never rotates. Returns whether the log could be created
+		bool open(const std::string &path, unsigned long long rotateSize);
+		// Writes out every game still waiting and closes the log
+		void close();
+		bool isOpen();
+
+		// Queues the game to be written. Never waits on the disk. Returns false if the game was dropped
+		bool append(const GameResult &result);
+	};
+}
+
+#endif // GAME_RESULT_LOG_H
@@ -0,0 +1,97 @@
+#include "game_scheduler.h"
+
+#include <algorithm>
+
+namespace checkers
+{
+	GameScheduler::GameScheduler()
+	{
+		isRunning_ = false;
+	}
+
+	GameScheduler::~GameScheduler()
+	{
+		stop();
+	}
+
+	bool GameScheduler::start(int numThreads)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (isRunning_)
+			return false;
+
+		if (numThreads <= 0)
+			numThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+		isRunning_ = true;
+		for (int i = 0; i < numThreads; i++)
+			threads_.push_back(std::thread([this] { runThread(); }));
+		return true;
+	}
+
+	void GameScheduler::stop()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!isRunning_)
+			return;
+		isRunning_ = false;
+		lock.unlock();
+
+		workPosted_.notify_all();
+		for (unsigned int i = 0; i < threads_.size(); i++)
+			threads_[i].join();
+
+		// Anything posted from here on runs where it's posted. Work posted once the threads had left is run here
+		lock.lock();
+		threads_.clear();
+		while (!queue_.empty())
+		{
+			std::function<void()> work = queue_.front();
+			queue_.pop_front();
+			lock.unlock();
+			work();
+			lock.lock();
+		}
+	}
+
+	void GameScheduler::runThread()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			workPosted_.wait(lock, [this] { return !queue_.empty() || !isRunning_; });
+			if (queue_.empty())
+				return; // Stopped with nothing left to run
+
+			std::function<void()> work;
+			work.swap(queue_.front());
+			queue_.pop_front();
+			lock.unlock();
+
+			work();
+
+			lock.lock();
+		}
+	}
+
+	void GameScheduler::post(const std::function<void()> &work)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!isRunning_ && threads_.empty())
+		{
+			lock.unlock();
+			work();
+			return;
+		}
+
+		queue_.push_back(work);
+		lock.unlock();
+		workPosted_.notify_one();
+	}
+
+	int GameScheduler::getQueueDepth()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return (int)queue_.size();
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#ifndef GAME_SCHEDULER_H
+#define GAME_SCHEDULER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace checkers
+{
+	// A few threads that play out games as their players' moves come in. Each step of a game is short (checking the move, sending the board), so a handful of threads can keep any number of games going as long as nothing run here waits on a player.
+	// Work runs in the order it was posted
+	class GameScheduler
+	{
+		bool isRunning_;
+		std::vector<std::thread> threads_;
+		std::mutex mutex_;
+		std::condition_variable workPosted_;
+		std::deque<std::function<void()>> queue_;
+
+		void runThread();
+	public:
+		GameScheduler();
+		~GameScheduler();
+
+		// Starts the given number of threads, or one per core when 0. Returns false if already started
+		bool start(int numThreads);
+		// Runs everything still queued, including anything it posts, then stops the threads
+		void stop();
+
+		// Queues the work to run on one of the threads. Work is run on the calling thread when the scheduler isn't started
+		void post(const std::function<void()> &work);
+
+		// Number of steps waiting for a thread
+		int getQueueDepth();
+	};
+}
+
+#endif // GAME_SCHEDULER_H
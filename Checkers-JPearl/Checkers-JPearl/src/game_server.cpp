@@ -1,9 +1,18 @@
 #include "game_server.h"
 
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
 
 #include "ai_player.h"
+#include "broadcast_channel.h"
+#include "metrics.h"
 #include "network_player.h"
+#include "uring_reactor.h"
 
 namespace checkers
 {
@@ -11,6 +20,12 @@ namespace checkers
 	GameServer::GameServer()
 	{
 		isRunning_ = false;
+		nextGameId_ = 1;
+		nextSessionId_ = 1;
+		shardLink_ = nullptr;
+
+		std::random_device device;
+		tokenRandom_.seed(((unsigned long long)device() << 32) | device());
 	}
 
 	void GameServer::initialize()
@@ -25,22 +40,73 @@ namespace checkers
 		}
 	}
 
+	void GameServer::setConfig(const ServerConfig & config)
+	{
+		serverMutex_.lock();
+		config_ = config;
+		serverMutex_.unlock();
+	}
+
+	void GameServer::setShardLink(ShardLink * link)
+	{
+		serverMutex_.lock();
+		shardLink_ = link;
+		serverMutex_.unlock();
+	}
+
 	void GameServer::run()
 	{
+		ClientSession *pendingSession = nullptr;
+
+		std::thread shardThread;
+		if (shardLink_ != nullptr)
+			shardThread = std::thread([this] { runShardLink(); });
+
+		std::thread snapshotThread;
+		if (!config_.snapshotPath.empty() && config_.snapshotInterval > 0)
+			snapshotThread = std::thread([this] { runSnapshots(); });
+
 		while (isRunning_)
 		{
-			if (currentConnectionIndex_ < kMaxConnections && listener.isListening())
+			serverMutex_.lock();
+			reclaimSessions();
+			serverMutex_.unlock();
+
+			if (pendingSession == nullptr)
 			{
-				// Try to accept a new connection
-				Connection &potential = currentConnections_[currentConnectionIndex_];
-				if (listener.acceptConnection(potential, 1000))
+				pendingSession = sessionPool_.acquire();
+				if (pendingSession != nullptr)
 				{
-					instances_[currentConnectionIndex_] = std::thread([this, &potential] {initConnection(potential);});
-					currentConnectionIndex_++;
+					// The connection is tapped before it is made so the recording starts with its first frame
+					if (recorder_.isOpen())
+						pendingSession->connection.setTap(&recorder_, nextSessionId_++);
+
+					ClientSession *carrier = pendingSession;
+					pendingSession->connection.setSessionHandler([this, carrier](unsigned short sessionId) { acceptSession(*carrier, sessionId); });
 				}
-				else
+			}
+
+			if (pendingSession == nullptr)
+			{
+				// At capacity, wait for a session to finish
+				std::this_thread::sleep_for(std::chrono::milliseconds(kFullServerWaitMilliseconds));
+			}
+			else if (listener.isListening())
+			{
+				// Try to accept a new connection
+				if (listener.acceptConnection(pendingSession->connection, kAcceptTimeoutMilliseconds))
 				{
-					printSockError("Server error on accepting");
+					// Menus and turns are several messages each, hold them back until the client has to respond
+					pendingSession->connection.setCorked(true);
+
+					serverMutex_.lock();
+					ClientSession *session = pendingSession;
+					session->holds = 1; // Held by its thread
+					activeSessions_.push_back(session);
+					session->thread = std::thread([this, session] { initConnection(*session); releaseSession(*session); });
+					serverMutex_.unlock();
+
+					pendingSession = nullptr;
 				}
 			}
 			std::this_thread::yield();
@@ -48,21 +114,120 @@ namespace checkers
 
 		// Shutdown
 
+		// No more players may be handed over once the sessions are being closed
+		if (shardThread.joinable())
+			shardThread.join();
+
+		// Saved while every game is still going, they end as their players are disconnected below
+		if (snapshotThread.joinable())
+			snapshotThread.join();
+		if (!config_.snapshotPath.empty())
+			writeSnapshot(true);
+
+		matchmaker_.stop();
+		sessionPool_.release(pendingSession);
+
+		serverMutex_.lock();
 		if (listener.isListening())
 			listener.end();
+		std::vector<ClientSession*> sessions = activeSessions_;
+		serverMutex_.unlock();
 
-		for (int i = 0; i < currentConnectionIndex_; i++)
+		for (unsigned int i = 0; i < sessions.size(); i++)
 		{
-			if(currentConnections_[i].isConnected())
-				currentConnections_[i].disconnect(false);
+			if (sessions[i]->connection.isConnected())
+				sessions[i]->connection.disconnect(false);
+		}
+
+		for (unsigned int i = 0; i < sessions.size(); i++)
+		{
+			if (sessions[i]->thread.joinable())
+				sessions[i]->thread.join();
+
+			// Games outlive their sessions' threads, and end once they see their players have disconnected
+			serverMutex_.lock();
+			while (sessions[i]->holds > 0)
+			{
+				serverMutex_.unlock();
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				serverMutex_.lock();
+			}
+			serverMutex_.unlock();
+
+			while (!sessions[i]->connection.isIdle())
+				std::this_thread::yield();
 
-			instances_[i].join();
+			sessionPool_.release(sessions[i]);
 		}
-		
+
+		serverMutex_.lock();
+		activeSessions_.clear();
+		serverMutex_.unlock();
+	}
+
+	void GameServer::acceptSession(ClientSession & carrier, unsigned short sessionId)
+	{
+		std::lock_guard<std::mutex> lock(serverMutex_);
+		if (!isRunning_)
+			return;
+
+		// Refused when at capacity, same as a connection would be left waiting
+		ClientSession *session = sessionPool_.acquire();
+		if (session == nullptr)
+			return;
+
+		if (recorder_.isOpen())
+			session->connection.setTap(&recorder_, nextSessionId_++);
+		session->connection.setCorked(true);
+		if (!carrier.connection.acceptSession(sessionId, session->connection))
+		{
+			sessionPool_.release(session);
+			return;
+		}
+
+		session->holds = 1; // Held by its thread
+		activeSessions_.push_back(session);
+		session->thread = std::thread([this, session] { initConnection(*session); releaseSession(*session); });
+	}
+
+	void GameServer::reclaimSessions()
+	{
+		for (unsigned int i = 0; i < activeSessions_.size();)
+		{
+			ClientSession *session = activeSessions_[i];
+			if (session->holds == 0 && session->connection.isIdle())
+			{
+				if (session->thread.joinable())
+					session->thread.join();
+
+				sessionPool_.release(session);
+				activeSessions_[i] = activeSessions_.back();
+				activeSessions_.pop_back();
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	void GameServer::holdSession(ClientSession & session)
+	{
+		serverMutex_.lock();
+		session.holds++;
+		serverMutex_.unlock();
 	}
 
-	void GameServer::initConnection(Connection & connection)
+	void GameServer::releaseSession(ClientSession & session)
 	{
+		serverMutex_.lock();
+		session.holds--;
+		serverMutex_.unlock();
+	}
+
+	void GameServer::initConnection(ClientSession & session)
+	{
+		Connection &connection = session.connection;
 		bool receivedValidInput = false;
 
 		while (connection.isConnected() && !receivedValidInput)
@@ -71,6 +236,8 @@ namespace checkers
 				"Welcome to the server. What would you like to do?\n"
 				"1) Play against someone else\n"
 				"2) Play against an AI\n"
+				"3) Watch a game\n"
+				"4) Resume a game after a server restart\n"
 				"Your choice > "
 			))
 				continue;
@@ -87,7 +254,7 @@ namespace checkers
 					case '1': // Play against someone else
 						receivedValidInput = true;
 
-						addOnlinePlayer(connection);
+						addOnlinePlayer(session);
 
 						break;
 					case '2': // Play against an AI
@@ -116,10 +283,22 @@ namespace checkers
 							std::this_thread::yield();
 						}
 
-						startAiGame(connection, levelResult);
+						startAiGame(session, levelResult);
 
 						break;
 					}
+					case '3': // Watch a game
+						receivedValidInput = true;
+
+						watchGame(session);
+
+						break;
+					case '4': // Resume a game after a server restart
+						if (!resumeGame(session))
+							continue; // Back to the menu
+
+						receivedValidInput = true;
+						break;
 				}
 			}
 
@@ -130,70 +309,637 @@ namespace checkers
 		}
 	}
 
-	void GameServer::addOnlinePlayer(Connection & playerToAdd)
+	void GameServer::addOnlinePlayer(ClientSession & playerToAdd)
+	{
+		Connection &connection = playerToAdd.connection;
+
+		// Named players are rated, and everyone is matched against players of similar rating
+		bool receivedValidName = false;
+		while (connection.isConnected() && !receivedValidName)
+		{
+			if (!connection.sendMessage("Enter a name to play rated games under (leave empty to play unrated) > "))
+				continue;
+
+			if (!connection.requestInput(playerToAdd.playerName))
+				continue;
+
+			receivedValidName = playerToAdd.playerName.length() <= kMaxPlayerNameLength;
+			if (!receivedValidName)
+				connection.sendMessage("That name is too long\n");
+		}
+
+		if (!connection.isConnected())
+			return;
+
+		int rating = ratings_.getRating(playerToAdd.playerName);
+		std::ostringstream os = std::ostringstream();
+		if (!playerToAdd.playerName.empty())
+			os << "Your rating is " << rating << ". ";
+		os << "Waiting for another player to join.\n";
+		connection.sendMessage(os.str());
+		connection.flush();
+
+		waitForMatch(playerToAdd, rating);
+	}
+
+	void GameServer::waitForMatch(ClientSession & player, int rating)
+	{
+		Connection &connection = player.connection;
+
+		holdSession(player); // Held by the ticket until its game is over
+		std::shared_ptr<MatchTicket> ticket = matchmaker_.enqueue(&player, rating);
+
+		MatchTicket::State state = MatchTicket::State::WAITING;
+		while (state == MatchTicket::State::WAITING)
+		{
+			state = ticket->waitForMatch(kMatchWaitMilliseconds);
+			if (state == MatchTicket::State::WAITING && (!connection.isConnected() || !isRunning_) && ticket->cancel())
+			{
+				state = MatchTicket::State::CANCELLED;
+			}
+			else if (state == MatchTicket::State::WAITING && shardLink_ != nullptr && ticket->getWaitTime() > std::chrono::milliseconds(kShardHandOffMilliseconds) && handOffPlayer(player, rating, ticket))
+			{
+				// Their wait carries on, and is measured, on the other shard
+				releaseSession(player);
+				return;
+			}
+		}
+		ServerMetrics::get().matchmakingWait.record(std::chrono::duration_cast<std::chrono::microseconds>(ticket->getWaitTime()).count());
+
+		if (state == MatchTicket::State::CANCELLED)
+		{
+			releaseSession(player);
+			return;
+		}
+
+		// Whoever was first in line runs the game on their thread
+		if (ticket->isFirst())
+		{
+			ClientSession *opponent = reinterpret_cast<ClientSession*>(ticket->getOpponent()->getPlayer());
+			connection.sendMessage("Found another player! Starting game.\n");
+			opponent->connection.sendMessage("Found another player! Starting game.\n");
+			startOnlineGame(player, *opponent);
+			releaseSession(*opponent);
+			releaseSession(player);
+		}
+	}
+
+	bool GameServer::handOffPlayer(ClientSession & player, int rating, std::shared_ptr<MatchTicket> & ticket)
+	{
+		int shard = shardLink_->findMatchShard();
+		if (shard < 0 || !ticket->cancel())
+			return false; // Nowhere better to go, or matched here in the meantime
+
+		if (shardLink_->handOff(shard, player.connection, player.playerName, rating))
+			return true;
+
+		// Stay in line here, the ticket hold carries over to the new ticket
+		ticket = matchmaker_.enqueue(&player, rating);
+		return false;
+	}
+
+	void GameServer::runShardLink()
+	{
+		while (isRunning_)
+		{
+			shardLink_->publish(sampleGauges());
+
+			unsigned int socket = 0;
+			std::string playerName;
+			int rating = 0;
+			if (shardLink_->receiveHandOff(kShardPublishMilliseconds, socket, playerName, rating))
+				adoptPlayer(socket, playerName, rating);
+		}
+	}
+
+	void GameServer::adoptPlayer(unsigned int socket, const std::string & playerName, int rating)
 	{
+		ClientSession *session = sessionPool_.acquire();
+		if (session == nullptr)
+		{
+			ShardLink::rejectHandOff(socket);
+			return;
+		}
+
+		// Sessions handed over aren't recorded, their recording would start part way through
+		session->connection.setTap(nullptr, 0);
+		Connection::adoptSocket(socket, session->connection);
+		session->connection.setCorked(true);
+
+		session->playerName = playerName;
+		ratings_.setRating(playerName, rating);
+
 		serverMutex_.lock();
+		session->holds = 1; // Held by its thread
+		activeSessions_.push_back(session);
+		session->thread = std::thread([this, session, rating] { waitForMatch(*session, rating); releaseSession(*session); });
+		serverMutex_.unlock();
+	}
+
+	void GameServer::runGame(Game & game, const GameSnapshot & snapshot, const std::function<void(int)> & onFinished)
+	{
+		// The instance now belongs to the scheduler until the game is over
+		game.initialize();
+		if (config_.clockSeconds > 0)
+			game.setClock(config_.clockSeconds * 1000, config_.clockIncrementSeconds * 1000);
+		game.setAutoPlayForcedMoves(config_.autoPlayForcedMoves);
+		game.setKeepsSnapshot(!config_.snapshotPath.empty());
+		game.setKeepsMoveHistory(resultLog_.isOpen());
+		if (!snapshot.state.empty() && !game.restoreSnapshot(snapshot.state))
+			std::cout << "Couldn't pick \"" << snapshot.description << "\" up from its snapshot, starting it over" << std::endl;
+
+		serverMutex_.lock();
+		RunningGame listing;
+		listing.id = nextGameId_++;
+		listing.game = &game;
+		listing.description = snapshot.description;
+		for (int i = 0; i < GameSnapshot::kNumSeats; i++)
+			listing.seats[i] = snapshot.seats[i];
+		listing.startedAt = std::chrono::steady_clock::now();
+		listing.isInFinalSnapshot = false;
+		runningGames_.push_back(listing);
+		serverMutex_.unlock();
 
-		if (connectionWaitingForOnlineGame_ == nullptr || !connectionWaitingForOnlineGame_->isConnected())
+		ServerMetrics::get().gamesStarted++;
+		game.playAsync(scheduler_, [this, &game, onFinished](int winner) {
+			ServerMetrics::get().gamesFinished++;
+
+			RunningGame listing;
+			listing.isInFinalSnapshot = false;
+			serverMutex_.lock();
+			for (unsigned int i = 0; i < runningGames_.size(); i++)
+			{
+				if (runningGames_[i].game == &game)
+				{
+					listing = runningGames_[i];
+					runningGames_.erase(runningGames_.begin() + i);
+					break;
+				}
+			}
+			serverMutex_.unlock();
+
+			// Games cut short by the server stopping are in the snapshot and logged once they're resumed and finished. Games that finish while it stops, before the snapshot is saved, are logged now
+			if (resultLog_.isOpen() && !listing.isInFinalSnapshot)
+			{
+				GameResult result;
+				result.finishedAt = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+				result.duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - listing.startedAt).count();
+				result.description = listing.description;
+				for (int i = 0; i < GameSnapshot::kNumSeats; i++)
+					result.seats[i] = listing.seats[i];
+				result.winner = winner;
+				result.ending = game.getEnding();
+				result.numTurns = game.getCurrentTurn();
+				result.moves = game.getMoveHistory();
+				resultLog_.append(result);
+			}
+
+			game.release();
+			onFinished(winner);
+		});
+	}
+
+	void GameServer::watchGame(ClientSession & spectator)
+	{
+		Connection &connection = spectator.connection;
+
+		std::shared_ptr<BroadcastChannel> channel;
+		while (connection.isConnected() && !channel)
 		{
-			playerToAdd.sendMessage("Waiting for another player to join.\n");
-			connectionWaitingForOnlineGame_ = &playerToAdd;
+			std::ostringstream os = std::ostringstream();
+			serverMutex_.lock();
+			if (runningGames_.empty())
+			{
+				os << "There are no games running right now.\n";
+			}
+			else
+			{
+				os << "Games being played:\n";
+				for (unsigned int i = 0; i < runningGames_.size(); i++)
+					os << "\t" << runningGames_[i].id << ") " << runningGames_[i].description << " -- turn " << runningGames_[i].game->getCurrentTurn() << '\n';
+			}
 			serverMutex_.unlock();
+			os << "Enter the game to watch or leave empty to check again > ";
+
+			if (!connection.sendMessage(os.str()))
+				continue;
+
+			std::string response;
+			if (!connection.requestInput(response) || response.empty())
+				continue;
+
+			int id = std::atoi(response.c_str());
+
+			// Subscribe while the game is known to still be running so it can't be released underneath us
+			serverMutex_.lock();
+			for (unsigned int i = 0; i < runningGames_.size(); i++)
+			{
+				if (runningGames_[i].id == id)
+				{
+					channel = runningGames_[i].game->getSpectators();
+					if (!channel->subscribe(&connection))
+						channel.reset();
+					break;
+				}
+			}
+			serverMutex_.unlock();
+
+			if (!channel)
+				connection.sendMessage("That game isn't running\n");
 		}
-		else
+
+		if (!channel)
+			return;
+
+		// Updates are sent as shared frames from here on, so anything held back has to go out first
+		connection.sendMessage("Now watching. The board will show after the next move.\n");
+		connection.setCorked(false);
+
+		while (connection.isConnected() && !channel->waitUntilClosed(kSpectatorWaitMilliseconds)) {}
+
+		channel->unsubscribe(&connection);
+
+		if (connection.isConnected())
 		{
-			playerToAdd.sendMessage("Found another player! Starting game.\n");
-			connectionWaitingForOnlineGame_->sendMessage("Found another player! Starting game.\n");
-			Connection *connectionWaiting = connectionWaitingForOnlineGame_;
-			connectionWaitingForOnlineGame_ = nullptr;
-			serverMutex_.unlock();
-			startOnlineGame(*connectionWaiting, playerToAdd);
+			connection.flushFrames(kSpectatorFlushMilliseconds);
+			connection.sendWinner(channel->getResult());
+			connection.disconnect(true);
 		}
 	}
 
-	int GameServer::runGame(Game & game)
+	AiPlayer * GameServer::createAiPlayer(int aiDifficulty)
 	{
-		// The instance now belongs to the connection that started the game.
-		// Which is the connection that requested the AI game or the 2nd connection into an online game
-		game.initialize();
-		int result = game.run();
-		game.release();
-		return result;
+		// Shallower searches are quick to finish, so they go ahead of deep ones rather than waiting behind them
+		AiPlayer *ai = new AiPlayer(aiDifficulty);
+		ai->setWorkerPool(&aiWorkers_, aiDifficulty);
+		ai->setSharedBudget(&aiBudget_);
+		if (aiTable_.isEnabled())
+			ai->setSharedTable(&aiTable_);
+		return ai;
+	}
+
+	void GameServer::startAiGame(ClientSession & player, int aiDifficuluty)
+	{
+		Game *game = gamePool_.acquire();
+		if (game == nullptr)
+		{
+			player.connection.sendMessage("The server is running as many games as it can. Try again later.\n");
+			player.connection.disconnect(true);
+			return;
+		}
+
+		game->registerPlayer(new NetworkPlayer(&player.connection), PieceSide::O);
+		game->registerPlayer(createAiPlayer(aiDifficuluty), PieceSide::X);
+
+		GameSnapshot setup;
+		std::ostringstream description = std::ostringstream();
+		description << "O: " << describePlayer(player) << " vs X: AI level " << aiDifficuluty;
+		setup.description = description.str();
+		giveResumeToken(player, setup.seats[PieceSide::O]);
+		setup.seats[PieceSide::X].isAi = true;
+		setup.seats[PieceSide::X].aiLevel = aiDifficuluty;
+
+		// The game carries on without this thread, holding the session until it's over
+		holdSession(player);
+		runGame(*game, setup, [this, game, &player](int winner) {
+			gamePool_.release(game);
+
+			player.connection.sendWinner(winner);
+			player.connection.disconnect(true); // Disconnect players on game completion
+			releaseSession(player);
+		});
+	}
+
+	void GameServer::startOnlineGame(ClientSession & playerOne, ClientSession & playerTwo)
+	{
+		Connection &connectionOne = playerOne.connection;
+		Connection &connectionTwo = playerTwo.connection;
+
+		Game *game = gamePool_.acquire();
+		if (game == nullptr)
+		{
+			connectionOne.sendMessage("The server is running as many games as it can. Try again later.\n");
+			connectionTwo.sendMessage("The server is running as many games as it can. Try again later.\n");
+			connectionOne.disconnect(true); connectionTwo.disconnect(true);
+			return;
+		}
+
+		game->registerPlayer(new NetworkPlayer(&connectionOne), PieceSide::O);
+		connectionOne.sendMessage("\n\nYou are playing as O's\n\n");
+		game->registerPlayer(new NetworkPlayer(&connectionTwo), PieceSide::X);
+		connectionTwo.sendMessage("\n\nYou are playing as X's\n\n");
+
+		GameSnapshot setup;
+		std::ostringstream description = std::ostringstream();
+		description << "O: " << describePlayer(playerOne) << " vs X: " << describePlayer(playerTwo);
+		setup.description = description.str();
+		giveResumeToken(playerOne, setup.seats[PieceSide::O]);
+		giveResumeToken(playerTwo, setup.seats[PieceSide::X]);
+
+		// The game carries on without this thread, holding both sessions until it's over
+		holdSession(playerOne);
+		holdSession(playerTwo);
+		runGame(*game, setup, [this, game, &playerOne, &playerTwo](int winner) {
+			gamePool_.release(game);
+
+			if (winner >= 0)
+			{
+				ratings_.recordResult(playerOne.playerName, playerTwo.playerName, winner);
+				sendRating(playerOne);
+				sendRating(playerTwo);
+			}
+
+			Connection &connectionOne = playerOne.connection;
+			Connection &connectionTwo = playerTwo.connection;
+			connectionOne.sendWinner(winner);
+			connectionTwo.sendWinner(winner);
+			connectionOne.disconnect(true); connectionTwo.disconnect(true); // Disconnect players on game completion
+			releaseSession(playerOne);
+			releaseSession(playerTwo);
+		});
 	}
 
-	void GameServer::startAiGame(Connection & player, int aiDifficuluty)
+	void GameServer::giveResumeToken(ClientSession & player, SnapshotSeat & seat)
 	{
+		seat.playerName = player.playerName;
+		if (config_.snapshotPath.empty())
+			return;
+
+		std::ostringstream token = std::ostringstream();
 		serverMutex_.lock();
+		token << std::hex << std::setw(16) << std::setfill('0') << tokenRandom_();
+		serverMutex_.unlock();
+		seat.resumeToken = token.str();
+
+		std::ostringstream os = std::ostringstream();
+		os << "Your resume token is " << seat.resumeToken << ". If the server restarts, resume the game with it to carry on where you left off\n";
+		player.connection.sendMessage(os.str());
+	}
+
+	bool GameServer::resumeGame(ClientSession & player)
+	{
+		Connection &connection = player.connection;
+
+		std::shared_ptr<PendingResume> pending;
+		std::string token;
+		int seat = 0;
+		while (connection.isConnected() && !pending)
+		{
+			if (!connection.sendMessage("Enter your resume token or leave empty to go back > "))
+				continue;
+
+			if (!connection.requestInput(token))
+				continue;
+			if (token.empty())
+				return false;
+
+			// Tokens are used up as they're claimed, so nobody else can take the seat
+			serverMutex_.lock();
+			std::map<std::string, std::pair<std::shared_ptr<PendingResume>, int>>::iterator found = resumeTokens_.find(token);
+			if (found != resumeTokens_.end() && !found->second.first->isStarted && std::chrono::steady_clock::now() - found->second.first->loadedAt < std::chrono::seconds(kResumeWindowSeconds))
+			{
+				pending = found->second.first;
+				seat = found->second.second;
+				resumeTokens_.erase(found);
+				pending->players[seat] = &player;
+				player.holds++; // Held by the game, or until the wait for the opponent is over
+			}
+			serverMutex_.unlock();
+
+			if (!pending)
+				connection.sendMessage("No game is waiting to be resumed with that token\n");
+		}
+		if (!pending)
+			return false;
 
-		int gameIndex = currentGameIndex_++;
-		Game *game = currentGames_ + gameIndex;
-		game->registerPlayer(new NetworkPlayer( &player), PieceSide::O);
-		game->registerPlayer(new AiPlayer(aiDifficuluty), PieceSide::X);
+		player.playerName = pending->snapshot.seats[seat].playerName;
 
+		// Whoever resumes last starts the game, on their thread
+		bool isReady = true;
+		serverMutex_.lock();
+		for (int i = 0; i < GameSnapshot::kNumSeats; i++)
+		{
+			if (!pending->snapshot.seats[i].isAi && pending->players[i] == nullptr)
+				isReady = false;
+		}
+		if (isReady)
+		{
+			pending->isStarted = true;
+			pendingResumes_.erase(std::find(pendingResumes_.begin(), pendingResumes_.end(), pending));
+		}
 		serverMutex_.unlock();
 
-		int winner = runGame(currentGames_[gameIndex]);
-		player.sendWinner(winner);
-		player.disconnect(true); // Disconnect players on game completion
+		if (isReady)
+		{
+			startResumedGame(*pending);
+			return true;
+		}
+
+		connection.sendMessage("Waiting for your opponent to resume the game.\n");
+		connection.flush();
+
+		std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+		while (true)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(kMatchWaitMilliseconds));
+
+			std::lock_guard<std::mutex> lock(serverMutex_);
+			if (pending->isStarted)
+				return true;
+
+			bool isOutOfTime = std::chrono::steady_clock::now() - waitStart > std::chrono::milliseconds(kResumeWaitMilliseconds);
+			if (!isOutOfTime && connection.isConnected() && isRunning_)
+				continue;
+
+			pending->players[seat] = nullptr;
+			player.holds--;
+			if (!isOutOfTime || !connection.isConnected())
+			{
+				// They can try again with the same token
+				resumeTokens_[token] = std::make_pair(pending, seat);
+				return true;
+			}
+
+			// The opponent isn't coming back, so the game goes to the player who did
+			pendingResumes_.erase(std::find(pendingResumes_.begin(), pendingResumes_.end(), pending));
+			for (int i = 0; i < GameSnapshot::kNumSeats; i++)
+				resumeTokens_.erase(pending->snapshot.seats[i].resumeToken);
+
+			connection.sendMessage("Your opponent didn't resume the game in time. You win!\n");
+			connection.sendWinner(seat + 1);
+			connection.disconnect(true);
+			return true;
+		}
+	}
+
+	void GameServer::startResumedGame(PendingResume & pending)
+	{
+		ClientSession *players[GameSnapshot::kNumSeats];
+		for (int i = 0; i < GameSnapshot::kNumSeats; i++)
+			players[i] = pending.players[i];
+
+		Game *game = gamePool_.acquire();
+		if (game == nullptr)
+		{
+			for (int i = 0; i < GameSnapshot::kNumSeats; i++)
+			{
+				if (players[i] == nullptr)
+					continue;
+				players[i]->connection.sendMessage("The server is running as many games as it can. Try again later.\n");
+				players[i]->connection.disconnect(true);
+				releaseSession(*players[i]);
+			}
+			return;
+		}
+
+		for (int i = 0; i < GameSnapshot::kNumSeats; i++)
+		{
+			if (pending.snapshot.seats[i].isAi)
+			{
+				game->registerPlayer(createAiPlayer(pending.snapshot.seats[i].aiLevel), (PieceSide)i);
+			}
+			else
+			{
+				game->registerPlayer(new NetworkPlayer(&players[i]->connection), (PieceSide)i);
+				players[i]->connection.sendMessage((i == PieceSide::O) ? "\n\nResuming your game as O's\n\n" : "\n\nResuming your game as X's\n\n");
+			}
+		}
+
+		// Each player's session is already held for the game by resumeGame()
+		runGame(*game, pending.snapshot, [this, game, players](int winner) {
+			gamePool_.release(game);
+
+			if (winner >= 0 && players[0] != nullptr && players[1] != nullptr)
+			{
+				ratings_.recordResult(players[0]->playerName, players[1]->playerName, winner);
+				sendRating(*players[0]);
+				sendRating(*players[1]);
+			}
+
+			for (int i = 0; i < GameSnapshot::kNumSeats; i++)
+			{
+				if (players[i] == nullptr)
+					continue;
+				players[i]->connection.sendWinner(winner);
+				players[i]->connection.disconnect(true);
+				releaseSession(*players[i]);
+			}
+		});
 	}
 
-	void GameServer::startOnlineGame(Connection & playerOne, Connection & playerTwo)
+	void GameServer::writeSnapshot(bool isFinal)
 	{
+		std::vector<GameSnapshot> games;
+
 		serverMutex_.lock();
+		for (unsigned int i = 0; i < runningGames_.size(); i++)
+		{
+			GameSnapshot game;
+			game.state = runningGames_[i].game->getSnapshot();
+			if (game.state.empty())
+				continue;
+
+			game.description = runningGames_[i].description;
+			for (int seat = 0; seat < GameSnapshot::kNumSeats; seat++)
+				game.seats[seat] = runningGames_[i].seats[seat];
+			games.push_back(game);
+			if (isFinal)
+				runningGames_[i].isInFinalSnapshot = true;
+		}
+
+		// Games nobody has come back to yet are kept for another restart, until their window to resume runs out
+		for (unsigned int i = 0; i < pendingResumes_.size(); i++)
+		{
+			if (std::chrono::steady_clock::now() - pendingResumes_[i]->loadedAt < std::chrono::seconds(kResumeWindowSeconds))
+				games.push_back(pendingResumes_[i]->snapshot);
+		}
+		serverMutex_.unlock();
+
+		if (!SnapshotFile::write(config_.snapshotPath, games))
+			std::cout << "Couldn't write snapshot " << config_.snapshotPath << std::endl;
+	}
+
+	void GameServer::runSnapshots()
+	{
+		std::chrono::steady_clock::time_point lastWritten = std::chrono::steady_clock::now();
+		while (isRunning_)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(kSnapshotCheckMilliseconds));
+			if (isRunning_ && std::chrono::steady_clock::now() - lastWritten >= std::chrono::seconds(config_.snapshotInterval))
+			{
+				writeSnapshot(false);
+				lastWritten = std::chrono::steady_clock::now();
+			}
+		}
+	}
+
+	void GameServer::loadSnapshot()
+	{
+		std::vector<GameSnapshot> games;
+		if (!SnapshotFile::read(config_.snapshotPath, games))
+		{
+			std::ifstream existing(config_.snapshotPath.c_str());
+			if (existing.is_open())
+				std::cout << "Couldn't read snapshot " << config_.snapshotPath << ", its games can't be resumed" << std::endl;
+			return;
+		}
+
+		for (unsigned int i = 0; i < games.size(); i++)
+		{
+			std::shared_ptr<PendingResume> pending = std::make_shared<PendingResume>();
+			pending->snapshot = games[i];
+			pending->isStarted = false;
+			pending->loadedAt = std::chrono::steady_clock::now();
+			for (int seat = 0; seat < GameSnapshot::kNumSeats; seat++)
+			{
+				pending->players[seat] = nullptr;
+				if (!games[i].seats[seat].isAi)
+					resumeTokens_[games[i].seats[seat].resumeToken] = std::make_pair(pending, seat);
+			}
+			pendingResumes_.push_back(pending);
+		}
+
+		if (!games.empty())
+			std::cout << "Picked up " << games.size() << " games from " << config_.snapshotPath << ", waiting for their players to resume them" << std::endl;
+	}
+
+	std::string GameServer::describePlayer(ClientSession & player)
+	{
+		if (player.playerName.empty())
+			return "Unrated player";
+
+		std::ostringstream os = std::ostringstream();
+		os << player.playerName << " (" << ratings_.getRating(player.playerName) << ")";
+		return os.str();
+	}
+
+	void GameServer::sendRating(ClientSession & player)
+	{
+		if (player.playerName.empty())
+			return;
 
-		int gameIndex = currentGameIndex_++;
-		Game *game = currentGames_ + gameIndex;
-		game->registerPlayer(new NetworkPlayer(&playerOne), PieceSide::O);
-		playerOne.sendMessage("\n\nYou are playing as O's\n\n");
-		game->registerPlayer(new NetworkPlayer(&playerTwo), PieceSide::X);
-		playerTwo.sendMessage("\n\nYou are playing as X's\n\n");
+		std::ostringstream os = std::ostringstream();
+		os << "Your rating is now " << ratings_.getRating(player.playerName) << "\n";
+		player.connection.sendMessage(os.str());
+	}
+
+	StatsReporter::Gauges GameServer::sampleGauges()
+	{
+		StatsReporter::Gauges gauges;
+		gauges.activeConnections = 0;
 
+		serverMutex_.lock();
+		for (unsigned int i = 0; i < activeSessions_.size(); i++)
+		{
+			if (activeSessions_[i]->connection.isConnected())
+				gauges.activeConnections++;
+		}
+		gauges.activeGames = (int)runningGames_.size();
 		serverMutex_.unlock();
 
-		int winner = runGame(currentGames_[gameIndex]);
-		playerOne.sendWinner(winner);
-		playerTwo.sendWinner(winner);
-		playerOne.disconnect(true); playerTwo.disconnect(true); // Disconnect players on game completion
+		gauges.waitingForMatch = matchmaker_.getNumWaiting();
+		gauges.aiQueueDepth = aiWorkers_.getQueueDepth();
+		return gauges;
 	}
 
 	bool GameServer::start(const char * port)
@@ -202,17 +948,47 @@ namespace checkers
 		serverMutex_.lock();
 		if (!isRunning_)
 		{
+			// Before the listener, so every connection accepted goes through it
+			if (config_.useIoUring && !UringReactor::start())
+				std::cout << "io_uring isn't available, every connection gets its own receiving thread" << std::endl;
+
 			listener = ConnectionListener();
-			if (!Connection::listenTo(port, listener, 1000))
+			if (!Connection::listenTo(port, listener, kListenTimeoutMilliseconds, false, shardLink_ != nullptr))
 			{
 				printSockError("Server error on creating listener");
 			}
+			else if (!config_.recordPath.empty() && !recorder_.open(config_.recordPath))
+			{
+				std::cout << "Couldn't create recording " << config_.recordPath << std::endl;
+				listener.end();
+			}
+			else if (!config_.resultsPath.empty() && !resultLog_.open(config_.resultsPath, (unsigned long long)config_.resultsRotateMegabytes * 1024 * 1024))
+			{
+				std::cout << "Couldn't create game result log " << config_.resultsPath << std::endl;
+				recorder_.close();
+				listener.end();
+			}
+			else if ((!config_.statsPort.empty() || config_.statsInterval > 0) && !stats_.start(config_.statsPort, config_.statsInterval, std::cout, [this] { return sampleGauges(); }))
+			{
+				printSockError("Server error on creating stats listener");
+				resultLog_.close();
+				recorder_.close();
+				listener.end();
+			}
 			else
 			{
 				result = true;
 				isRunning_ = true;
-				currentConnectionIndex_ = 0;
-				currentGameIndex_ = 0;
+				sessionPool_.setCapacity(config_.maxConnections);
+				gamePool_.setCapacity(config_.maxGames);
+				matchmaker_.start();
+				scheduler_.start(config_.gameThreads);
+				aiWorkers_.start(config_.aiWorkers);
+				aiBudget_.setNodesPerSecond(config_.aiNodesPerSecond);
+				aiTable_.setCapacity(config_.aiTableMegabytes);
+				Connection::setHeartbeatTimeout(config_.heartbeatTimeout * 1000);
+				if (!config_.snapshotPath.empty())
+					loadSnapshot();
 				runningThread_ = std::thread([this] { run(); });
 			}
 		}
@@ -226,9 +1002,14 @@ namespace checkers
 		if (isRunning_)
 		{
 			isRunning_ = false;
-			listener.end();
+			listener.interrupt(); // Don't wait for the acceptor to time out
 			serverMutex_.unlock();
 			runningThread_.join();
+			aiWorkers_.stop();
+			scheduler_.stop();
+			stats_.stop();
+			recorder_.close();
+			resultLog_.close(); // Once every game has finished, so none are left out
 		}
 		else
 		{
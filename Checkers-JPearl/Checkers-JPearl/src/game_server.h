@@ -2,40 +2,156 @@
 #ifndef GAME_SERVER_H
 #define GAME_SERVER_H
 
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
 #include <thread>
 #include <mutex>
+#include <vector>
 
+#include "ai_budget.h"
+#include "ai_worker_pool.h"
 #include "connection.h"
 #include "game.h"
+#include "game_result_log.h"
+#include "game_snapshot.h"
+#include "game_scheduler.h"
+#include "matchmaker.h"
+#include "object_pool.h"
+#include "server_config.h"
+#include "session_log.h"
+#include "shard_link.h"
+#include "stats_reporter.h"
+#include "transposition_table.h"
 
 namespace checkers
 {
+	class AiPlayer;
 	class Connection;
 	class GameServer
 	{
-		static const int kMaxConnections = 20;
+		static const int kAcceptTimeoutMilliseconds = 1000;
+		static const int kListenTimeoutMilliseconds = 2000; // Covers a previous server on the same port still shutting down
+		static const int kFullServerWaitMilliseconds = 100; // How long to wait for a slot to free up before checking again when at capacity
+		static const int kMatchWaitMilliseconds = 200; // How often a player waiting for a match checks that they're still connected
+		static const unsigned int kMaxPlayerNameLength = 24;
+		static const int kSpectatorWaitMilliseconds = 200; // How often a spectator checks that they're still connected
+		static const int kSpectatorFlushMilliseconds = 1000; // How long to wait for the last updates to reach a spectator once the game ends
+		static const int kShardHandOffMilliseconds = 1000; // How long a player waits for a match on their own shard before being handed to another shard with someone waiting
+		static const int kShardPublishMilliseconds = 100; // How often a shard publishes what it has going on to the others
+		static const int kSnapshotCheckMilliseconds = 100; // How often the snapshot thread checks whether the server is stopping
+		static const int kResumeWaitMilliseconds = 60000; // How long a player resuming a game waits for their opponent to resume it too before winning it
+		static const int kResumeWindowSeconds = 300; // How long after a restart games picked up from a snapshot can be resumed
+
+		// A connected client and the thread that serves it
+		struct ClientSession
+		{
+			Connection connection;
+			std::thread thread;
+			int holds; // Number of things (its thread, a matchmaking ticket, a game) still using this session. Guarded by serverMutex_
+			std::string playerName; // Name rated online games are played under. Empty if unrated
+		};
 
 		bool isRunning_;
 		
 		std::thread runningThread_;
 		std::mutex serverMutex_;
 
-		int currentGameIndex_;
-		Game currentGames_[kMaxConnections];
+		ServerConfig config_;
+
+		ObjectPool<Game> gamePool_;
+		ObjectPool<ClientSession> sessionPool_;
 
 		ConnectionListener listener;
 
-		int currentConnectionIndex_;
-		std::thread instances_[kMaxConnections];
-		Connection currentConnections_[kMaxConnections];
-		Connection *connectionWaitingForOnlineGame_;
+		std::vector<ClientSession*> activeSessions_;
+
+		// A game that can be watched, is snapshot, and is logged once it finishes. Guarded by serverMutex_
+		struct RunningGame
+		{
+			int id;
+			Game *game;
+			std::string description;
+			SnapshotSeat seats[GameSnapshot::kNumSeats];
+			std::chrono::steady_clock::time_point startedAt;
+			bool isInFinalSnapshot; // Saved by the server stopping, so it's logged once it's resumed and finished instead
+		};
+		std::vector<RunningGame> runningGames_;
+		int nextGameId_;
+
+		// A game picked up from a snapshot, waiting for its network players to resume it. Guarded by serverMutex_
+		struct PendingResume
+		{
+			GameSnapshot snapshot;
+			ClientSession *players[GameSnapshot::kNumSeats]; // Players that have resumed so far, each holding their session for the game
+			bool isStarted;
+			std::chrono::steady_clock::time_point loadedAt;
+		};
+		std::vector<std::shared_ptr<PendingResume>> pendingResumes_;
+		std::map<std::string, std::pair<std::shared_ptr<PendingResume>, int>> resumeTokens_; // Seat each unclaimed token takes back
+		std::mt19937_64 tokenRandom_; // Guarded by serverMutex_
+
+		Matchmaker matchmaker_;
+		PlayerRatings ratings_;
+
+		GameScheduler scheduler_;
+		AiWorkerPool aiWorkers_;
+		AiBudget aiBudget_;
+		TranspositionTable aiTable_;
+
+		StatsReporter stats_;
+
+		SessionRecorder recorder_;
+		std::atomic<unsigned int> nextSessionId_; // Identifies sessions in the recording
+
+		GameResultLog resultLog_;
+
+		ShardLink *shardLink_; // Set when running as one shard of a sharded server
 
 		void run();
-		void initConnection(Connection &connection);
-		void addOnlinePlayer(Connection &playerToAdd);
-		int runGame(Game &game);
-		void startAiGame(Connection &player, int aiDifficuluty);
-		void startOnlineGame(Connection &playerOne, Connection &playerTwo);
+		// Starts a session the client opened over the carrier's connection, run just like a connection of its own
+		void acceptSession(ClientSession &carrier, unsigned short sessionId);
+		// Returns sessions that are done to the pool. Expects serverMutex_ to be held
+		void reclaimSessions();
+		// Keeps a session from being reclaimed until the hold is released. Sessions are reclaimed once all holds are released and their connection is idle
+		void holdSession(ClientSession &session);
+		void releaseSession(ClientSession &session);
+		void initConnection(ClientSession &session);
+		void addOnlinePlayer(ClientSession &playerToAdd);
+		// Puts the player in line for a match and, if they were first in line, runs the game once matched
+		void waitForMatch(ClientSession &player, int rating);
+		// Hands a player left waiting alone to another shard with someone waiting. On success the ticket is cancelled, otherwise the player is kept in line here, under a new ticket if the old one had to be given up. Returns whether they were handed over
+		bool handOffPlayer(ClientSession &player, int rating, std::shared_ptr<MatchTicket> &ticket);
+		// Publishes what this shard has going on and takes in players handed to it, until the server stops
+		void runShardLink();
+		// Takes in a player handed over by another shard and puts them in line for a match
+		void adoptPlayer(unsigned int socket, const std::string &playerName, int rating);
+		// Plays the game on the scheduler, listing it for spectators and snapshots while it runs and logging its result once it's over. A snapshot with a state picks the game up from it. onFinished is called with the winner once the game is over and released
+		void runGame(Game &game, const GameSnapshot &snapshot, const std::function<void(int)> &onFinished);
+		void watchGame(ClientSession &spectator);
+		AiPlayer* createAiPlayer(int aiDifficulty);
+		void startAiGame(ClientSession &player, int aiDifficuluty);
+		void startOnlineGame(ClientSession &playerOne, ClientSession &playerTwo);
+		// Gives a network player a token to resume their seat with, if games are being snapshot
+		void giveResumeToken(ClientSession &player, SnapshotSeat &seat);
+		// Asks for a resume token and gives the player their seat back. The game starts once every network player has resumed it. Returns false if the token wasn't for any game
+		bool resumeGame(ClientSession &player);
+		// Runs a game picked up from a snapshot, once all its players are back
+		void startResumedGame(PendingResume &pending);
+		// Saves every running game and every game still waiting to be resumed to the snapshot file. The final snapshot, written as the server stops, marks the games it saved
+		void writeSnapshot(bool isFinal);
+		// Saves running games every snapshot interval until the server stops
+		void runSnapshots();
+		// Picks up the games in the snapshot file, if there is one, for their players to resume
+		void loadSnapshot();
+		// Name and rating of the player for game listings
+		std::string describePlayer(ClientSession &player);
+		// Lets a named player know their current rating
+		void sendRating(ClientSession &player);
+		// Current connection, game, and matchmaking counts for the stats reporter
+		StatsReporter::Gauges sampleGauges();
 
 
 	public:
@@ -44,6 +160,11 @@ namespace checkers
 		void initialize();
 		void release();
 
+		// Replaces the configuration. Takes effect on the next start()
+		void setConfig(const ServerConfig &config);
+		// Runs the server as one shard of a sharded server: listening on a port shared with the other shards and handing players waiting for a match between them. Pass nullptr to run on its own. Takes effect on the next start()
+		void setShardLink(ShardLink *link);
+
 		// Starts the server, returns whether successful
 		bool start(const char * port);
 		void stop();
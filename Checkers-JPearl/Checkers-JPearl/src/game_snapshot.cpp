@@ -0,0 +1,171 @@
+#include "game_snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+namespace checkers
+{
+	const char SnapshotFile::kMagic[4] = { 'C', 'K', 'S', 'N' };
+
+	SnapshotEncoder::SnapshotEncoder(std::string & out) : out_(out)
+	{
+	}
+
+	void SnapshotEncoder::writeNumber(unsigned long long value)
+	{
+		while (value >= 0x80)
+		{
+			out_.push_back((char)(0x80 | (value & 0x7F)));
+			value >>= 7;
+		}
+		out_.push_back((char)value);
+	}
+
+	void SnapshotEncoder::writeString(const std::string & value)
+	{
+		writeNumber(value.length());
+		out_.append(value);
+	}
+
+	void SnapshotEncoder::writeBytes(const char * data, unsigned int length)
+	{
+		out_.append(data, length);
+	}
+
+	SnapshotDecoder::SnapshotDecoder(const std::string & data) : data_(data)
+	{
+		position_ = 0;
+		isValid_ = true;
+	}
+
+	unsigned long long SnapshotDecoder::readNumber()
+	{
+		unsigned long long result = 0;
+		for (int shift = 0; shift < 64 && position_ < data_.size(); shift += 7)
+		{
+			unsigned char byte = (unsigned char)data_[position_++];
+			result |= (unsigned long long)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return result;
+		}
+
+		isValid_ = false;
+		return 0;
+	}
+
+	std::string SnapshotDecoder::readString()
+	{
+		unsigned long long length = readNumber();
+		if (length > data_.size())
+		{
+			isValid_ = false;
+			return std::string();
+		}
+
+		const char * data = readBytes((unsigned int)length);
+		return (data != nullptr) ? std::string(data, (size_t)length) : std::string();
+	}
+
+	const char * SnapshotDecoder::readBytes(unsigned int length)
+	{
+		if (!isValid_ || data_.size() - position_ < length)
+		{
+			isValid_ = false;
+			return nullptr;
+		}
+
+		const char * result = data_.data() + position_;
+		position_ += length;
+		return result;
+	}
+
+	bool SnapshotDecoder::isValid() const
+	{
+		return isValid_;
+	}
+
+	bool SnapshotDecoder::isAtEnd() const
+	{
+		return position_ >= data_.size();
+	}
+
+	SnapshotSeat::SnapshotSeat()
+	{
+		isAi = false;
+		aiLevel = 0;
+	}
+
+	bool SnapshotFile::write(const std::string & path, const std::vector<GameSnapshot>& games)
+	{
+		std::string data(kMagic, sizeof kMagic);
+		data.push_back((char)kVersion);
+
+		SnapshotEncoder encoder(data);
+		encoder.writeNumber(games.size());
+		for (unsigned int i = 0; i < games.size(); i++)
+		{
+			const GameSnapshot &game = games[i];
+			encoder.writeString(game.description);
+			for (int seat = 0; seat < GameSnapshot::kNumSeats; seat++)
+			{
+				encoder.writeNumber(game.seats[seat].isAi ? 1 : 0);
+				encoder.writeNumber(game.seats[seat].aiLevel);
+				encoder.writeString(game.seats[seat].playerName);
+				encoder.writeString(game.seats[seat].resumeToken);
+			}
+			encoder.writeString(game.state);
+		}
+
+		std::string temporaryPath = path + ".tmp";
+		std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file.write(data.data(), data.size()) || !file.flush())
+			return false;
+		file.close();
+
+#ifdef _WIN32
+		// Renaming doesn't replace a file that's already there on Windows
+		std::remove(path.c_str());
+#endif
+		return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+	}
+
+	bool SnapshotFile::read(const std::string & path, std::vector<GameSnapshot>& outGames)
+	{
+		outGames.clear();
+
+		std::ifstream file(path.c_str(), std::ios::binary);
+		if (!file.is_open())
+			return false;
+		std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		if (data.size() < sizeof kMagic + 1 || !std::equal(kMagic, kMagic + sizeof kMagic, data.begin()) || data[sizeof kMagic] != (char)kVersion)
+			return false;
+		data.erase(0, sizeof kMagic + 1);
+
+		SnapshotDecoder decoder(data);
+		unsigned long long numGames = decoder.readNumber();
+		for (unsigned long long i = 0; i < numGames && decoder.isValid(); i++)
+		{
+			GameSnapshot game;
+			game.description = decoder.readString();
+			for (int seat = 0; seat < GameSnapshot::kNumSeats; seat++)
+			{
+				game.seats[seat].isAi = decoder.readNumber() != 0;
+				game.seats[seat].aiLevel = (int)decoder.readNumber();
+				game.seats[seat].playerName = decoder.readString();
+				game.seats[seat].resumeToken = decoder.readString();
+			}
+			game.state = decoder.readString();
+			outGames.push_back(game);
+		}
+
+		if (!decoder.isValid() || !decoder.isAtEnd())
+		{
+			outGames.clear();
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef GAME_SNAPSHOT_H
+#define GAME_SNAPSHOT_H
+
+#include <string>
+#include <vector>
+
+namespace checkers
+{
+	// Appends numbers and strings to a snapshot. Numbers are written as variable length integers, 7 bits per byte, like session logs
+	class SnapshotEncoder
+	{
+		std::string &out_;
+	public:
+		SnapshotEncoder(std::string &out);
+
+		void writeNumber(unsigned long long value);
+		// Writes the length, then the bytes
+		void writeString(const std::string &value);
+		void writeBytes(const char * data, unsigned int length);
+	};
+
+	// Reads back what a SnapshotEncoder wrote. Anything read past the end or out of shape reads as 0 or empty and marks the data invalid
+	class SnapshotDecoder
+	{
+		const std::string &data_;
+		size_t position_;
+		bool isValid_;
+	public:
+		SnapshotDecoder(const std::string &data);
+
+		unsigned long long readNumber();
+		std::string readString();
+		// Returns a pointer to the next length bytes, or nullptr if there aren't that many left
+		const char * readBytes(unsigned int length);
+
+		// Whether everything read so far was there and well formed
+		bool isValid() const;
+		bool isAtEnd() const;
+	};
+
+	// Who plays one side of a game that was snapshot
+	struct SnapshotSeat
+	{
+		bool isAi;
+		int aiLevel; // Only for AI players
+		std::string playerName; // Rated name of a network player, empty if unrated
+		std::string resumeToken; // Given to a network player to take their seat back with after a restart
+
+		SnapshotSeat();
+	};
+
+	// A game as it was when snapshot: who was playing it and the game's own state, see Game::getSnapshot()
+	struct GameSnapshot
+	{
+		static const int kNumSeats = 2;
+
+		std::string description;
+		SnapshotSeat seats[kNumSeats]; // Indexed by the side the seat plays
+		std::string state; // Empty for a game that hasn't started
+	};
+
+	// Snapshot files hold every game a server had running. They start with a short header, then the number of games and each game's description, seats and state
+	class SnapshotFile
+	{
+	public:
+		static const char kMagic[4];
+		static const unsigned char kVersion = 1;
+
+		// Replaces the file at the path with the games. The file is written beside it and moved into place, so it is never left half written. Returns whether it was written
+		static bool write(const std::string &path, const std::vector<GameSnapshot> &games);
+		// Reads the games from the file. Returns false if it can't be opened or isn't a snapshot this build can read
+		static bool read(const std::string &path, std::vector<GameSnapshot> &outGames);
+	};
+}
+
+#endif // GAME_SNAPSHOT_H
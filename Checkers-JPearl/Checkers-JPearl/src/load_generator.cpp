@@ -0,0 +1,366 @@
+#include "load_generator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include "connection.h"
+
+namespace checkers
+{
+	const char * LoadConfig::kUsage =
+		"Usage: CheckersLoad-JPearl --port <port> [options]\n"
+		"  --host <address>       Server to load (localhost by default), or unix:<path> for one listening on a unix domain socket\n"
+		"  --port <port>          Port the server is listening on. Not needed with a unix:<path> host\n"
+		"  --bots <count>         Sessions kept going at once (100 by default)\n"
+		"  --games <count>        Games each session plays (10 by default)\n"
+		"  --sessions <count>     Bots sharing one connection, each game on a session of its own over it (1 by default, a connection per game)\n"
+		"  --mode <ai|online>     Play the server's AI or each other through matchmaking (ai by default)\n"
+		"  --ai-level <0-9>       Difficulty of the server's AI (0 by default)\n"
+		"  --max-turns <count>    Turns a bot plays in one game before forfeiting (200 by default)\n"
+		"  --seed <number>        Seed for the bots' move choices\n"
+		"  --replay <file>        Replay sessions recorded by a server started with --record instead of running bots\n"
+		"  --speed <factor|max>   How many times faster than recorded to replay (1 by default), or max for as fast as possible\n";
+
+	LoadConfig::LoadConfig()
+	{
+		host = "localhost";
+		numBots = 100;
+		gamesPerBot = 10;
+		sessionsPerConnection = 1;
+		playOnline = false;
+		aiLevel = 0;
+		maxTurns = 200;
+		seed = std::random_device()();
+		replaySpeed = 1;
+	}
+
+	// Reads a non-negative integer, returns whether the whole value was a number
+	static bool parseCount(const char * value, int &outCount)
+	{
+		char * end = nullptr;
+		long result = std::strtol(value, &end, 10);
+		if (end == value || *end != '\0' || result < 0)
+			return false;
+		outCount = (int)result;
+		return true;
+	}
+
+	bool LoadConfig::parseArguments(int argc, char ** argv, std::ostream & errors)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char * option = argv[i];
+			if (i + 1 >= argc)
+			{
+				errors << "Missing value for " << option << '\n';
+				return false;
+			}
+			const char * value = argv[++i];
+
+			bool valid = true;
+			int seedValue = 0;
+			if (std::strcmp(option, "--host") == 0)
+				host = value;
+			else if (std::strcmp(option, "--port") == 0)
+				port = value;
+			else if (std::strcmp(option, "--bots") == 0)
+				valid = parseCount(value, numBots) && numBots > 0;
+			else if (std::strcmp(option, "--games") == 0)
+				valid = parseCount(value, gamesPerBot) && gamesPerBot > 0;
+			else if (std::strcmp(option, "--sessions") == 0)
+				valid = parseCount(value, sessionsPerConnection) && sessionsPerConnection > 0;
+			else if (std::strcmp(option, "--mode") == 0)
+			{
+				playOnline = std::strcmp(value, "online") == 0;
+				valid = playOnline || std::strcmp(value, "ai") == 0;
+			}
+			else if (std::strcmp(option, "--ai-level") == 0)
+				valid = parseCount(value, aiLevel) && aiLevel <= 9;
+			else if (std::strcmp(option, "--max-turns") == 0)
+				valid = parseCount(value, maxTurns) && maxTurns > 0;
+			else if (std::strcmp(option, "--seed") == 0)
+			{
+				valid = parseCount(value, seedValue);
+				seed = (unsigned int)seedValue;
+			}
+			else if (std::strcmp(option, "--replay") == 0)
+				replayPath = value;
+			else if (std::strcmp(option, "--speed") == 0)
+			{
+				char * end = nullptr;
+				replaySpeed = (std::strcmp(value, "max") == 0) ? 0 : std::strtod(value, &end);
+				valid = (end == nullptr) || (end != value && *end == '\0' && replaySpeed > 0);
+			}
+			else
+			{
+				errors << "Unrecognized option " << option << '\n';
+				return false;
+			}
+
+			if (!valid)
+			{
+				errors << "Invalid value \"" << value << "\" for " << option << '\n';
+				return false;
+			}
+		}
+		return true;
+	}
+
+	LoadGenerator::LoadGenerator(const LoadConfig & config)
+	{
+		config_ = config;
+		gamesCompleted_ = 0;
+		turnsPlayed_ = 0;
+		connectErrors_ = 0;
+		protocolErrors_ = 0;
+		droppedGames_ = 0;
+		unmatchedBots_ = 0;
+		activeBots_ = 0;
+	}
+
+	std::vector<std::string> LoadGenerator::parseAvailableMoves(const std::string & text)
+	{
+		std::vector<std::string> moves;
+
+		size_t section = text.rfind("Available Moves:");
+		if (section == std::string::npos)
+			return moves;
+
+		// Moves are listed one per line as "\t<number>) <move>"
+		size_t lineStart = text.find('\n', section);
+		while (lineStart != std::string::npos && lineStart + 1 < text.size() && text[lineStart + 1] == '\t')
+		{
+			size_t lineEnd = text.find('\n', lineStart + 1);
+			std::string line = text.substr(lineStart + 2, (lineEnd == std::string::npos) ? std::string::npos : lineEnd - lineStart - 2);
+
+			size_t separator = line.find(") ");
+			if (separator != std::string::npos)
+				moves.push_back(line.substr(separator + 2));
+
+			lineStart = lineEnd;
+		}
+		return moves;
+	}
+
+	bool LoadGenerator::chooseResponse(const std::string & prompt, int index, int turnsPlayed, std::mt19937 & random, std::string & outResponse, bool & outIsMove)
+	{
+		outIsMove = false;
+
+		if (prompt.find("Your choice >") != std::string::npos)
+		{
+			outResponse = config_.playOnline ? "1" : "2";
+			return true;
+		}
+		if (prompt.find("Enter 0-9 >") != std::string::npos)
+		{
+			outResponse = std::string(1, (char)('0' + config_.aiLevel));
+			return true;
+		}
+		if (prompt.find("Enter a name") != std::string::npos)
+		{
+			std::ostringstream name = std::ostringstream();
+			name << "bot" << index;
+			outResponse = name.str();
+			return true;
+		}
+
+		outIsMove = true;
+		std::vector<std::string> moves = parseAvailableMoves(prompt);
+		if (moves.empty() || prompt.find("Not a valid move") != std::string::npos)
+		{
+			outResponse = "forfeit";
+			return false;
+		}
+
+		if (turnsPlayed >= config_.maxTurns)
+			outResponse = "forfeit";
+		else
+			outResponse = moves[std::uniform_int_distribution<size_t>(0, moves.size() - 1)(random)];
+		return true;
+	}
+
+	bool LoadGenerator::playGame(Connection & connection, int index, std::mt19937 & random)
+	{
+		std::string transcript; // Everything the server sent since it last asked for input
+		bool isWaitingForMatch = false;
+		bool isWaitingForTurn = false;
+		Stopwatch sinceMove;
+		int turnsPlayed = 0;
+
+		while (connection.isConnected() || connection.hasMessageWaiting())
+		{
+			if (!connection.waitUntilHasMessage(kMatchCheckMilliseconds))
+			{
+				// Nobody is left to be matched with
+				if (isWaitingForMatch && activeBots_ <= 1)
+				{
+					unmatchedBots_++;
+					return false;
+				}
+				continue;
+			}
+
+			MessageType type;
+			unsigned int length = 0;
+			const char * data = connection.processMessage(type, length);
+			if (data == nullptr)
+				continue;
+
+			switch (type)
+			{
+			case MessageType::SEND_MESSAGE:
+				transcript.append(data, strnlen(data, length));
+				if (transcript.find("Waiting for another player") != std::string::npos)
+					isWaitingForMatch = true;
+				break;
+			case MessageType::REQUEST_INPUT:
+			{
+				isWaitingForMatch = false;
+				if (isWaitingForTurn)
+				{
+					turnLatency_.record(sinceMove.elapsedMicroseconds());
+					isWaitingForTurn = false;
+				}
+
+				std::string response;
+				bool isMove = false;
+				if (!chooseResponse(transcript, index, turnsPlayed, random, response, isMove))
+					protocolErrors_++;
+				transcript.clear();
+
+				if (isMove)
+				{
+					turnsPlayed++;
+					turnsPlayed_++;
+					isWaitingForTurn = true;
+					sinceMove = Stopwatch();
+				}
+				connection.sendMessage(response);
+				break;
+			}
+			case MessageType::WINNER_RESULT:
+				gamesCompleted_++;
+				return true;
+			default:
+				break;
+			}
+		}
+
+		droppedGames_++;
+		return false;
+	}
+
+	void LoadGenerator::runBot(int index)
+	{
+		std::mt19937 random(config_.seed + index);
+
+		// Connections take a moment to finish closing after a game, so the next game starts on a new one while they do
+		std::vector<std::unique_ptr<Connection>> closing;
+		Connection *carrier = carriers_.empty() ? nullptr : carriers_[index / config_.sessionsPerConnection];
+
+		for (int game = 0; game < config_.gamesPerBot; game++)
+		{
+			closing.erase(std::remove_if(closing.begin(), closing.end(), [](const std::unique_ptr<Connection> &connection) { return connection->isIdle(); }), closing.end());
+
+			std::unique_ptr<Connection> connection(new Connection());
+			bool isConnected = (carrier != nullptr)
+				? carrier->openSession(*connection)
+				: Connection::connectTo(config_.host.c_str(), config_.port.c_str(), *connection, kConnectTimeoutMilliseconds);
+			if (!isConnected)
+			{
+				connectErrors_++;
+				continue;
+			}
+
+			// The server closes the connection once it has sent the winner. Bots that gave up close it themselves
+			bool wasPlayed = playGame(*connection, index, random);
+			if (!wasPlayed && connection->isConnected())
+				connection->disconnect(true);
+			closing.push_back(std::move(connection));
+
+			if (!wasPlayed && config_.playOnline && activeBots_ <= 1)
+				break;
+		}
+
+		activeBots_--;
+
+		for (unsigned int i = 0; i < closing.size(); i++)
+		{
+			while (!closing[i]->isIdle())
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	void LoadGenerator::writeReport(std::ostream & stream, std::chrono::steady_clock::duration elapsed) const
+	{
+		double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 1000.0;
+
+		stream << std::fixed << std::setprecision(2)
+			<< "games=" << gamesCompleted_
+			<< " games/sec=" << ((seconds > 0) ? gamesCompleted_ / seconds : 0)
+			<< " turns=" << turnsPlayed_
+			<< " turn_p50_ms=" << turnLatency_.getPercentile(50) / 1000.0
+			<< " turn_p99_ms=" << turnLatency_.getPercentile(99) / 1000.0
+			<< " turn_max_ms=" << turnLatency_.getMax() / 1000.0
+			<< " connect_errors=" << connectErrors_
+			<< " protocol_errors=" << protocolErrors_
+			<< " dropped=" << droppedGames_
+			<< " unmatched=" << unmatchedBots_;
+	}
+
+	unsigned long long LoadGenerator::run(std::ostream & out)
+	{
+		Connection::init();
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		// A carrier that couldn't connect fails every session opened over it, which counts as a connect error each
+		std::vector<std::unique_ptr<Connection>> carriers;
+		if (config_.sessionsPerConnection > 1)
+		{
+			for (int i = 0; i < config_.numBots; i += config_.sessionsPerConnection)
+			{
+				carriers.push_back(std::unique_ptr<Connection>(new Connection()));
+				Connection::connectTo(config_.host.c_str(), config_.port.c_str(), *carriers.back(), kConnectTimeoutMilliseconds);
+				carriers_.push_back(carriers.back().get());
+			}
+		}
+
+		activeBots_ = config_.numBots;
+		std::vector<std::thread> bots;
+		for (int i = 0; i < config_.numBots; i++)
+			bots.push_back(std::thread([this, i] { runBot(i); }));
+
+		while (activeBots_ > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(kProgressIntervalMilliseconds));
+			out << "[" << activeBots_ << " bots] ";
+			writeReport(out, std::chrono::steady_clock::now() - start);
+			out << std::endl;
+		}
+
+		for (unsigned int i = 0; i < bots.size(); i++)
+			bots[i].join();
+
+		for (unsigned int i = 0; i < carriers.size(); i++)
+		{
+			if (carriers[i]->isConnected())
+				carriers[i]->disconnect(true);
+			while (!carriers[i]->isIdle())
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		carriers_.clear();
+
+		out << "Finished: ";
+		writeReport(out, std::chrono::steady_clock::now() - start);
+		out << std::endl;
+
+		Connection::cleanup();
+		return connectErrors_ + protocolErrors_ + droppedGames_;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+
+namespace checkers
+{
+	class Connection;
+
+	// What a LoadGenerator run looks like, read from the command line of the load test binary
+	struct LoadConfig
+	{
+		static const char * kUsage;
+
+		std::string host;
+		std::string port;
+
+		int numBots; // Sessions kept going at once
+		int gamesPerBot; // Games each session plays before it stops
+		int sessionsPerConnection; // Bots sharing one connection, each game played on a session of its own over it. 1 for a connection per game
+		bool playOnline; // Bots play each other through matchmaking instead of playing the server's AI
+		int aiLevel;
+		int maxTurns; // Turns a bot plays in one game before forfeiting, so games can't go on forever
+		unsigned int seed;
+
+		// Session log to replay instead of running bots. Empty to run bots
+		std::string replayPath;
+		double replaySpeed; // How many times faster than recorded to replay. 0 for as fast as possible
+
+		LoadConfig();
+
+		// Reads "--option value" pairs into this config, reporting anything it can't make sense of to errors. Returns whether all arguments were understood
+		bool parseArguments(int argc, char ** argv, std::ostream &errors);
+	};
+
+	// Drives many bot sessions against a server at once. Each bot connects, finds its way through the menus, plays random legal moves from the list the server offers, and reconnects for its next game.
+	// Reports games per second, turn latency as seen by the client, and errors
+	class LoadGenerator
+	{
+		static const int kConnectTimeoutMilliseconds = 5000;
+		static const int kProgressIntervalMilliseconds = 1000;
+		static const int kMatchCheckMilliseconds = 200; // How often a bot waiting for an opponent checks whether anyone is left to play
+
+		LoadConfig config_;
+
+		Histogram turnLatency_; // Microseconds from sending a move until being asked for the next one
+		std::atomic<unsigned long long> gamesCompleted_;
+		std::atomic<unsigned long long> turnsPlayed_;
+		std::atomic<unsigned long long> connectErrors_; // Connections that couldn't be made
+		std::atomic<unsigned long long> protocolErrors_; // Prompts the bot didn't understand or moves the server rejected
+		std::atomic<unsigned long long> droppedGames_; // Connections closed before a winner was sent
+		std::atomic<unsigned long long> unmatchedBots_; // Bots that gave up waiting for an opponent because everyone else was done
+		std::atomic<int> activeBots_;
+
+		// Connections the bots open their sessions over when they share them. Made and closed by run()
+		std::vector<Connection*> carriers_;
+
+		void runBot(int index);
+		// Plays one game over the connection. Returns whether a winner was received
+		bool playGame(Connection &connection, int index, std::mt19937 &random);
+		// Picks the answer to whatever the server last asked. Returns false if the prompt wasn't understood
+		bool chooseResponse(const std::string &prompt, int index, int turnsPlayed, std::mt19937 &random, std::string &outResponse, bool &outIsMove);
+
+		void writeReport(std::ostream &stream, std::chrono::steady_clock::duration elapsed) const;
+	public:
+		LoadGenerator(const LoadConfig &config);
+
+		// Runs every bot to completion, printing progress and a final report to out. Returns the number of errors seen
+		unsigned long long run(std::ostream &out);
+
+		// Lists the moves offered in the last "Available Moves" section of the text
+		static std::vector<std::string> parseAvailableMoves(const std::string &text);
+	};
+}
+
+#endif // LOAD_GENERATOR_H
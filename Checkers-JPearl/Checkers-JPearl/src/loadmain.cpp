@@ -0,0 +1,74 @@
+#include "connection.h"
+#include "load_generator.h"
+#include "session_replayer.h"
+
+#include <iostream>
+#include <string>
+
+#ifndef _WIN32
+	#include <sys/resource.h>
+#endif
+
+static const int kSpareFiles = 64; // Files the process has open besides the bots' connections, eg. standard streams and io_uring
+
+// Raises the limit on open files to fit the connections the bots keep open. Returns false, saying why, if it can't be raised that far
+static bool raiseFileLimit(int numConnections, std::ostream &errors)
+{
+#ifdef _WIN32
+	numConnections; errors;
+	return true;
+#else
+	// A bot's next connection is opened while its last one may still be closing
+	rlim_t needed = (rlim_t)numConnections * 2 + kSpareFiles;
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= needed)
+		return true;
+
+	rlim_t allowed = limit.rlim_cur;
+	if (limit.rlim_max >= needed)
+	{
+		limit.rlim_cur = needed;
+		if (setrlimit(RLIMIT_NOFILE, &limit) == 0)
+			return true;
+	}
+
+	errors << numConnections << " connections need " << needed << " open files, but only " << allowed << " are allowed. Raise the limit (eg. ulimit -n " << needed << ") or run fewer bots" << std::endl;
+	return false;
+#endif
+}
+
+int main(int argc, char ** argv)
+{
+	checkers::LoadConfig config;
+	bool isValid = config.parseArguments(argc, argv, std::cout);
+	bool isUnixHost = checkers::Connection::isUnixAddress(config.host.c_str());
+	if (!isValid || (config.port.empty() && !isUnixHost))
+	{
+		std::cout << checkers::LoadConfig::kUsage;
+		return -1;
+	}
+	std::string server = isUnixHost ? config.host : config.host + ":" + config.port;
+
+	unsigned long long errors = 0;
+	if (!config.replayPath.empty())
+	{
+		checkers::SessionReplayer replayer(config);
+		if (!replayer.load(std::cout))
+			return -1;
+
+		std::cout << "Replaying " << config.replayPath << " against " << server << std::endl;
+		errors = replayer.run(std::cout);
+	}
+	else
+	{
+		int numConnections = (config.numBots + config.sessionsPerConnection - 1) / config.sessionsPerConnection;
+		if (!raiseFileLimit(numConnections, std::cout))
+			return -1;
+
+		std::cout << "Running " << config.numBots << " bots for " << config.gamesPerBot << " games each against " << server << std::endl;
+
+		checkers::LoadGenerator generator(config);
+		errors = generator.run(std::cout);
+	}
+	return (errors == 0) ? 0 : 1;
+}
@@ -1,11 +1,79 @@
 #include "game_menu.h"
+#include "game_server.h"
+#include "server_config.h"
+#include "sharded_server.h"
 
 #include <iostream>
 #include <string>
+#include <thread>
+#include <chrono>
+#include <csignal>
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void requestStop(int signal)
+{
+	signal;
+	stopRequested = 1;
+}
+
+// How the address a dedicated server listens on is reported
+static std::string describeAddress(const std::string &port)
+{
+	return checkers::Connection::isUnixAddress(port.c_str()) ? port : "port " + port;
+}
+
+// Runs a server without the menu until the process is asked to stop
+static int runDedicatedServer(const checkers::ServerConfig &config)
+{
+	checkers::GameServer server;
+	server.initialize();
+	server.setConfig(config);
+
+	if (!server.start(config.port.c_str()))
+	{
+		std::cout << "Couldn't start server on " << describeAddress(config.port) << std::endl;
+		return -1;
+	}
+
+	std::signal(SIGINT, requestStop);
+	std::signal(SIGTERM, requestStop);
+
+	std::cout << "Server listening on " << describeAddress(config.port) << std::endl;
+	while (!stopRequested && server.isRunning())
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	std::cout << "Stopping server" << std::endl;
+	server.release();
+
+	// Only a stop that was asked for is clean, a server that stopped by itself failed
+	return stopRequested ? 0 : -1;
+}
+
+// Runs a server as several shard processes until the process is asked to stop. Each shard stops on the same signal
+static int runShardedServer(const checkers::ServerConfig &config)
+{
+	std::signal(SIGINT, requestStop);
+	std::signal(SIGTERM, requestStop);
+
+	checkers::ShardedServer server;
+	return server.run(config, [] { return stopRequested != 0; });
+}
 
 int main(int argc, char ** argv)
 {
-	argc; argv;
+	if (argc > 1)
+	{
+		checkers::ServerConfig config;
+		if (!config.parseArguments(argc, argv, std::cout) || config.port.empty())
+		{
+			std::cout << checkers::ServerConfig::kUsage;
+			return -1;
+		}
+		if (config.shards > 1)
+			return runShardedServer(config);
+		return runDedicatedServer(config);
+	}
 
 	checkers::GameMenu menu;
 	int result = menu.show();
@@ -0,0 +1,285 @@
+#include "matchmaker.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace checkers
+{
+	MatchTicket::MatchTicket(void * player, int rating)
+	{
+		player_ = player;
+		rating_ = rating;
+		enqueuedAt_ = std::chrono::steady_clock::now();
+		state_ = State::WAITING;
+		isFirst_ = false;
+	}
+
+	void * MatchTicket::getPlayer() const
+	{
+		return player_;
+	}
+
+	int MatchTicket::getRating() const
+	{
+		return rating_;
+	}
+
+	std::chrono::steady_clock::duration MatchTicket::getWaitTime() const
+	{
+		return std::chrono::steady_clock::now() - enqueuedAt_;
+	}
+
+	MatchTicket::State MatchTicket::waitForMatch(unsigned int timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		stateChanged_.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return state_ != State::WAITING; });
+		return state_;
+	}
+
+	bool MatchTicket::cancel()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (state_ == State::MATCHED)
+			return false;
+		state_ = State::CANCELLED;
+		return true;
+	}
+
+	bool MatchTicket::isWaiting()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return state_ == State::WAITING;
+	}
+
+	std::shared_ptr<MatchTicket> MatchTicket::getOpponent()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return opponent_;
+	}
+
+	bool MatchTicket::isFirst()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return isFirst_;
+	}
+
+	Matchmaker::Matchmaker()
+	{
+		isRunning_ = false;
+	}
+
+	int Matchmaker::getBucketIndex(int rating) const
+	{
+		int index = rating / kRatingBucketWidth;
+		return std::max(0, std::min(index, kNumRatingBuckets - 1));
+	}
+
+	int Matchmaker::getRatingWindow(const MatchTicket & ticket) const
+	{
+		long long waitedMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(ticket.getWaitTime()).count();
+		long long window = kBaseRatingWindow + waitedMilliseconds * kRatingWindowGrowthPerSecond / 1000;
+		return (int)std::min<long long>(window, kMaxRatingWindow);
+	}
+
+	void Matchmaker::start()
+	{
+		std::lock_guard<std::mutex> lock(runningMutex_);
+		if (!isRunning_)
+		{
+			isRunning_ = true;
+			matchingThread_ = std::thread([this] { run(); });
+		}
+	}
+
+	void Matchmaker::stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(runningMutex_);
+			if (!isRunning_)
+				return;
+			isRunning_ = false;
+		}
+		runningChanged_.notify_all();
+		matchingThread_.join();
+
+		// Anyone still in line is let go
+		for (int i = 0; i < kNumRatingBuckets; i++)
+		{
+			std::lock_guard<std::mutex> lock(buckets_[i].mutex);
+			for (unsigned int j = 0; j < buckets_[i].tickets.size(); j++)
+			{
+				if (buckets_[i].tickets[j]->cancel())
+					buckets_[i].tickets[j]->stateChanged_.notify_all();
+			}
+			buckets_[i].tickets.clear();
+		}
+	}
+
+	void Matchmaker::run()
+	{
+		std::unique_lock<std::mutex> lock(runningMutex_);
+		while (isRunning_)
+		{
+			lock.unlock();
+			matchBatch();
+			lock.lock();
+
+			runningChanged_.wait_for(lock, std::chrono::milliseconds(kMatchIntervalMilliseconds), [this] { return !isRunning_; });
+		}
+	}
+
+	std::shared_ptr<MatchTicket> Matchmaker::enqueue(void * player, int rating)
+	{
+		std::shared_ptr<MatchTicket> ticket = std::make_shared<MatchTicket>(player, rating);
+
+		RatingBucket &bucket = buckets_[getBucketIndex(rating)];
+		std::lock_guard<std::mutex> lock(bucket.mutex);
+		bucket.tickets.push_back(ticket);
+
+		return ticket;
+	}
+
+	int Matchmaker::getNumWaiting()
+	{
+		int count = 0;
+		for (int i = 0; i < kNumRatingBuckets; i++)
+		{
+			std::lock_guard<std::mutex> lock(buckets_[i].mutex);
+			count += (int)buckets_[i].tickets.size();
+		}
+		return count;
+	}
+
+	bool Matchmaker::tryMatch(const std::shared_ptr<MatchTicket>& first, const std::shared_ptr<MatchTicket>& second)
+	{
+		std::unique_lock<std::mutex> firstLock(first->mutex_, std::defer_lock);
+		std::unique_lock<std::mutex> secondLock(second->mutex_, std::defer_lock);
+		std::lock(firstLock, secondLock);
+
+		if (first->state_ != MatchTicket::State::WAITING || second->state_ != MatchTicket::State::WAITING)
+			return false;
+
+		first->state_ = MatchTicket::State::MATCHED;
+		first->opponent_ = second;
+		first->isFirst_ = true;
+		second->state_ = MatchTicket::State::MATCHED;
+		second->opponent_ = first;
+		second->isFirst_ = false;
+
+		first->stateChanged_.notify_all();
+		second->stateChanged_.notify_all();
+		return true;
+	}
+
+	void Matchmaker::matchBatch()
+	{
+		// Take a snapshot of everyone waiting, holding only one bucket's lock at a time. Players joining meanwhile are picked up next batch
+		std::vector<std::shared_ptr<MatchTicket>> waiting;
+		for (int i = 0; i < kNumRatingBuckets; i++)
+		{
+			std::lock_guard<std::mutex> lock(buckets_[i].mutex);
+			waiting.insert(waiting.end(), buckets_[i].tickets.begin(), buckets_[i].tickets.end());
+		}
+
+		if (waiting.size() >= 2)
+		{
+			std::sort(waiting.begin(), waiting.end(), [](const std::shared_ptr<MatchTicket> &a, const std::shared_ptr<MatchTicket> &b) { return a->getRating() < b->getRating(); });
+
+			// Whoever has waited longest picks first
+			std::vector<int> byWaitTime(waiting.size());
+			for (unsigned int i = 0; i < byWaitTime.size(); i++)
+				byWaitTime[i] = i;
+			std::sort(byWaitTime.begin(), byWaitTime.end(), [&waiting](int a, int b) { return waiting[a]->enqueuedAt_ < waiting[b]->enqueuedAt_; });
+
+			std::vector<bool> isTaken(waiting.size(), false);
+			for (unsigned int i = 0; i < byWaitTime.size(); i++)
+			{
+				int index = byWaitTime[i];
+				if (isTaken[index])
+					continue;
+
+				std::shared_ptr<MatchTicket> &ticket = waiting[index];
+				int window = getRatingWindow(*ticket);
+
+				// Walk outwards from the ticket's place in rating order to find the closest rated opponent still free
+				int below = index - 1, above = index + 1;
+				while (below >= 0 || above < (int)waiting.size())
+				{
+					while (below >= 0 && isTaken[below]) below--;
+					while (above < (int)waiting.size() && isTaken[above]) above++;
+
+					int candidate = -1;
+					int belowDifference = (below >= 0) ? ticket->getRating() - waiting[below]->getRating() : -1;
+					int aboveDifference = (above < (int)waiting.size()) ? waiting[above]->getRating() - ticket->getRating() : -1;
+					if (belowDifference >= 0 && (aboveDifference < 0 || belowDifference <= aboveDifference))
+						candidate = below--;
+					else if (aboveDifference >= 0)
+						candidate = above++;
+					else
+						break;
+
+					// The longer either player has waited, the larger a difference is acceptable
+					int difference = std::abs(ticket->getRating() - waiting[candidate]->getRating());
+					if (difference > std::max(window, getRatingWindow(*waiting[candidate])))
+						continue; // Someone further away in rating may have waited long enough to accept
+
+					if (tryMatch(ticket, waiting[candidate]))
+					{
+						isTaken[index] = true;
+						isTaken[candidate] = true;
+						break;
+					}
+
+					// One of the two was cancelled in the meantime
+					if (!ticket->isWaiting())
+					{
+						isTaken[index] = true;
+						break;
+					}
+					isTaken[candidate] = true;
+				}
+			}
+		}
+
+		// Matched and cancelled tickets leave the queue
+		for (int i = 0; i < kNumRatingBuckets; i++)
+		{
+			std::lock_guard<std::mutex> lock(buckets_[i].mutex);
+			std::vector<std::shared_ptr<MatchTicket>> &tickets = buckets_[i].tickets;
+			tickets.erase(std::remove_if(tickets.begin(), tickets.end(), [](const std::shared_ptr<MatchTicket> &ticket) { return !ticket->isWaiting(); }), tickets.end());
+		}
+	}
+
+	int PlayerRatings::getRating(const std::string & name)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::map<std::string, int>::iterator found = ratings_.find(name);
+		return (found == ratings_.end()) ? kDefaultRating : found->second;
+	}
+
+	void PlayerRatings::setRating(const std::string & name, int rating)
+	{
+		if (name.empty())
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		ratings_[name] = rating;
+	}
+
+	void PlayerRatings::recordResult(const std::string & first, const std::string & second, int winner)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		int firstRating = (ratings_.count(first) > 0) ? ratings_[first] : kDefaultRating;
+		int secondRating = (ratings_.count(second) > 0) ? ratings_[second] : kDefaultRating;
+
+		double expectedFirst = 1.0 / (1.0 + std::pow(10.0, (secondRating - firstRating) / 400.0));
+		double scoreFirst = (winner == 1) ? 1.0 : (winner == 2) ? 0.0 : 0.5;
+		int change = (int)std::round(kKFactor * (scoreFirst - expectedFirst));
+
+		if (!first.empty())
+			ratings_[first] = firstRating + change;
+		if (!second.empty())
+			ratings_[second] = secondRating - change;
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+#ifndef MATCHMAKER_H
+#define MATCHMAKER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace checkers
+{
+	// A player's place in the matchmaking queue. The player's thread waits on it until the matchmaker pairs it up or the player gives up
+	class MatchTicket
+	{
+	public:
+		enum State : unsigned char
+		{
+			WAITING,
+			MATCHED,
+			CANCELLED
+		};
+	private:
+		void *player_;
+		int rating_;
+		std::chrono::steady_clock::time_point enqueuedAt_;
+
+		std::mutex mutex_;
+		std::condition_variable stateChanged_;
+		State state_;
+		std::shared_ptr<MatchTicket> opponent_;
+		bool isFirst_;
+
+		friend class Matchmaker;
+	public:
+		MatchTicket(void *player, int rating);
+
+		void * getPlayer() const;
+		int getRating() const;
+		// How long this ticket has been waiting for a match
+		std::chrono::steady_clock::duration getWaitTime() const;
+
+		// Waits up to timeout (in milliseconds) for the ticket to leave the waiting state. Returns the current state
+		State waitForMatch(unsigned int timeout);
+
+		// Returns whether the ticket is still waiting for a match
+		bool isWaiting();
+
+		// Takes the ticket out of matchmaking. Returns false if it was already matched, in which case the match stands
+		bool cancel();
+
+		// Once matched, the ticket of the opponent and whether this player was first in line (and so plays first)
+		std::shared_ptr<MatchTicket> getOpponent();
+		bool isFirst();
+	};
+
+	// Pairs up waiting players of similar rating. Tickets are kept in buckets by rating, each with its own lock so players joining don't contend with each other.
+	// A background thread pairs up everyone waiting in batches, accepting a larger rating difference the longer a player has been waiting
+	class Matchmaker
+	{
+		static const int kRatingBucketWidth = 100;
+		static const int kNumRatingBuckets = 32; // Ratings beyond the last bucket share it
+		static const int kMatchIntervalMilliseconds = 250;
+		static const int kBaseRatingWindow = 100; // Largest rating difference accepted for someone who just started waiting
+		static const int kRatingWindowGrowthPerSecond = 50;
+		static const int kMaxRatingWindow = 1000; // Beyond this anyone will do
+
+		struct RatingBucket
+		{
+			std::mutex mutex;
+			std::vector<std::shared_ptr<MatchTicket>> tickets;
+		};
+
+		RatingBucket buckets_[kNumRatingBuckets];
+
+		bool isRunning_;
+		std::thread matchingThread_;
+		std::mutex runningMutex_;
+		std::condition_variable runningChanged_;
+
+		int getBucketIndex(int rating) const;
+		// Largest rating difference the ticket will accept right now
+		int getRatingWindow(const MatchTicket &ticket) const;
+		void run();
+		// Pairs up everyone currently waiting that can be paired
+		void matchBatch();
+		// Matches the two tickets if both are still waiting. Returns whether they were matched
+		bool tryMatch(const std::shared_ptr<MatchTicket> &first, const std::shared_ptr<MatchTicket> &second);
+	public:
+		Matchmaker();
+
+		void start();
+		void stop();
+
+		// Puts a player in line for a match
+		std::shared_ptr<MatchTicket> enqueue(void *player, int rating);
+
+		// Number of tickets still waiting for a match
+		int getNumWaiting();
+	};
+
+	// Elo ratings of named players, kept for as long as the server runs
+	class PlayerRatings
+	{
+		static const int kKFactor = 32;
+
+		std::mutex mutex_;
+		std::map<std::string, int> ratings_;
+	public:
+		static const int kDefaultRating = 1200;
+
+		// Returns the rating of the player, or the default rating if they are unrated or haven't played yet
+		int getRating(const std::string &name);
+
+		// Sets the rating of a player whose games were rated elsewhere, eg. by another shard. Ignored for unrated (unnamed) players
+		void setRating(const std::string &name, int rating);
+
+		// Adjusts the ratings of both players given the winner (1 for the first player, 2 for the second, 0 for a draw). Unrated (unnamed) players are left out but still count as an opponent
+		void recordResult(const std::string &first, const std::string &second, int winner);
+	};
+}
+
+#endif // MATCHMAKER_H
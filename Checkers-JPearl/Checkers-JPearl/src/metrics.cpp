@@ -0,0 +1,150 @@
+#include "metrics.h"
+
+namespace checkers
+{
+	Histogram::Histogram()
+	{
+		for (int i = 0; i < kNumBuckets; i++)
+			counts_[i] = 0;
+		total_ = 0;
+		sum_ = 0;
+		max_ = 0;
+	}
+
+	int Histogram::getBucketIndex(unsigned long long value)
+	{
+		if (value < (unsigned long long)kNumSubBuckets)
+			return (int)value; // Small values are counted exactly
+
+		int highestBit = 0;
+		for (unsigned long long remaining = value; remaining > 1; remaining >>= 1)
+			highestBit++;
+
+		int magnitude = highestBit - kSubBucketBits;
+		if (magnitude >= kNumMagnitudes)
+			return kNumBuckets - 1;
+
+		int subBucket = (int)((value >> magnitude) & (kNumSubBuckets - 1));
+		return kNumSubBuckets + magnitude * kNumSubBuckets + subBucket;
+	}
+
+	unsigned long long Histogram::getBucketUpperBound(int index)
+	{
+		if (index < kNumSubBuckets)
+			return index;
+
+		int magnitude = (index - kNumSubBuckets) / kNumSubBuckets;
+		int subBucket = (index - kNumSubBuckets) % kNumSubBuckets;
+		return ((unsigned long long)(kNumSubBuckets + subBucket + 1) << magnitude) - 1;
+	}
+
+	void Histogram::record(unsigned long long value)
+	{
+		counts_[getBucketIndex(value)]++;
+		total_++;
+		sum_ += value;
+
+		unsigned long long currentMax = max_;
+		while (value > currentMax && !max_.compare_exchange_weak(currentMax, value)) {}
+	}
+
+	unsigned long long Histogram::getCount() const
+	{
+		return total_;
+	}
+
+	unsigned long long Histogram::getMax() const
+	{
+		return max_;
+	}
+
+	double Histogram::getMean() const
+	{
+		unsigned long long count = total_;
+		return (count == 0) ? 0 : (double)sum_ / count;
+	}
+
+	unsigned long long Histogram::getPercentile(double percent) const
+	{
+		unsigned long long count = total_;
+		if (count == 0)
+			return 0;
+
+		unsigned long long target = (unsigned long long)(count * percent / 100.0 + 0.5);
+		if (target == 0)
+			target = 1;
+
+		unsigned long long seen = 0;
+		for (int i = 0; i < kNumBuckets; i++)
+		{
+			seen += counts_[i];
+			if (seen >= target)
+			{
+				// The bucket's bound can overshoot what was actually recorded
+				unsigned long long bound = getBucketUpperBound(i);
+				unsigned long long max = max_;
+				return (bound < max) ? bound : max;
+			}
+		}
+		return max_;
+	}
+
+	void Histogram::writeSummary(std::ostream & stream, double divisor) const
+	{
+		stream << "count=" << getCount()
+			<< " mean=" << getMean() / divisor
+			<< " p50=" << getPercentile(50) / divisor
+			<< " p90=" << getPercentile(90) / divisor
+			<< " p99=" << getPercentile(99) / divisor
+			<< " max=" << getMax() / divisor;
+	}
+
+	Stopwatch::Stopwatch()
+	{
+		start_ = std::chrono::steady_clock::now();
+	}
+
+	unsigned long long Stopwatch::elapsedMicroseconds() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+	}
+
+	ServerMetrics::ServerMetrics()
+	{
+		gamesStarted = 0;
+		gamesFinished = 0;
+		gamesTimedOut = 0;
+		movesPlayedUnasked = 0;
+		gameResultsLogged = 0;
+		gameResultsDropped = 0;
+		aiNodesSearched = 0;
+		aiSearchesCut = 0;
+		aiTableProbes = 0;
+		aiTableHits = 0;
+	}
+
+	static ServerMetrics *sharedMetrics = nullptr;
+
+	ServerMetrics & ServerMetrics::get()
+	{
+		if (sharedMetrics != nullptr)
+			return *sharedMetrics;
+
+		static ServerMetrics metrics;
+		return metrics;
+	}
+
+	void ServerMetrics::share(ServerMetrics * metrics)
+	{
+		sharedMetrics = metrics;
+	}
+
+	void ServerMetrics::recordAiThinkTime(int level, unsigned long long microseconds)
+	{
+		if (level < 0)
+			level = 0;
+		if (level >= kNumAiLevels)
+			level = kNumAiLevels - 1;
+		aiThinkTime[level].record(microseconds);
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+namespace checkers
+{
+	// Counts recorded values in log-linear buckets: 16 buckets for every power of two, so any reported value is within about 6% of the true one.
+	// Recording is lock free and can happen from any number of threads at once
+	class Histogram
+	{
+		static const int kSubBucketBits = 4;
+		static const int kNumSubBuckets = 1 << kSubBucketBits;
+		static const int kNumMagnitudes = 37; // Values up to 2^40 (about 12 days in microseconds), larger values land in the last bucket
+		static const int kNumBuckets = kNumSubBuckets + kNumMagnitudes * kNumSubBuckets;
+
+		std::atomic<unsigned long long> counts_[kNumBuckets];
+		std::atomic<unsigned long long> total_;
+		std::atomic<unsigned long long> sum_;
+		std::atomic<unsigned long long> max_;
+
+		static int getBucketIndex(unsigned long long value);
+		// Largest value that lands in the bucket
+		static unsigned long long getBucketUpperBound(int index);
+	public:
+		Histogram();
+
+		void record(unsigned long long value);
+
+		unsigned long long getCount() const;
+		unsigned long long getMax() const;
+		double getMean() const;
+		// Returns the value that the given percent (0-100) of recorded values are at or below
+		unsigned long long getPercentile(double percent) const;
+
+		// Writes count, mean, p50, p90, p99 and max, dividing every value by the divisor (eg. to turn microseconds into milliseconds)
+		void writeSummary(std::ostream &stream, double divisor = 1) const;
+	};
+
+	// Measures a span of time in microseconds
+	class Stopwatch
+	{
+		std::chrono::steady_clock::time_point start_;
+	public:
+		Stopwatch();
+		unsigned long long elapsedMicroseconds() const;
+	};
+
+	// Process wide measurements of what the server is doing. Everything here is safe to record from any thread. Only atomics, so they may be placed in memory shared with other processes
+	struct ServerMetrics
+	{
+		static const int kNumAiLevels = 10;
+
+		Histogram aiThinkTime[kNumAiLevels]; // Microseconds an AI spends finding a move, by level
+		Histogram turnRoundTrip; // Microseconds from asking a network player for a move to receiving it
+		Histogram matchmakingWait; // Microseconds a player waits to be matched with an opponent
+		Histogram aiQueueWait; // Microseconds an AI search waits for a worker
+		Histogram resultLogCommitTime; // Microseconds to write out and sync each batch of game results
+
+		std::atomic<unsigned long long> gamesStarted;
+		std::atomic<unsigned long long> gamesFinished;
+		std::atomic<unsigned long long> gamesTimedOut; // Games lost by a player whose clock ran out
+		std::atomic<unsigned long long> movesPlayedUnasked; // Moves played without asking for them, as they were the only move or planned ahead
+		std::atomic<unsigned long long> gameResultsLogged; // Finished games written to the result log and synced to disk
+		std::atomic<unsigned long long> gameResultsDropped; // Finished games that couldn't be written to the result log
+		std::atomic<unsigned long long> aiNodesSearched; // Positions evaluated by every AI search
+		std::atomic<unsigned long long> aiSearchesCut; // AI searches that ran out of budget before reaching their level's depth
+		std::atomic<unsigned long long> aiTableProbes; // Positions AI searches looked up in the shared transposition table
+		std::atomic<unsigned long long> aiTableHits; // Lookups that found the position already searched
+
+		ServerMetrics();
+
+		static ServerMetrics& get();
+		// Has get() return metrics from now on, eg. ones in memory shared with other processes. Set before anything is recorded
+		static void share(ServerMetrics *metrics);
+
+		void recordAiThinkTime(int level, unsigned long long microseconds);
+	};
+}
+
+#endif // METRICS_H
@@ -1,6 +1,7 @@
 #include "move.h"
 
 #include <stdexcept>
+#include <string>
 
 #include "checker_board.h"
 
@@ -104,6 +105,48 @@ namespace checkers
 		return result;
 	}
 
+	Move Move::parseWithConditionalMoves(const char * sequence, std::vector<std::pair<Move, Move>>& outConditionalMoves)
+	{
+		outConditionalMoves.clear();
+
+		std::string text = sequence;
+		size_t end = text.find(';');
+		Move result = parseFromString(text.substr(0, end).c_str());
+
+		while (end != std::string::npos)
+		{
+			size_t start = end + 1;
+			end = text.find(';', start);
+			std::string entry = text.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+
+			// A trailing separator plans nothing
+			if (entry.find_first_not_of(' ') == std::string::npos)
+				continue;
+
+			size_t arrow = entry.find("->");
+			if (arrow == std::string::npos)
+				throw std::invalid_argument("Could not parse conditional move. Expected the opponent's move, then -> and the reply");
+
+			Move opponentMove = parseFromString(entry.substr(0, arrow).c_str());
+			outConditionalMoves.push_back(std::make_pair(opponentMove, parseFromString(entry.substr(arrow + 2).c_str())));
+		}
+
+		return result;
+	}
+
+	bool Move::operator==(const Move & other) const
+	{
+		if (numCoords_ != other.numCoords_)
+			return false;
+
+		for (int i = 0; i < numCoords_; i++)
+		{
+			if (moveCoords_[i].row != other.moveCoords_[i].row || moveCoords_[i].column != other.moveCoords_[i].column)
+				return false;
+		}
+		return true;
+	}
+
 	std::ostream & operator<<(std::ostream & stream, const Move & move)
 	{
 		if (move.isForfeit())
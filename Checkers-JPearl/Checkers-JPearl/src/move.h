@@ -3,6 +3,8 @@
 #define MOVE_H
 
 #include <ostream>
+#include <utility>
+#include <vector>
 #include "compact_coordinate.h"
 
 namespace checkers
@@ -33,6 +35,11 @@ namespace checkers
 
 		// Parses a string such as d6 f4 d2 into a move with CompactCoordinates. Excepts if the data is invalid
 		static Move parseFromString(const char* sequence);
+		// Parses a move followed by moves planned for later turns, each as the opponent's move and the reply to it, eg. "c3 d4; f6 e5 -> d4 f6; g7 f6 -> b2 c3". Excepts if any of it is invalid
+		static Move parseWithConditionalMoves(const char* sequence, std::vector<std::pair<Move, Move>> &outConditionalMoves);
+
+		// Whether both moves go through the same coordinates
+		bool operator==(const Move &other) const;
 
 		// Inserts a textual representation of the move coordinates into a stream
 		friend std::ostream& operator<< (std::ostream& stream, const Move& move);
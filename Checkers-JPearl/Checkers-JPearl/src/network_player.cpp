@@ -3,6 +3,7 @@
 #include <sstream>
 
 #include "connection.h"
+#include "metrics.h"
 #include "move.h"
 namespace checkers
 {
@@ -11,6 +12,16 @@ namespace checkers
 		connection_ = connection;
 	}
 
+	Move NetworkPlayer::parseResponse(const std::string & input)
+	{
+		std::vector<std::pair<Move, Move>> conditionalMoves;
+		Move result = Move::parseWithConditionalMoves(input.c_str(), conditionalMoves);
+
+		// Each move sent replaces whatever was planned before it
+		conditionalMoves_.assign(conditionalMoves.begin(), conditionalMoves.end());
+		return result;
+	}
+
 	const char * NetworkPlayer::getDescriptor() const
 	{
 		return "Net ";
@@ -26,14 +37,16 @@ namespace checkers
 		{
 			
 			std::string input;
+			Stopwatch roundTrip;
 			connection_->requestInput(input);
+			ServerMetrics::get().turnRoundTrip.record(roundTrip.elapsedMicroseconds());
 
 			try
 			{
 				if (!connection_->isConnected() || input.find("FORFEIT") != std::string::npos || input.find("forfeit") != std::string::npos)
 					result.makeForfeit();
 				else
-					result = checkers::Move::parseFromString(input.c_str());
+					result = parseResponse(input);
 				moveSuccessfullyMade = true;
 			}
 			catch (std::exception& e)
@@ -45,8 +58,71 @@ namespace checkers
 		}
 		return result;
 	}
+	void NetworkPlayer::requestMoveAsync(const MoveHandler & onMove)
+	{
+		requestMoveAsync(onMove, Stopwatch());
+	}
+
+	void NetworkPlayer::requestMoveAsync(const MoveHandler & onMove, const Stopwatch & roundTrip)
+	{
+		connection_->requestInputAsync([this, onMove, roundTrip](bool received, const std::string &input) {
+			ServerMetrics::get().turnRoundTrip.record(roundTrip.elapsedMicroseconds());
+
+			Move result;
+			try
+			{
+				// Nothing is received when the connection closes or the request is cancelled
+				if (!received || !connection_->isConnected() || input.find("FORFEIT") != std::string::npos || input.find("forfeit") != std::string::npos)
+					result.makeForfeit();
+				else
+					result = parseResponse(input);
+			}
+			catch (std::exception& e)
+			{
+				std::ostringstream os = std::ostringstream();
+				os << "Invalid formatting: " << e.what() << "\nTry again > ";
+				connection_->sendMessage(os.str());
+				requestMoveAsync(onMove, Stopwatch());
+				return;
+			}
+
+			onMove(result); // The game may be over and this player gone once the move is handed over
+		});
+	}
+
 	void NetworkPlayer::sendMessage(const char * message) const
 	{
 		connection_->sendMessage(message);
 	}
+	void NetworkPlayer::flushMessages() const
+	{
+		connection_->flush();
+	}
+
+	void NetworkPlayer::setOnDisconnect(const std::function<void()>& onDisconnect)
+	{
+		connection_->setCloseHandler(onDisconnect);
+	}
+
+	void NetworkPlayer::cancelMoveRequest()
+	{
+		connection_->cancelInputRequest();
+	}
+
+	bool NetworkPlayer::takeConditionalMove(const Move & opponentMove, Move & outMove)
+	{
+		if (conditionalMoves_.empty())
+			return false;
+
+		// The rest of the plan followed from the expected move, so none of it holds once the opponent plays something else
+		if (!(conditionalMoves_.front().first == opponentMove))
+		{
+			conditionalMoves_.clear();
+			return false;
+		}
+
+		outMove = conditionalMoves_.front().second;
+		conditionalMoves_.pop_front();
+		return true;
+	}
 }
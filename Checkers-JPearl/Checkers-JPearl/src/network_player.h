@@ -2,6 +2,12 @@
 #ifndef NETWORK_PLAYER_H
 #define NETWORK_PLAYER_H
 
+#include <deque>
+#include <string>
+#include <utility>
+
+#include "metrics.h"
+#include "move.h"
 #include "player.h"
 
 namespace checkers
@@ -10,11 +16,26 @@ namespace checkers
 	class NetworkPlayer : public Player
 	{
 		Connection *connection_;
+
+		// Replies planned with the last move, each to the opponent's move it expects, in the order they come up. Only set as a move is handed over and read once it's been played, so never at the same time
+		std::deque<std::pair<Move, Move>> conditionalMoves_;
+
+		// Reads a move sent by the client along with any moves planned after it. Excepts if it can't be read
+		Move parseResponse(const std::string &input);
+
+		// Asks for a move until one that can be read comes back, then hands it over
+		void requestMoveAsync(const MoveHandler &onMove, const Stopwatch &roundTrip);
 	public:
 		NetworkPlayer(Connection *connection);
 		const char * getDescriptor() const override;
 		Move requestMove() override;
+		// Hands the move over from the connection's receiving thread
+		void requestMoveAsync(const MoveHandler &onMove) override;
 		void sendMessage(const char * message) const override;
+		void flushMessages() const override;
+		void setOnDisconnect(const std::function<void()> &onDisconnect) override;
+		void cancelMoveRequest() override;
+		bool takeConditionalMove(const Move &opponentMove, Move &outMove) override;
 	};
 }
 
@@ -0,0 +1,143 @@
+#pragma once
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace checkers
+{
+	// Hands out objects from slabs of kSlotsPerSlab slots. Slabs are only allocated when every existing slot is taken and are freed again once all of their slots are returned, so an idle pool holds at most one spare slab.
+	// Objects are constructed on acquire() and destroyed on release(). Thread safe
+	template <typename T, int kSlotsPerSlab = 8>
+	class ObjectPool
+	{
+		typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+		struct Slab
+		{
+			Storage slots[kSlotsPerSlab];
+			int freeSlots[kSlotsPerSlab]; // Stack of indices into slots that are not in use
+			int numFree;
+		};
+
+		std::mutex mutex_;
+		std::vector<Slab*> slabs_;
+		int numInUse_;
+		int capacity_;
+
+		// Returns the slab the object was handed out from or nullptr if it isn't from this pool
+		Slab* findSlab(const T * object, int &outIndex) const
+		{
+			for (unsigned int i = 0; i < slabs_.size(); i++)
+			{
+				const Storage *start = slabs_[i]->slots;
+				const Storage *asStorage = reinterpret_cast<const Storage*>(object);
+				if (asStorage >= start && asStorage < start + kSlotsPerSlab)
+				{
+					outIndex = (int)(asStorage - start);
+					return slabs_[i];
+				}
+			}
+			return nullptr;
+		}
+	public:
+		// A capacity of 0 lets the pool grow without limit
+		ObjectPool(int capacity = 0)
+		{
+			numInUse_ = 0;
+			capacity_ = capacity;
+		}
+
+		~ObjectPool()
+		{
+			// Objects still in use are the owner's responsibility, only the memory is reclaimed here
+			for (unsigned int i = 0; i < slabs_.size(); i++)
+				delete slabs_[i];
+		}
+
+		void setCapacity(int capacity)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			capacity_ = capacity;
+		}
+
+		// Constructs a new object in a free slot. Returns nullptr if the pool is at capacity
+		T* acquire()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (capacity_ > 0 && numInUse_ >= capacity_)
+				return nullptr;
+
+			Slab *slab = nullptr;
+			for (unsigned int i = 0; i < slabs_.size() && slab == nullptr; i++)
+			{
+				if (slabs_[i]->numFree > 0)
+					slab = slabs_[i];
+			}
+
+			if (slab == nullptr)
+			{
+				slab = new Slab();
+				for (int i = 0; i < kSlotsPerSlab; i++)
+					slab->freeSlots[i] = kSlotsPerSlab - 1 - i;
+				slab->numFree = kSlotsPerSlab;
+				slabs_.push_back(slab);
+			}
+
+			int index = slab->freeSlots[--slab->numFree];
+			numInUse_++;
+			return new (slab->slots + index) T();
+		}
+
+		// Destroys the object and returns its slot to the pool
+		void release(T * object)
+		{
+			if (object == nullptr)
+				return;
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			int index = 0;
+			Slab *slab = findSlab(object, index);
+			if (slab == nullptr)
+				return;
+
+			object->~T();
+			slab->freeSlots[slab->numFree++] = index;
+			numInUse_--;
+
+			// Give back slabs that are entirely unused as long as another slab has room left
+			if (slab->numFree == kSlotsPerSlab)
+			{
+				for (unsigned int i = 0; i < slabs_.size(); i++)
+				{
+					if (slabs_[i] != slab && slabs_[i]->numFree > 0)
+					{
+						for (unsigned int j = 0; j < slabs_.size(); j++)
+						{
+							if (slabs_[j] == slab)
+							{
+								slabs_.erase(slabs_.begin() + j);
+								break;
+							}
+						}
+						delete slab;
+						break;
+					}
+				}
+			}
+		}
+
+		int numInUse()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return numInUse_;
+		}
+	};
+}
+
+#endif // OBJECT_POOL_H
@@ -1,11 +1,39 @@
 #include "player.h"
 
+#include "move.h"
+
 namespace checkers
 {
 	Player::~Player()
 	{
 	}
 
+	void Player::requestMoveAsync(const MoveHandler & onMove)
+	{
+		onMove(requestMove());
+	}
+
+	void Player::flushMessages() const
+	{
+	}
+
+	void Player::setOnDisconnect(const std::function<void()> &)
+	{
+	}
+
+	void Player::cancelMoveRequest()
+	{
+	}
+
+	void Player::setClock(unsigned int, unsigned int)
+	{
+	}
+
+	bool Player::takeConditionalMove(const Move &, Move &)
+	{
+		return false;
+	}
+
 	char Player::getSymbol() const
 	{
 		return (controllingSide_ == PieceSide::O) ? 'o' : 'x';
@@ -2,6 +2,8 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
+#include <functional>
+
 #include "checker_piece.h"
 namespace checkers
 {
@@ -12,6 +14,9 @@ namespace checkers
 		Game *game_;
 		PieceSide controllingSide_;
 	public:
+		// Takes a move once the player has made it
+		typedef std::function<void(const Move &move)> MoveHandler;
+
 		virtual ~Player();
 
 		// Gets the descriptor for this player to be shown
@@ -20,9 +25,25 @@ namespace checkers
 		// Requests a move from the player
 		virtual Move requestMove() = 0;
 
+		// Requests a move without waiting for it. onMove is called exactly once with the move, from whichever thread the move was made on, and the player isn't touched after.
+		// By default calls requestMove() and hands over its move before returning, which is all players that have nothing to wait on (or can only wait by blocking, like the console) need
+		virtual void requestMoveAsync(const MoveHandler &onMove);
+
 		// Sends a message to the player
 		virtual void sendMessage(const char * message) const = 0;
 
+		// Pushes out any messages the player may be holding back. Does nothing by default
+		virtual void flushMessages() const;
+
+		// Has onDisconnect called, on whichever thread notices, if the player goes away. Pass nullptr to stop, which waits for a call already in progress. Does nothing by default, for players that can't go away
+		virtual void setOnDisconnect(const std::function<void()> &onDisconnect);
+		// Stops waiting on the move asked for with requestMoveAsync() and hands over a forfeit in its place. Does nothing by default, for players whose moves always come
+		virtual void cancelMoveRequest();
+		// Tells the player how much time (in milliseconds) is left on their clock before they are asked for a move, and how much each move adds back. Ignored by default
+		virtual void setClock(unsigned int remaining, unsigned int increment);
+		// Hands over the move the player planned to reply to opponentMove with, so they needn't be asked. Plans that expected a different move are dropped. Returns false by default, for players that plan nothing
+		virtual bool takeConditionalMove(const Move &opponentMove, Move &outMove);
+
 		// Returns the symbol that represents the side this player controls
 		char getSymbol() const;
 
@@ -0,0 +1,138 @@
+#include "server_config.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <string>
+
+namespace checkers
+{
+	const char * ServerConfig::kUsage =
+		"Usage: Checkers-JPearl [--server <port>] [options]\n"
+		"  --server <port>            Run a dedicated server on the port, or unix:<path> for a unix domain socket, instead of showing the menu\n"
+		"  --shards <count>           Run as this many processes sharing the port, each with its own games. Limits and threads below apply to each (POSIX only)\n"
+		"  --network <threads|io_uring> Receive on a thread per connection (the default), or for every connection on one thread with io_uring (Linux only)\n"
+		"  --max-connections <count>  Most clients connected at once (0 for no limit)\n"
+		"  --max-games <count>        Most games running at once (0 for no limit)\n"
+		"  --game-threads <count>     Threads games are played on (0 for one per core)\n"
+		"  --ai-workers <count>       Threads AI moves are searched on (0 for one per core)\n"
+		"  --ai-nodes <count>         Most positions all AI players may search per second, AIs play weaker moves beyond it (0 for no limit)\n"
+		"  --ai-table <megabytes>     Memory for positions searched that every AI player can reuse (32 by default, 0 to not share them)\n"
+		"  --heartbeat <seconds>      Drop clients not heard from for this long, they send a heartbeat every second (10 by default, 0 to never drop them)\n"
+		"  --clock <seconds>[+<inc>]  Time each player has for the game, plus inc seconds for every move. Running out loses (600+5 by default, 0 for no clock)\n"
+		"  --forced-moves <play|ask> Play a player's move for them when it's the only one they have (the default), or ask for it anyway\n"
+		"  --stats-port <port>        Serve plain text stats to connections from this machine on the port\n"
+		"  --stats-interval <seconds> Log a line of stats every so many seconds (0 to not log them)\n"
+		"  --record <file>            Record every session's traffic to the file so it can be replayed with CheckersLoad-JPearl\n"
+		"  --snapshot <file>          Save every running game to the file, and on starting pick up the games saved there so their players can resume them\n"
+		"  --snapshot-interval <seconds> Save running games every so many seconds as well as when stopping (10 by default, 0 to only save when stopping)\n"
+		"  --results <file>           Log every finished game to the file: its players, result, and moves\n"
+		"  --results-rotate <megabytes> Move the result log aside to <file>.1, <file>.2 and so on once it grows this large (64 by default, 0 to never rotate it)\n";
+
+	ServerConfig::ServerConfig()
+	{
+		shards = 0;
+		useIoUring = false;
+		maxConnections = 1000;
+		maxGames = 500;
+		gameThreads = 0;
+		aiWorkers = 0;
+		aiNodesPerSecond = 0;
+		aiTableMegabytes = 32;
+		heartbeatTimeout = 10;
+		clockSeconds = 600;
+		clockIncrementSeconds = 5;
+		autoPlayForcedMoves = true;
+		statsInterval = 0;
+		snapshotInterval = 10;
+		resultsRotateMegabytes = 64;
+	}
+
+	// Reads a non-negative integer, returns whether the whole value was a number
+	static bool parseCount(const char * value, int &outCount)
+	{
+		char * end = nullptr;
+		long result = std::strtol(value, &end, 10);
+		if (end == value || *end != '\0' || result < 0)
+			return false;
+		outCount = (int)result;
+		return true;
+	}
+
+	bool ServerConfig::parseArguments(int argc, char ** argv, std::ostream & errors)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char * option = argv[i];
+			if (i + 1 >= argc)
+			{
+				errors << "Missing value for " << option << '\n';
+				return false;
+			}
+			const char * value = argv[++i];
+
+			bool valid = true;
+			if (std::strcmp(option, "--server") == 0)
+				port = value;
+			else if (std::strcmp(option, "--shards") == 0)
+				valid = parseCount(value, shards);
+			else if (std::strcmp(option, "--network") == 0)
+			{
+				valid = std::strcmp(value, "threads") == 0 || std::strcmp(value, "io_uring") == 0;
+				useIoUring = std::strcmp(value, "io_uring") == 0;
+			}
+			else if (std::strcmp(option, "--max-connections") == 0)
+				valid = parseCount(value, maxConnections);
+			else if (std::strcmp(option, "--max-games") == 0)
+				valid = parseCount(value, maxGames);
+			else if (std::strcmp(option, "--game-threads") == 0)
+				valid = parseCount(value, gameThreads);
+			else if (std::strcmp(option, "--ai-workers") == 0)
+				valid = parseCount(value, aiWorkers);
+			else if (std::strcmp(option, "--ai-nodes") == 0)
+				valid = parseCount(value, aiNodesPerSecond);
+			else if (std::strcmp(option, "--ai-table") == 0)
+				valid = parseCount(value, aiTableMegabytes);
+			else if (std::strcmp(option, "--heartbeat") == 0)
+				valid = parseCount(value, heartbeatTimeout) && heartbeatTimeout != 1; // Any shorter than two heartbeats would drop clients that are fine
+			else if (std::strcmp(option, "--clock") == 0)
+			{
+				// Eg. 300+5, the increment can be left out
+				const char * plus = std::strchr(value, '+');
+				std::string base = (plus != nullptr) ? std::string(value, plus - value) : std::string(value);
+				clockIncrementSeconds = 0;
+				valid = parseCount(base.c_str(), clockSeconds) && (plus == nullptr || parseCount(plus + 1, clockIncrementSeconds));
+			}
+			else if (std::strcmp(option, "--forced-moves") == 0)
+			{
+				valid = std::strcmp(value, "play") == 0 || std::strcmp(value, "ask") == 0;
+				autoPlayForcedMoves = std::strcmp(value, "play") == 0;
+			}
+			else if (std::strcmp(option, "--stats-port") == 0)
+				statsPort = value;
+			else if (std::strcmp(option, "--stats-interval") == 0)
+				valid = parseCount(value, statsInterval);
+			else if (std::strcmp(option, "--record") == 0)
+				recordPath = value;
+			else if (std::strcmp(option, "--snapshot") == 0)
+				snapshotPath = value;
+			else if (std::strcmp(option, "--snapshot-interval") == 0)
+				valid = parseCount(value, snapshotInterval);
+			else if (std::strcmp(option, "--results") == 0)
+				resultsPath = value;
+			else if (std::strcmp(option, "--results-rotate") == 0)
+				valid = parseCount(value, resultsRotateMegabytes);
+			else
+			{
+				errors << "Unrecognized option " << option << '\n';
+				return false;
+			}
+
+			if (!valid)
+			{
+				errors << "Invalid value \"" << value << "\" for " << option << '\n';
+				return false;
+			}
+		}
+		return true;
+	}
+}
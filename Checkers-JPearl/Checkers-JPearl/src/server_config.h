@@ -0,0 +1,76 @@
+#pragma once
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <string>
+#include <ostream>
+
+namespace checkers
+{
+	// Tunables for a GameServer. Defaults are used when the server is started from the menu, and can be overridden on the command line when running a dedicated server
+	struct ServerConfig
+	{
+		static const char * kUsage;
+
+		// Port a dedicated server listens on, or a unix:<path> address. Empty when no dedicated server was requested
+		std::string port;
+
+		// Processes a dedicated server runs as, each listening on the port with games of its own. 0 or 1 for a single process
+		int shards;
+
+		// Receive and send for every connection on one thread with io_uring instead of a receiving thread per connection (Linux only, falls back to threads where it isn't available)
+		bool useIoUring;
+
+		// Most connections and games that may be active at once. 0 removes the limit
+		int maxConnections;
+		int maxGames;
+
+		// Threads games are played on. 0 for one per core
+		int gameThreads;
+
+		// Threads AI searches run on. 0 for one per core
+		int aiWorkers;
+
+		// Most positions all AI players together may search per second. 0 for no limit
+		int aiNodesPerSecond;
+
+		// Megabytes for the transposition table shared by every AI player. 0 to not share searches
+		int aiTableMegabytes;
+
+		// Seconds a client may go without being heard from before it is dropped. 0 never drops
+		int heartbeatTimeout;
+
+		// Seconds each player has on their game clock, and seconds added back for every move. A player whose clock runs out loses. 0 plays without a clock
+		int clockSeconds;
+		int clockIncrementSeconds;
+
+		// Whether a player's only move is played for them rather than asked for
+		bool autoPlayForcedMoves;
+
+		// Local port serving plain text stats. Empty to not serve them
+		std::string statsPort;
+
+		// Seconds between stats lines in the log. 0 to not log them
+		int statsInterval;
+
+		// File to record every session's traffic to for replaying later. Empty to not record
+		std::string recordPath;
+
+		// File every running game is saved to, so players can resume them once the server restarts. Empty to not save them
+		std::string snapshotPath;
+		// Seconds between saves while running, games are also saved as the server stops. 0 only saves them when stopping
+		int snapshotInterval;
+
+		// File every finished game is logged to. Empty to not log them
+		std::string resultsPath;
+		// Megabytes the result log may grow to before it is moved aside and a new one started. 0 never rotates it
+		int resultsRotateMegabytes;
+
+		ServerConfig();
+
+		// Reads "--option value" pairs into this config, reporting anything it can't make sense of to errors. Returns whether all arguments were understood
+		bool parseArguments(int argc, char ** argv, std::ostream &errors);
+	};
+}
+
+#endif // SERVER_CONFIG_H
@@ -0,0 +1,178 @@
+#include "session_log.h"
+
+#include <algorithm>
+
+namespace checkers
+{
+	const char SessionRecorder::kMagic[4] = { 'C', 'K', 'R', 'L' };
+
+	SessionRecorder::SessionRecorder()
+	{
+		lastTime_ = 0;
+	}
+
+	SessionRecorder::~SessionRecorder()
+	{
+		close();
+	}
+
+	bool SessionRecorder::open(const std::string & path)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		file_.open(path.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file_.is_open())
+			return false;
+
+		file_.write(kMagic, sizeof kMagic);
+		file_.put((char)kVersion);
+
+		buffer_.clear();
+		startTime_ = std::chrono::steady_clock::now();
+		lastTime_ = 0;
+		return file_.good();
+	}
+
+	void SessionRecorder::close()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (file_.is_open())
+		{
+			flushBuffer();
+			file_.close();
+		}
+	}
+
+	bool SessionRecorder::isOpen()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return file_.is_open();
+	}
+
+	void SessionRecorder::writeNumber(unsigned long long value)
+	{
+		while (value >= 0x80)
+		{
+			buffer_.push_back((char)(0x80 | (value & 0x7F)));
+			value >>= 7;
+		}
+		buffer_.push_back((char)value);
+	}
+
+	void SessionRecorder::beginRecord(SessionLogRecord::Kind kind, unsigned int sessionId)
+	{
+		unsigned long long now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime_).count();
+
+		buffer_.push_back((char)kind);
+		writeNumber(sessionId);
+		writeNumber(now - lastTime_);
+		lastTime_ = now;
+	}
+
+	void SessionRecorder::flushBuffer()
+	{
+		file_.write(buffer_.data(), buffer_.size());
+		file_.flush();
+		buffer_.clear();
+	}
+
+	void SessionRecorder::onFrame(unsigned int sessionId, bool isIncoming, MessageType type, const char * data, unsigned int length)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!file_.is_open())
+			return;
+
+		beginRecord(isIncoming ? SessionLogRecord::Kind::FRAME_IN : SessionLogRecord::Kind::FRAME_OUT, sessionId);
+		buffer_.push_back((char)type);
+		writeNumber(length);
+		buffer_.append(data, length);
+
+		if (buffer_.size() >= kFlushSize)
+			flushBuffer();
+	}
+
+	void SessionRecorder::onClose(unsigned int sessionId)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!file_.is_open())
+			return;
+
+		beginRecord(SessionLogRecord::Kind::CLOSED, sessionId);
+
+		if (buffer_.size() >= kFlushSize)
+			flushBuffer();
+	}
+
+	SessionLogReader::SessionLogReader()
+	{
+		time_ = 0;
+		isValid_ = false;
+	}
+
+	bool SessionLogReader::open(const std::string & path)
+	{
+		file_.open(path.c_str(), std::ios::binary);
+
+		char magic[sizeof SessionRecorder::kMagic];
+		isValid_ = file_.read(magic, sizeof magic) && std::equal(magic, magic + sizeof magic, SessionRecorder::kMagic) && file_.get() == SessionRecorder::kVersion;
+		time_ = 0;
+		return isValid_;
+	}
+
+	bool SessionLogReader::readNumber(unsigned long long & outValue)
+	{
+		outValue = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			int byte = file_.get();
+			if (byte == std::char_traits<char>::eof())
+				return false;
+
+			outValue |= (unsigned long long)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	bool SessionLogReader::next(SessionLogRecord & outRecord)
+	{
+		if (!isValid_)
+			return false;
+
+		int kind = file_.get();
+		if (kind == std::char_traits<char>::eof())
+			return false; // A clean end of the log
+
+		unsigned long long sessionId = 0, timeDelta = 0;
+		isValid_ = kind <= SessionLogRecord::Kind::CLOSED && readNumber(sessionId) && readNumber(timeDelta);
+		if (!isValid_)
+			return false;
+
+		time_ += timeDelta;
+		outRecord.kind = (SessionLogRecord::Kind)kind;
+		outRecord.sessionId = (unsigned int)sessionId;
+		outRecord.time = time_;
+		outRecord.payload.clear();
+
+		if (outRecord.kind == SessionLogRecord::Kind::CLOSED)
+			return true;
+
+		int type = file_.get();
+		unsigned long long length = 0;
+		isValid_ = type != std::char_traits<char>::eof() && readNumber(length) && length < 0x10000;
+		if (!isValid_)
+			return false;
+
+		outRecord.type = (MessageType)type;
+		outRecord.payload.resize((size_t)length);
+		if (length > 0)
+			isValid_ = (bool)file_.read(&outRecord.payload[0], length);
+		return isValid_;
+	}
+
+	bool SessionLogReader::isValid() const
+	{
+		return isValid_;
+	}
+}
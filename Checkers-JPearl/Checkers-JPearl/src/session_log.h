@@ -0,0 +1,85 @@
+#pragma once
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include "connection.h"
+
+namespace checkers
+{
+	// One entry of a session log: a frame that went either way on a session, or the session closing
+	struct SessionLogRecord
+	{
+		enum Kind : unsigned char
+		{
+			FRAME_IN = 0, // Received from the client
+			FRAME_OUT = 1, // Sent to the client
+			CLOSED = 2
+		};
+
+		Kind kind;
+		unsigned int sessionId;
+		unsigned long long time; // Microseconds since recording started
+		MessageType type;
+		std::string payload;
+	};
+
+	// Writes the traffic of every connection it is tapped into to a compact binary log.
+	// The log starts with a short header, then each record is its kind, session id, microseconds since the previous record, and for frames the type, payload length and payload. Numbers are written as variable length integers, 7 bits per byte
+	class SessionRecorder : public ConnectionTap
+	{
+		static const unsigned int kFlushSize = 64 * 1024; // Records are buffered and written out in chunks of about this size
+
+		std::mutex mutex_;
+		std::ofstream file_;
+		std::string buffer_;
+		std::chrono::steady_clock::time_point startTime_;
+		unsigned long long lastTime_;
+
+		void writeNumber(unsigned long long value);
+		// Starts a record stamped with the current time. Expects mutex_ to be held
+		void beginRecord(SessionLogRecord::Kind kind, unsigned int sessionId);
+		void flushBuffer();
+	public:
+		static const char kMagic[4];
+		static const unsigned char kVersion = 1;
+
+		SessionRecorder();
+		~SessionRecorder();
+
+		// Starts a new log at the path, replacing any file already there. Returns whether it could be created
+		bool open(const std::string &path);
+		void close();
+		bool isOpen();
+
+		void onFrame(unsigned int sessionId, bool isIncoming, MessageType type, const char * data, unsigned int length) override;
+		void onClose(unsigned int sessionId) override;
+	};
+
+	// Reads back the records of a log written by SessionRecorder
+	class SessionLogReader
+	{
+		std::ifstream file_;
+		unsigned long long time_;
+		bool isValid_;
+
+		bool readNumber(unsigned long long &outValue);
+	public:
+		SessionLogReader();
+
+		// Opens the log and checks its header. Returns whether it is a session log this build can read
+		bool open(const std::string &path);
+
+		// Reads the next record. Returns false at the end of the log or if the rest of it is damaged, see isValid()
+		bool next(SessionLogRecord &outRecord);
+
+		// Whether everything read so far was well formed
+		bool isValid() const;
+	};
+}
+
+#endif // SESSION_LOG_H
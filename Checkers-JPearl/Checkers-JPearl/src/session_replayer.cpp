@@ -0,0 +1,249 @@
+#include "session_replayer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "connection.h"
+#include "session_log.h"
+
+namespace checkers
+{
+	SessionReplayer::SessionReplayer(const LoadConfig & config)
+	{
+		config_ = config;
+		recordedSpan_ = 0;
+		sessionsFinished_ = 0;
+		activeSessions_ = 0;
+		sessionsDiverged_ = 0;
+		connectErrors_ = 0;
+		framesSent_ = 0;
+		framesReceived_ = 0;
+	}
+
+	bool SessionReplayer::load(std::ostream & errors)
+	{
+		SessionLogReader reader;
+		if (!reader.open(config_.replayPath))
+		{
+			errors << "Couldn't read session log " << config_.replayPath << '\n';
+			return false;
+		}
+
+		// Index into sessions_ by session id, and when each session was last asked for input
+		std::map<unsigned int, size_t> indices;
+		std::map<unsigned int, unsigned long long> lastRequestTimes;
+		std::set<unsigned int> carriers; // Connections the client opened sessions over
+
+		unsigned long long firstTime = 0;
+		bool isFirst = true;
+
+		SessionLogRecord record;
+		while (reader.next(record))
+		{
+			if (isFirst)
+			{
+				firstTime = record.time;
+				isFirst = false;
+			}
+			recordedSpan_ = record.time - firstTime;
+
+			std::map<unsigned int, size_t>::iterator found = indices.find(record.sessionId);
+			if (found == indices.end())
+			{
+				Session session;
+				session.id = record.sessionId;
+				session.startTime = record.time - firstTime;
+				found = indices.insert(std::make_pair(record.sessionId, sessions_.size())).first;
+				sessions_.push_back(session);
+			}
+			Session &session = sessions_[found->second];
+
+			if (record.kind == SessionLogRecord::Kind::FRAME_OUT && record.type == MessageType::REQUEST_INPUT)
+			{
+				lastRequestTimes[record.sessionId] = record.time;
+			}
+			else if (record.kind == SessionLogRecord::Kind::FRAME_IN && record.type == MessageType::SEND_MESSAGE)
+			{
+				Step step;
+				step.response = std::string(record.payload.c_str()); // The payload carries its own terminator
+				step.thinkTime = (lastRequestTimes.count(record.sessionId) > 0) ? record.time - lastRequestTimes[record.sessionId] : 0;
+				session.steps.push_back(step);
+			}
+			else if (record.kind == SessionLogRecord::Kind::FRAME_IN && record.type == MessageType::OPEN_SESSION)
+			{
+				carriers.insert(record.sessionId);
+			}
+		}
+
+		// Sessions over a shared connection were recorded on their own and are replayed each over a connection of their own, which leaves nothing to replay for the connection that carried them
+		sessions_.erase(std::remove_if(sessions_.begin(), sessions_.end(), [&carriers](const Session &session) { return carriers.count(session.id) > 0; }), sessions_.end());
+
+		if (!reader.isValid())
+			errors << "Session log " << config_.replayPath << " is damaged, replaying what could be read\n";
+
+		return !sessions_.empty() || reader.isValid();
+	}
+
+	void SessionReplayer::waitScaled(std::chrono::steady_clock::time_point from, unsigned long long duration) const
+	{
+		if (config_.replaySpeed <= 0)
+			return;
+
+		std::chrono::microseconds scaled((long long)(duration / config_.replaySpeed));
+		std::this_thread::sleep_until(from + scaled);
+	}
+
+	bool SessionReplayer::replayOver(Connection & connection, const Session & session)
+	{
+		unsigned int nextStep = 0;
+		bool isWaitingForTurn = false;
+		bool isWaitingForMatch = false;
+		Stopwatch sinceResponse;
+
+		while (connection.isConnected() || connection.hasMessageWaiting())
+		{
+			if (!connection.waitUntilHasMessage(kMatchCheckMilliseconds))
+			{
+				// Pairings don't have to come out as recorded, and nobody is left to be matched with
+				if (isWaitingForMatch && activeSessions_ <= 1)
+					return false;
+				continue;
+			}
+
+			MessageType type;
+			unsigned int length = 0;
+			const char * data = connection.processMessage(type, length);
+			if (data == nullptr)
+				continue;
+			framesReceived_++;
+
+			switch (type)
+			{
+			case MessageType::SEND_MESSAGE:
+				// A move the server didn't take when recorded means the game has gone a different way
+				if (std::strstr(data, "Not a valid move") != nullptr)
+					return false;
+				if (std::strstr(data, "Waiting for another player") != nullptr)
+					isWaitingForMatch = true;
+				break;
+			case MessageType::REQUEST_INPUT:
+			{
+				std::chrono::steady_clock::time_point requestedAt = std::chrono::steady_clock::now();
+				isWaitingForMatch = false;
+				if (isWaitingForTurn)
+				{
+					turnLatency_.record(sinceResponse.elapsedMicroseconds());
+					isWaitingForTurn = false;
+				}
+
+				// Asked for more than the client answered when recorded
+				if (nextStep >= session.steps.size())
+					return false;
+
+				const Step &step = session.steps[nextStep++];
+				waitScaled(requestedAt, step.thinkTime);
+
+				connection.sendMessage(step.response);
+				framesSent_++;
+				isWaitingForTurn = true;
+				sinceResponse = Stopwatch();
+				break;
+			}
+			case MessageType::WINNER_RESULT:
+				return nextStep == session.steps.size();
+			default:
+				break;
+			}
+		}
+
+		// The server closed the session, which is what it did when recorded as long as every answer was given
+		return nextStep == session.steps.size();
+	}
+
+	void SessionReplayer::replaySession(const Session & session)
+	{
+		Connection connection;
+		if (!Connection::connectTo(config_.host.c_str(), config_.port.c_str(), connection, kConnectTimeoutMilliseconds))
+		{
+			connectErrors_++;
+			activeSessions_--;
+			sessionsFinished_++;
+			return;
+		}
+
+		// The server closes sessions that went as recorded, the rest are closed from here
+		if (!replayOver(connection, session))
+		{
+			sessionsDiverged_++;
+			if (connection.isConnected())
+				connection.disconnect(true);
+		}
+		activeSessions_--;
+		while (!connection.isIdle())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		sessionsFinished_++;
+	}
+
+	void SessionReplayer::writeReport(std::ostream & stream, std::chrono::steady_clock::duration elapsed) const
+	{
+		double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / 1000.0;
+
+		stream << std::fixed << std::setprecision(2)
+			<< "sessions=" << sessionsFinished_ << "/" << sessions_.size()
+			<< " sessions/sec=" << ((seconds > 0) ? sessionsFinished_ / seconds : 0)
+			<< " frames_sent=" << framesSent_
+			<< " frames_received=" << framesReceived_
+			<< " turn_p50_ms=" << turnLatency_.getPercentile(50) / 1000.0
+			<< " turn_p99_ms=" << turnLatency_.getPercentile(99) / 1000.0
+			<< " turn_max_ms=" << turnLatency_.getMax() / 1000.0
+			<< " connect_errors=" << connectErrors_
+			<< " diverged=" << sessionsDiverged_;
+	}
+
+	unsigned long long SessionReplayer::run(std::ostream & out)
+	{
+		Connection::init();
+
+		std::sort(sessions_.begin(), sessions_.end(), [](const Session &a, const Session &b) { return a.startTime < b.startTime; });
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		// Sessions not yet started count as active so nobody gives up on a match that is still to come
+		activeSessions_ = sessions_.size();
+
+		// Sessions are started as they come due, at the same offsets from each other as when recorded
+		std::vector<std::thread> replays;
+		std::thread dispatcher = std::thread([this, start, &replays] {
+			for (unsigned int i = 0; i < sessions_.size(); i++)
+			{
+				waitScaled(start, sessions_[i].startTime);
+				const Session *session = &sessions_[i];
+				replays.push_back(std::thread([this, session] { replaySession(*session); }));
+			}
+		});
+
+		while (sessionsFinished_ < sessions_.size())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(kProgressIntervalMilliseconds));
+			writeReport(out, std::chrono::steady_clock::now() - start);
+			out << std::endl;
+		}
+
+		dispatcher.join();
+		for (unsigned int i = 0; i < replays.size(); i++)
+			replays[i].join();
+
+		double recordedSeconds = recordedSpan_ / 1000000.0;
+		out << "Finished: ";
+		writeReport(out, std::chrono::steady_clock::now() - start);
+		out << " recorded_seconds=" << recordedSeconds << std::endl;
+
+		Connection::cleanup();
+		return connectErrors_ + sessionsDiverged_;
+	}
+}
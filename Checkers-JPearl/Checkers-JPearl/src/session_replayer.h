@@ -0,0 +1,70 @@
+#pragma once
+#ifndef SESSION_REPLAYER_H
+#define SESSION_REPLAYER_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "load_generator.h"
+#include "metrics.h"
+
+namespace checkers
+{
+	class Connection;
+
+	// Plays the client side of recorded sessions against a server. Sessions start at the same offsets they did when recorded and answer each request for input with what the client answered then, after the same think time.
+	// Everything can be sped up by a factor, or run as fast as possible
+	class SessionReplayer
+	{
+		static const int kConnectTimeoutMilliseconds = 5000;
+		static const int kProgressIntervalMilliseconds = 1000;
+		static const int kMatchCheckMilliseconds = 200; // How often a session waiting for a match checks whether anyone is left to match it
+
+		// What the client answered to one request for input
+		struct Step
+		{
+			std::string response;
+			unsigned long long thinkTime; // Microseconds between being asked and answering
+		};
+
+		struct Session
+		{
+			unsigned int id;
+			unsigned long long startTime; // Microseconds into the recording the session was first seen
+			std::vector<Step> steps;
+		};
+
+		LoadConfig config_;
+		std::vector<Session> sessions_;
+		unsigned long long recordedSpan_; // Microseconds between the first and last record
+
+		Histogram turnLatency_; // Microseconds from answering until being asked again
+		std::atomic<unsigned long long> sessionsFinished_;
+		std::atomic<unsigned long long> activeSessions_; // Sessions not yet finished, including those still to start
+		std::atomic<unsigned long long> sessionsDiverged_; // Sessions where the server didn't respond as it did when recorded
+		std::atomic<unsigned long long> connectErrors_;
+		std::atomic<unsigned long long> framesSent_;
+		std::atomic<unsigned long long> framesReceived_;
+
+		// Waits the recorded duration (in microseconds) scaled by the replay speed
+		void waitScaled(std::chrono::steady_clock::time_point from, unsigned long long duration) const;
+		void replaySession(const Session &session);
+		// Returns whether the session went as recorded
+		bool replayOver(Connection &connection, const Session &session);
+
+		void writeReport(std::ostream &stream, std::chrono::steady_clock::duration elapsed) const;
+	public:
+		SessionReplayer(const LoadConfig &config);
+
+		// Reads every session from the log at config.replayPath. Returns false if it couldn't be read
+		bool load(std::ostream &errors);
+
+		// Replays every session to completion, printing progress and a final report to out. Returns the number of sessions that failed to connect or diverged
+		unsigned long long run(std::ostream &out);
+	};
+}
+
+#endif // SESSION_REPLAYER_H
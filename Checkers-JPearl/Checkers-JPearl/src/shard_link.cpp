@@ -0,0 +1,223 @@
+#include "shard_link.h"
+
+#include <cstring>
+#include <thread>
+#include <chrono>
+
+#ifndef _WIN32
+	#include <sys/types.h>
+	#include <sys/socket.h>
+	#include <sys/uio.h>
+	#include <poll.h>
+	#include <errno.h>
+	#include <unistd.h>
+#endif
+
+namespace checkers
+{
+	// Sent along with the socket of a player handed to another shard
+	struct HandOffMessage
+	{
+		int rating;
+		char playerName[64];
+	};
+
+	ShardTable::ShardTable()
+	{
+		for (int i = 0; i < kMaxShards; i++)
+		{
+			shards[i].pid = 0;
+			shards[i].activeConnections = 0;
+			shards[i].activeGames = 0;
+			shards[i].waitingForMatch = 0;
+			shards[i].aiQueueDepth = 0;
+		}
+	}
+
+	StatsReporter::Gauges ShardTable::sumGauges() const
+	{
+		StatsReporter::Gauges gauges;
+		gauges.activeConnections = 0;
+		gauges.activeGames = 0;
+		gauges.waitingForMatch = 0;
+		gauges.aiQueueDepth = 0;
+
+		for (int i = 0; i < kMaxShards; i++)
+		{
+			if (shards[i].pid == 0)
+				continue;
+
+			gauges.activeConnections += shards[i].activeConnections;
+			gauges.activeGames += shards[i].activeGames;
+			gauges.waitingForMatch += shards[i].waitingForMatch;
+			gauges.aiQueueDepth += shards[i].aiQueueDepth;
+		}
+		return gauges;
+	}
+
+	ShardLink::ShardLink(ShardTable * table, int index, int numShards, int receiveSocket, const int * sendSockets)
+	{
+		table_ = table;
+		index_ = index;
+		numShards_ = numShards;
+		receiveSocket_ = receiveSocket;
+		for (int i = 0; i < ShardTable::kMaxShards; i++)
+			sendSockets_[i] = (i < numShards) ? sendSockets[i] : -1;
+	}
+
+	int ShardLink::getIndex() const
+	{
+		return index_;
+	}
+
+	void ShardLink::publish(const StatsReporter::Gauges & gauges)
+	{
+		ShardTable::Slot &slot = table_->shards[index_];
+		slot.activeConnections = gauges.activeConnections;
+		slot.activeGames = gauges.activeGames;
+		slot.waitingForMatch = gauges.waitingForMatch;
+		slot.aiQueueDepth = gauges.aiQueueDepth;
+	}
+
+	int ShardLink::findMatchShard() const
+	{
+		// Only ever handing players forward means two shards can't swap their players with each other
+		for (int i = 0; i < index_; i++)
+		{
+			if (table_->shards[i].pid != 0 && table_->shards[i].waitingForMatch > 0)
+				return i;
+		}
+		return -1;
+	}
+
+	bool ShardLink::handOff(int shard, Connection & connection, const std::string & playerName, int rating)
+	{
+#ifdef _WIN32
+		shard; connection; playerName; rating;
+		return false;
+#else
+		if (shard < 0 || shard >= numShards_ || shard == index_)
+			return false;
+
+		int socket = (int)connection.detachSocket();
+		if (socket == -1)
+			return false;
+
+		HandOffMessage message;
+		memset(&message, 0, sizeof message);
+		message.rating = rating;
+		strncpy(message.playerName, playerName.c_str(), sizeof message.playerName - 1);
+
+		struct iovec data;
+		data.iov_base = &message;
+		data.iov_len = sizeof message;
+
+		// The socket travels as ancillary data, the receiving process gets its own descriptor for it
+		union
+		{
+			char buffer[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr align;
+		} control;
+		memset(&control, 0, sizeof control);
+
+		struct msghdr header;
+		memset(&header, 0, sizeof header);
+		header.msg_iov = &data;
+		header.msg_iovlen = 1;
+		header.msg_control = control.buffer;
+		header.msg_controllen = sizeof control.buffer;
+
+		struct cmsghdr *rights = CMSG_FIRSTHDR(&header);
+		rights->cmsg_level = SOL_SOCKET;
+		rights->cmsg_type = SCM_RIGHTS;
+		rights->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(rights), &socket, sizeof socket);
+
+		// Never wait on a shard that isn't taking players in, the player can just as well stay here
+		ssize_t sent;
+		do
+		{
+			sent = sendmsg(sendSockets_[shard], &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+		} while (sent == -1 && errno == EINTR);
+
+		if (sent != (ssize_t)sizeof message)
+		{
+			Connection::adoptSocket((unsigned int)socket, connection);
+			return false;
+		}
+
+		// The other shard has its own descriptor now
+		close(socket);
+		return true;
+#endif
+	}
+
+	bool ShardLink::receiveHandOff(unsigned int timeout, unsigned int & outSocket, std::string & outPlayerName, int & outRating)
+	{
+#ifdef _WIN32
+		outSocket; outPlayerName; outRating;
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		return false;
+#else
+		struct pollfd ready;
+		ready.fd = receiveSocket_;
+		ready.events = POLLIN;
+		ready.revents = 0;
+		if (poll(&ready, 1, (int)timeout) <= 0)
+			return false;
+
+		HandOffMessage message;
+		struct iovec data;
+		data.iov_base = &message;
+		data.iov_len = sizeof message;
+
+		union
+		{
+			char buffer[CMSG_SPACE(sizeof(int))];
+			struct cmsghdr align;
+		} control;
+		memset(&control, 0, sizeof control);
+
+		struct msghdr header;
+		memset(&header, 0, sizeof header);
+		header.msg_iov = &data;
+		header.msg_iovlen = 1;
+		header.msg_control = control.buffer;
+		header.msg_controllen = sizeof control.buffer;
+
+		ssize_t received = recvmsg(receiveSocket_, &header, MSG_DONTWAIT);
+		if (received == -1)
+			return false;
+
+		int socket = -1;
+		struct cmsghdr *rights = CMSG_FIRSTHDR(&header);
+		if (rights != nullptr && rights->cmsg_level == SOL_SOCKET && rights->cmsg_type == SCM_RIGHTS && rights->cmsg_len == CMSG_LEN(sizeof(int)))
+			memcpy(&socket, CMSG_DATA(rights), sizeof socket);
+
+		if (socket == -1)
+			return false;
+
+		if (received != (ssize_t)sizeof message)
+		{
+			close(socket);
+			return false;
+		}
+
+		message.playerName[sizeof message.playerName - 1] = '\0';
+		outSocket = (unsigned int)socket;
+		outPlayerName = message.playerName;
+		outRating = message.rating;
+		return true;
+#endif
+	}
+
+	void ShardLink::rejectHandOff(unsigned int socket)
+	{
+#ifdef _WIN32
+		socket;
+#else
+		shutdown((int)socket, SHUT_RDWR);
+		close((int)socket);
+#endif
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef SHARD_LINK_H
+#define SHARD_LINK_H
+
+#include <atomic>
+#include <string>
+
+#include "connection.h"
+#include "metrics.h"
+#include "stats_reporter.h"
+
+namespace checkers
+{
+	// Everything the shards of a sharded server share: stats recorded by all of them and what each has going on. Placed in memory shared between the processes, so it holds nothing but atomics
+	struct ShardTable
+	{
+		static const int kMaxShards = 64;
+
+		// What one shard has going on, published by the shard a few times a second
+		struct Slot
+		{
+			std::atomic<int> pid; // 0 while the shard isn't running
+			std::atomic<int> activeConnections;
+			std::atomic<int> activeGames;
+			std::atomic<int> waitingForMatch;
+			std::atomic<int> aiQueueDepth;
+		};
+
+		ServerMetrics metrics;
+		ConnectionTotals connectionTotals;
+		Slot shards[kMaxShards];
+
+		ShardTable();
+
+		// Gauges of every running shard added together
+		StatsReporter::Gauges sumGauges() const;
+	};
+
+	// A shard's view of the rest of a sharded server: its slot in the shard table, and the sockets players waiting for a match are handed between shards on.
+	// Players left waiting alone are handed to the first shard ahead of theirs with someone waiting, so they gather on as few shards as possible and the matchmaker there can pair them up
+	class ShardLink
+	{
+		ShardTable *table_;
+		int index_;
+		int numShards_;
+		int receiveSocket_; // Where players handed to this shard arrive
+		int sendSockets_[ShardTable::kMaxShards]; // Where each shard receives players handed to it
+	public:
+		ShardLink(ShardTable *table, int index, int numShards, int receiveSocket, const int *sendSockets);
+
+		int getIndex() const;
+
+		// Publishes what this shard has going on for the other shards and the stats
+		void publish(const StatsReporter::Gauges &gauges);
+
+		// The first shard ahead of this one with a player waiting for a match, or -1 if there is none
+		int findMatchShard() const;
+
+		// Detaches the connection and hands it to the shard along with the player's name and rating. Returns whether it was handed over, if not the connection carries on here as it was
+		bool handOff(int shard, Connection &connection, const std::string &playerName, int rating);
+
+		// Waits up to timeout (in milliseconds) for a player handed to this shard and writes their socket and details to the parameters. Returns whether one arrived
+		bool receiveHandOff(unsigned int timeout, unsigned int &outSocket, std::string &outPlayerName, int &outRating);
+		// Closes the socket of a player handed to this shard that can't be taken in
+		static void rejectHandOff(unsigned int socket);
+	};
+}
+
+#endif // SHARD_LINK_H
@@ -0,0 +1,226 @@
+#include "sharded_server.h"
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <new>
+
+#include "game_server.h"
+
+#ifndef _WIN32
+	#include <sys/types.h>
+	#include <sys/socket.h>
+	#include <sys/mman.h>
+	#include <sys/wait.h>
+	#include <signal.h>
+	#include <unistd.h>
+#endif
+
+namespace checkers
+{
+	ShardedServer::ShardedServer()
+	{
+		table_ = nullptr;
+		numShards_ = 0;
+		for (int i = 0; i < ShardTable::kMaxShards; i++)
+			pids_[i] = 0;
+	}
+
+	int ShardedServer::run(const ServerConfig & config, const std::function<bool()>& shouldStop)
+	{
+#ifdef _WIN32
+		shouldStop;
+		std::cout << "Running the server as " << config.shards << " shards isn't supported on Windows" << std::endl;
+		return -1;
+#else
+		if (config.shards > ShardTable::kMaxShards)
+		{
+			std::cout << "Can't run more than " << ShardTable::kMaxShards << " shards" << std::endl;
+			return -1;
+		}
+		// Only ports can be shared between listeners
+		if (Connection::isUnixAddress(config.port.c_str()))
+		{
+			std::cout << "Shards can't share a unix domain socket, run a single process or listen on a port" << std::endl;
+			return -1;
+		}
+		// A resume token only means something to the shard that gave it out, and the client may well reconnect to another
+		if (!config.snapshotPath.empty())
+		{
+			std::cout << "Games can't be snapshot while running as shards, run a single process to resume games after a restart" << std::endl;
+			return -1;
+		}
+		numShards_ = config.shards;
+
+		// Mapped before forking so every shard shares the same pages
+		void *memory = mmap(nullptr, sizeof(ShardTable), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+		{
+			std::cout << "Couldn't map memory shared between shards" << std::endl;
+			return -1;
+		}
+		table_ = new (memory) ShardTable();
+		ServerMetrics::share(&table_->metrics);
+		Connection::shareTotals(&table_->connectionTotals);
+
+		// One datagram socket pair per shard, players are handed to a shard by sending on one end and it receives them on the other
+		int receiveSockets[ShardTable::kMaxShards], sendSockets[ShardTable::kMaxShards];
+		for (int i = 0; i < numShards_; i++)
+		{
+			int pair[2];
+			if (socketpair(AF_UNIX, SOCK_DGRAM, 0, pair) == -1)
+			{
+				std::cout << "Couldn't create sockets to hand players between shards" << std::endl;
+				for (int j = 0; j < i; j++)
+				{
+					close(receiveSockets[j]);
+					close(sendSockets[j]);
+				}
+				return -1;
+			}
+			receiveSockets[i] = pair[0];
+			sendSockets[i] = pair[1];
+		}
+
+		// Anything still buffered would be written out again by every shard
+		std::cout.flush();
+
+		int numStarted = 0;
+		for (int i = 0; i < numShards_; i++)
+		{
+			pid_t pid = fork();
+			if (pid == 0)
+			{
+				for (int j = 0; j < numShards_; j++)
+				{
+					if (j != i)
+						close(receiveSockets[j]);
+				}
+
+				int result = runShard(config, i, receiveSockets[i], sendSockets, shouldStop);
+				std::cout.flush();
+				_exit(result);
+			}
+
+			if (pid == -1)
+			{
+				std::cout << "Couldn't start shard " << i << std::endl;
+				break;
+			}
+
+			pids_[i] = pid;
+			table_->shards[i].pid = pid;
+			numStarted++;
+		}
+
+		// Only the shards use these
+		for (int i = 0; i < numShards_; i++)
+		{
+			close(receiveSockets[i]);
+			close(sendSockets[i]);
+		}
+
+		// Clean only when the stop was asked for and every shard stopped cleanly, otherwise the first failure is returned
+		int result = 0;
+		if (numStarted < numShards_)
+		{
+			stopShards();
+			result = -1;
+		}
+		else if ((!config.statsPort.empty() || config.statsInterval > 0) && !stats_.start(config.statsPort, config.statsInterval, std::cout, [this] { return table_->sumGauges(); }))
+		{
+			printSockError("Server error on creating stats listener");
+			stopShards();
+			result = -1;
+		}
+		else
+		{
+			std::cout << "Server listening on port " << config.port << " with " << numShards_ << " shards" << std::endl;
+		}
+
+		bool isStopping = result != 0;
+		bool isStopRequested = false;
+		while (numStarted > 0)
+		{
+			if (!isStopping && shouldStop())
+			{
+				std::cout << "Stopping server" << std::endl;
+				stopShards();
+				isStopping = true;
+				isStopRequested = true;
+			}
+
+			int status = 0;
+			pid_t exited = waitpid(-1, &status, WNOHANG);
+			if (exited <= 0)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(kWaitMilliseconds));
+				continue;
+			}
+
+			for (int i = 0; i < numShards_; i++)
+			{
+				if (pids_[i] != exited)
+					continue;
+
+				// The rest carry on, the system stops sending connections to a listener that's gone
+				pids_[i] = 0;
+				table_->shards[i].pid = 0;
+				numStarted--;
+				if (!isStopping)
+					std::cout << "Shard " << i << " exited" << std::endl;
+
+				int shardResult = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+				if (result == 0 && (!isStopRequested || shardResult != 0))
+					result = (shardResult != 0) ? shardResult : -1;
+			}
+		}
+
+		stats_.stop();
+		return result;
+#endif
+	}
+
+	int ShardedServer::runShard(const ServerConfig & config, int index, int receiveSocket, const int * sendSockets, const std::function<bool()>& shouldStop)
+	{
+		ShardLink link(table_, index, numShards_, receiveSocket, sendSockets);
+
+		// Stats are reported by the parent, and each shard records and logs results to its own files
+		ServerConfig shardConfig = config;
+		shardConfig.statsPort.clear();
+		shardConfig.statsInterval = 0;
+		if (!shardConfig.recordPath.empty())
+			shardConfig.recordPath += "." + std::to_string(index);
+		if (!shardConfig.resultsPath.empty())
+			shardConfig.resultsPath += ".shard" + std::to_string(index);
+
+		GameServer server;
+		server.initialize();
+		server.setConfig(shardConfig);
+		server.setShardLink(&link);
+
+		if (!server.start(config.port.c_str()))
+		{
+			std::cout << "Couldn't start shard " << index << " on port " << config.port << std::endl;
+			return -1;
+		}
+
+		while (!shouldStop() && server.isRunning())
+			std::this_thread::sleep_for(std::chrono::milliseconds(kWaitMilliseconds));
+
+		server.release();
+		return 0;
+	}
+
+	void ShardedServer::stopShards()
+	{
+#ifndef _WIN32
+		for (int i = 0; i < numShards_; i++)
+		{
+			if (pids_[i] != 0)
+				kill(pids_[i], SIGTERM);
+		}
+#endif
+	}
+}
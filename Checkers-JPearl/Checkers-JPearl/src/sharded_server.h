@@ -0,0 +1,37 @@
+#pragma once
+#ifndef SHARDED_SERVER_H
+#define SHARDED_SERVER_H
+
+#include <functional>
+
+#include "server_config.h"
+#include "shard_link.h"
+#include "stats_reporter.h"
+
+namespace checkers
+{
+	// Runs a dedicated server as several processes (shards), each a GameServer with its own listener on the same port, its own games and its own locks. The system spreads incoming connections across the listeners, so shards never contend with each other.
+	// This process only starts and stops the shards and reports the stats they keep in memory shared between them. POSIX only
+	class ShardedServer
+	{
+		static const int kWaitMilliseconds = 200; // How often shards are checked on
+
+		ShardTable *table_;
+		int numShards_;
+		int pids_[ShardTable::kMaxShards];
+
+		StatsReporter stats_;
+
+		// Runs shard index of a forked process until shouldStop returns true. Returns the process' exit code
+		int runShard(const ServerConfig &config, int index, int receiveSocket, const int *sendSockets, const std::function<bool()> &shouldStop);
+		// Asks every shard still running to stop
+		void stopShards();
+	public:
+		ShardedServer();
+
+		// Starts config.shards shards on config.port and waits until shouldStop returns true or every shard has exited, then stops the rest. shouldStop is also what each shard checks, so it should be set by a signal handler. Returns the process' exit code
+		int run(const ServerConfig &config, const std::function<bool()> &shouldStop);
+	};
+}
+
+#endif // SHARDED_SERVER_H
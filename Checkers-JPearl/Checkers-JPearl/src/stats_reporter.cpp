@@ -0,0 +1,170 @@
+#include "stats_reporter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#include "metrics.h"
+
+namespace checkers
+{
+	StatsReporter::StatsReporter()
+	{
+		isRunning_ = false;
+		logInterval_ = 0;
+		log_ = nullptr;
+	}
+
+	bool StatsReporter::start(const std::string & port, int logInterval, std::ostream & log, const std::function<Gauges()>& sampleGauges)
+	{
+		std::lock_guard<std::mutex> lock(runningMutex_);
+		if (isRunning_)
+			return true;
+
+		listener_ = ConnectionListener();
+		if (!port.empty() && !Connection::listenTo(port.c_str(), listener_, kListenTimeoutMilliseconds, true))
+		{
+			printSockError("Error creating stats listener");
+			return false;
+		}
+
+		logInterval_ = logInterval;
+		log_ = &log;
+		sampleGauges_ = sampleGauges;
+		isRunning_ = true;
+		reportingThread_ = std::thread([this] { run(); });
+		return true;
+	}
+
+	void StatsReporter::stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(runningMutex_);
+			if (!isRunning_)
+				return;
+			isRunning_ = false;
+		}
+		listener_.interrupt();
+		runningChanged_.notify_all();
+		reportingThread_.join();
+
+		if (listener_.isListening())
+			listener_.end();
+	}
+
+	void StatsReporter::run()
+	{
+		std::chrono::steady_clock::time_point nextLog = std::chrono::steady_clock::now() + std::chrono::seconds(logInterval_);
+
+		std::unique_lock<std::mutex> lock(runningMutex_);
+		while (isRunning_)
+		{
+			lock.unlock();
+
+			if (logInterval_ > 0 && std::chrono::steady_clock::now() >= nextLog)
+			{
+				*log_ << formatLogLine(sampleGauges_()) << std::endl;
+				nextLog += std::chrono::seconds(logInterval_);
+			}
+
+			// Don't sleep past the next log line
+			std::chrono::steady_clock::duration wait = std::chrono::milliseconds(kAcceptTimeoutMilliseconds);
+			if (logInterval_ > 0 && nextLog - std::chrono::steady_clock::now() < wait)
+				wait = nextLog - std::chrono::steady_clock::now();
+			unsigned int timeout = (unsigned int)std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(wait).count());
+
+			if (listener_.isListening())
+			{
+				listener_.acceptAndReply([this] { return formatReport(sampleGauges_()); }, timeout);
+				lock.lock();
+			}
+			else
+			{
+				lock.lock();
+				runningChanged_.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return !isRunning_; });
+			}
+		}
+	}
+
+	// Fraction of transposition table lookups that found what they were looking for
+	static double getHitRate(const ServerMetrics &metrics)
+	{
+		unsigned long long probes = metrics.aiTableProbes;
+		return (probes > 0) ? (double)metrics.aiTableHits / probes : 0;
+	}
+
+	std::string StatsReporter::formatReport(const Gauges & gauges)
+	{
+		ServerMetrics &metrics = ServerMetrics::get();
+
+		std::ostringstream os = std::ostringstream();
+		os << std::fixed << std::setprecision(2);
+		os << "connections_active " << gauges.activeConnections << '\n';
+		os << "games_active " << gauges.activeGames << '\n';
+		os << "matchmaking_waiting " << gauges.waitingForMatch << '\n';
+		os << "ai_queue_depth " << gauges.aiQueueDepth << '\n';
+		os << "games_started " << metrics.gamesStarted << '\n';
+		os << "games_finished " << metrics.gamesFinished << '\n';
+		os << "games_timed_out " << metrics.gamesTimedOut << '\n';
+		os << "moves_played_unasked " << metrics.movesPlayedUnasked << '\n';
+		os << "game_results_logged " << metrics.gameResultsLogged << '\n';
+		os << "game_results_dropped " << metrics.gameResultsDropped << '\n';
+		os << "bytes_sent " << Connection::getTotalBytesSent() << '\n';
+		os << "bytes_received " << Connection::getTotalBytesReceived() << '\n';
+		os << "slow_receivers_dropped " << Connection::getTotalSlowReceiversDropped() << '\n';
+		os << "dead_peers_dropped " << Connection::getTotalDeadPeersDropped() << '\n';
+		os << "ai_nodes_searched " << metrics.aiNodesSearched << '\n';
+		os << "ai_searches_cut " << metrics.aiSearchesCut << '\n';
+		os << "ai_table_probes " << metrics.aiTableProbes << '\n';
+		os << "ai_table_hits " << metrics.aiTableHits << '\n';
+		os << "ai_table_hit_rate " << getHitRate(metrics) << '\n';
+
+		// Times are recorded in microseconds and reported in milliseconds
+		os << "turn_round_trip_ms ";
+		metrics.turnRoundTrip.writeSummary(os, 1000);
+		os << "\nmatchmaking_wait_ms ";
+		metrics.matchmakingWait.writeSummary(os, 1000);
+		os << "\nai_queue_wait_ms ";
+		metrics.aiQueueWait.writeSummary(os, 1000);
+		os << "\nresult_log_commit_ms ";
+		metrics.resultLogCommitTime.writeSummary(os, 1000);
+		for (int i = 0; i < ServerMetrics::kNumAiLevels; i++)
+		{
+			os << "\nai_think_ms_level_" << i << ' ';
+			metrics.aiThinkTime[i].writeSummary(os, 1000);
+		}
+		os << '\n';
+		return os.str();
+	}
+
+	std::string StatsReporter::formatLogLine(const Gauges & gauges)
+	{
+		ServerMetrics &metrics = ServerMetrics::get();
+
+		unsigned long long aiMoves = 0;
+		for (int i = 0; i < ServerMetrics::kNumAiLevels; i++)
+			aiMoves += metrics.aiThinkTime[i].getCount();
+
+		std::ostringstream os = std::ostringstream();
+		os << std::fixed << std::setprecision(2);
+		os << "[stats] connections=" << gauges.activeConnections
+			<< " games=" << gauges.activeGames
+			<< " waiting=" << gauges.waitingForMatch
+			<< " finished=" << metrics.gamesFinished
+			<< " timed_out=" << metrics.gamesTimedOut
+			<< " sent=" << Connection::getTotalBytesSent()
+			<< " received=" << Connection::getTotalBytesReceived()
+			<< " slow_dropped=" << Connection::getTotalSlowReceiversDropped()
+			<< " dead_dropped=" << Connection::getTotalDeadPeersDropped()
+			<< " turn_p99_ms=" << metrics.turnRoundTrip.getPercentile(99) / 1000.0
+			<< " match_wait_p99_ms=" << metrics.matchmakingWait.getPercentile(99) / 1000.0
+			<< " ai_moves=" << aiMoves
+			<< " ai_nodes=" << metrics.aiNodesSearched
+			<< " ai_cut=" << metrics.aiSearchesCut
+			<< " ai_table_hit_rate=" << getHitRate(metrics)
+			<< " ai_queue=" << gauges.aiQueueDepth
+			<< " ai_queue_wait_p99_ms=" << metrics.aiQueueWait.getPercentile(99) / 1000.0;
+		return os.str();
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#ifndef STATS_REPORTER_H
+#define STATS_REPORTER_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "connection.h"
+
+namespace checkers
+{
+	// Reports the process' ServerMetrics on a thread of its own: as plain text to anyone connecting to the stats port, and as a summary line logged at a regular interval
+	class StatsReporter
+	{
+		static const int kAcceptTimeoutMilliseconds = 1000;
+		static const int kListenTimeoutMilliseconds = 2000;
+	public:
+		// What the server has going on right now, sampled whenever a report is made
+		struct Gauges
+		{
+			int activeConnections;
+			int activeGames;
+			int waitingForMatch;
+			int aiQueueDepth; // AI searches waiting for a worker
+		};
+	private:
+		bool isRunning_;
+		std::thread reportingThread_;
+		std::mutex runningMutex_;
+		std::condition_variable runningChanged_;
+
+		ConnectionListener listener_;
+		int logInterval_;
+		std::ostream *log_;
+		std::function<Gauges()> sampleGauges_;
+
+		void run();
+	public:
+		StatsReporter();
+
+		// Serves reports on the local port (unless it is empty) and logs a line every logInterval seconds to log (unless it is 0). Returns false if the port couldn't be listened on
+		bool start(const std::string &port, int logInterval, std::ostream &log, const std::function<Gauges()> &sampleGauges);
+		void stop();
+
+		// Full report with one "name value" pair per line
+		static std::string formatReport(const Gauges &gauges);
+		// Single line summary for the log
+		static std::string formatLogLine(const Gauges &gauges);
+	};
+}
+
+#endif // STATS_REPORTER_H
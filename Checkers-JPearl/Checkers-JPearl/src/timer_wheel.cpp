@@ -0,0 +1,151 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+namespace checkers
+{
+	TimerWheel::TimerWheel()
+	{
+		numTimers_ = 0;
+		nextSequence_ = 1;
+		currentTick_ = 0;
+		startTime_ = std::chrono::steady_clock::now();
+		thread_ = std::thread([this] { runThread(); });
+	}
+
+	TimerWheel & TimerWheel::get()
+	{
+		// Never destroyed, timers may still be pending on objects that outlive main
+		static TimerWheel *wheel = new TimerWheel();
+		return *wheel;
+	}
+
+	unsigned long long TimerWheel::getTickNow() const
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime_).count() / kTickMilliseconds;
+	}
+
+	unsigned long long TimerWheel::schedule(unsigned int delay, const std::function<void()>& callback)
+	{
+		unsigned long long ticks = (delay + kTickMilliseconds - 1) / kTickMilliseconds;
+		if (ticks == 0)
+			ticks = 1;
+
+		Timer timer;
+		timer.callback = callback;
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		// Due after the last tick run, or it would land in a slot the thread has already been past and wait a whole turn of the ring
+		timer.dueTick = std::max(getTickNow(), currentTick_) + ticks;
+		// Both slots the timer can be in are found from the id alone when cancelling
+		timer.id = nextSequence_++ * kNumSlots * kNumOuterSlots + timer.dueTick % (kNumSlots * kNumOuterSlots);
+		place(timer);
+		bool wasEmpty = numTimers_ == 0;
+		numTimers_++;
+		lock.unlock();
+
+		// The thread only sleeps without a deadline when there was nothing to run
+		if (wasEmpty)
+			timerAdded_.notify_one();
+		return timer.id;
+	}
+
+	bool TimerWheel::cancel(unsigned long long id)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::vector<Timer> *slots[] = { &slots_[id % kNumSlots], &outerSlots_[(id / kNumSlots) % kNumOuterSlots] };
+		for (int level = 0; level < 2; level++)
+		{
+			std::vector<Timer> &slot = *slots[level];
+			for (unsigned int i = 0; i < slot.size(); i++)
+			{
+				if (slot[i].id == id)
+				{
+					slot.erase(slot.begin() + i);
+					numTimers_--;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	void TimerWheel::place(const Timer & timer)
+	{
+		if (timer.dueTick / kNumSlots <= currentTick_ / kNumSlots)
+			slots_[timer.dueTick % kNumSlots].push_back(timer);
+		else
+			outerSlots_[(timer.dueTick / kNumSlots) % kNumOuterSlots].push_back(timer);
+	}
+
+	void TimerWheel::cascade(std::vector<Timer> &outerSlot)
+	{
+		for (unsigned int i = 0; i < outerSlot.size();)
+		{
+			if (outerSlot[i].dueTick / kNumSlots <= currentTick_ / kNumSlots)
+			{
+				slots_[outerSlot[i].dueTick % kNumSlots].push_back(outerSlot[i]);
+				outerSlot.erase(outerSlot.begin() + i);
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	void TimerWheel::runThread()
+	{
+		std::vector<Timer> due;
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			if (numTimers_ == 0)
+				timerAdded_.wait(lock, [this] { return numTimers_ > 0; });
+			else
+				timerAdded_.wait_until(lock, startTime_ + std::chrono::milliseconds((currentTick_ + 1) * kTickMilliseconds));
+
+			// Catch up on every tick passed since. Going once around the ring visits every slot, so anything further behind can be skipped once everything in the outer ring due by then has been moved down
+			unsigned long long tickNow = getTickNow();
+			if (tickNow - currentTick_ > kNumSlots)
+			{
+				currentTick_ = tickNow - kNumSlots;
+				for (unsigned int i = 0; i < kNumOuterSlots; i++)
+					cascade(outerSlots_[i]);
+			}
+
+			while (currentTick_ < tickNow)
+			{
+				currentTick_++;
+				if (currentTick_ % kNumSlots == 0)
+					cascade(outerSlots_[(currentTick_ / kNumSlots) % kNumOuterSlots]);
+
+				std::vector<Timer> &slot = slots_[currentTick_ % kNumSlots];
+				for (unsigned int i = 0; i < slot.size();)
+				{
+					if (slot[i].dueTick <= currentTick_)
+					{
+						due.push_back(slot[i]);
+						slot.erase(slot.begin() + i);
+						numTimers_--;
+					}
+					else
+					{
+						i++;
+					}
+				}
+			}
+
+			if (due.empty())
+				continue;
+
+			// Callbacks are free to schedule or cancel timers
+			lock.unlock();
+			for (unsigned int i = 0; i < due.size(); i++)
+				due[i].callback();
+			due.clear();
+			lock.lock();
+		}
+	}
+}
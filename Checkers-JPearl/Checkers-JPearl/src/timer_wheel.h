@@ -0,0 +1,60 @@
+#pragma once
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace checkers
+{
+	// Runs callbacks after a delay on a single thread, however many timers are pending. Timers are kept in a ring of slots, one per tick, so scheduling and cancelling only touch the timer's own slot.
+	// Timers further out than one turn of the ring wait in a second, coarser ring with a slot per turn of the first, and move down into the first once their turn comes. So long timers, like game clocks, are only looked at once on their way instead of every turn.
+	// Timers further out than the coarse ring wait in their slot until their turn comes around. Callbacks run in tick order and should be short, everything else due waits on them
+	class TimerWheel
+	{
+		static const unsigned int kNumSlots = 256;
+		static const unsigned int kNumOuterSlots = 64; // Each as long as a turn of the inner ring, so together they cover over two and a half minutes
+		static const int kTickMilliseconds = 10;
+
+		struct Timer
+		{
+			unsigned long long id;
+			unsigned long long dueTick;
+			std::function<void()> callback;
+		};
+
+		std::mutex mutex_;
+		std::condition_variable timerAdded_;
+		std::thread thread_;
+		std::vector<Timer> slots_[kNumSlots];
+		std::vector<Timer> outerSlots_[kNumOuterSlots];
+		unsigned int numTimers_;
+		unsigned long long nextSequence_;
+		unsigned long long currentTick_; // Last tick whose timers have been run
+		std::chrono::steady_clock::time_point startTime_;
+
+		TimerWheel();
+
+		void runThread();
+		// Puts the timer in the inner ring if it is due within the turn being run, otherwise in the outer ring. Expects mutex_ to be held
+		void place(const Timer &timer);
+		// Moves timers from the outer slot into the inner ring once they are due within the turn being run. Expects mutex_ to be held
+		void cascade(std::vector<Timer> &outerSlot);
+		// Ticks since the wheel started, rounded down
+		unsigned long long getTickNow() const;
+	public:
+		// The process wide wheel, started on first use and left running until the process exits
+		static TimerWheel& get();
+
+		// Runs the callback once after delay (in milliseconds), rounded up to a whole tick. Returns an id to cancel it with, never 0
+		unsigned long long schedule(unsigned int delay, const std::function<void()> &callback);
+		// Returns whether the timer was cancelled before it ran. False if it has run, is running, or was already cancelled
+		bool cancel(unsigned long long id);
+	};
+}
+
+#endif // TIMER_WHEEL_H
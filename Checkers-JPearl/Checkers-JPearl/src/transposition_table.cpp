@@ -0,0 +1,149 @@
+#include "transposition_table.h"
+
+#include <cstring>
+
+#include "checker_piece.h"
+
+namespace checkers
+{
+	static unsigned long long toBits(double value)
+	{
+		unsigned long long bits;
+		std::memcpy(&bits, &value, sizeof bits);
+		return bits;
+	}
+
+	static double fromBits(unsigned long long bits)
+	{
+		double value;
+		std::memcpy(&value, &bits, sizeof value);
+		return value;
+	}
+
+	// SplitMix64 finalizer, spreads a small number over all 64 bits
+	static unsigned long long mix(unsigned long long value)
+	{
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+		return value ^ (value >> 31);
+	}
+
+	TranspositionTable::TranspositionTable()
+	{
+		numBuckets_ = 0;
+		numSearches_ = 0;
+	}
+
+	void TranspositionTable::setCapacity(size_t megabytes)
+	{
+		entries_.reset();
+		numBuckets_ = 0;
+
+		size_t bucketSize = sizeof(Entry) * kEntriesPerBucket;
+		size_t maxBuckets = megabytes * 1024 * 1024 / bucketSize;
+		if (maxBuckets == 0)
+			return;
+
+		numBuckets_ = 1;
+		while (numBuckets_ * 2 <= maxBuckets)
+			numBuckets_ *= 2;
+
+		size_t numEntries = numBuckets_ * kEntriesPerBucket;
+		entries_.reset(new Entry[numEntries]);
+		for (size_t i = 0; i < numEntries; i++)
+		{
+			entries_[i].check = 0;
+			entries_[i].bestScore = 0;
+			entries_[i].worstScore = 0;
+			entries_[i].meta = 0;
+		}
+	}
+
+	bool TranspositionTable::isEnabled() const
+	{
+		return numBuckets_ > 0;
+	}
+
+	size_t TranspositionTable::getSize() const
+	{
+		return numBuckets_ * kEntriesPerBucket * sizeof(Entry);
+	}
+
+	unsigned long long TranspositionTable::makeKey(unsigned long long boardHash, PieceSide sideToMove, int depth)
+	{
+		return boardHash ^ mix(1 + sideToMove + 2 * (unsigned long long)depth);
+	}
+
+	unsigned int TranspositionTable::getGeneration() const
+	{
+		return (numSearches_.load(std::memory_order_relaxed) / kSearchesPerGeneration) & 0xFF;
+	}
+
+	void TranspositionTable::startSearch()
+	{
+		numSearches_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	bool TranspositionTable::probe(unsigned long long key, double & outBestScore, double & outWorstScore) const
+	{
+		if (numBuckets_ == 0)
+			return false;
+
+		Entry *bucket = &entries_[(key & (numBuckets_ - 1)) * kEntriesPerBucket];
+		for (int i = 0; i < kEntriesPerBucket; i++)
+		{
+			unsigned long long meta = bucket[i].meta.load(std::memory_order_relaxed);
+			unsigned long long best = bucket[i].bestScore.load(std::memory_order_relaxed);
+			unsigned long long worst = bucket[i].worstScore.load(std::memory_order_relaxed);
+			unsigned long long check = bucket[i].check.load(std::memory_order_relaxed);
+
+			if (meta != 0 && (check ^ best ^ worst ^ meta) == key)
+			{
+				outBestScore = fromBits(best);
+				outWorstScore = fromBits(worst);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void TranspositionTable::store(unsigned long long key, double bestScore, double worstScore, int depth)
+	{
+		if (numBuckets_ == 0)
+			return;
+
+		unsigned int generation = getGeneration();
+		Entry *bucket = &entries_[(key & (numBuckets_ - 1)) * kEntriesPerBucket];
+
+		// Take over the key's own entry or an empty one if there is one, otherwise whichever is worth the least
+		Entry *target = nullptr;
+		int targetWorth = 0;
+		for (int i = 0; i < kEntriesPerBucket; i++)
+		{
+			unsigned long long meta = bucket[i].meta.load(std::memory_order_relaxed);
+			if (meta == 0 || (bucket[i].check.load(std::memory_order_relaxed) ^ bucket[i].bestScore.load(std::memory_order_relaxed) ^ bucket[i].worstScore.load(std::memory_order_relaxed) ^ meta) == key)
+			{
+				target = &bucket[i];
+				break;
+			}
+
+			int age = (int)((generation - (meta >> 8)) & 0xFF);
+			int worth = (int)(meta & 0xFF) - age * kAgePenalty;
+			if (target == nullptr || worth < targetWorth)
+			{
+				target = &bucket[i];
+				targetWorth = worth;
+			}
+		}
+
+		// The depth is stored one higher so a depth 0 entry isn't mistaken for an empty one
+		unsigned long long meta = (unsigned long long)((depth + 1) & 0xFF) | ((unsigned long long)generation << 8);
+		unsigned long long best = toBits(bestScore);
+		unsigned long long worst = toBits(worstScore);
+
+		target->meta.store(meta, std::memory_order_relaxed);
+		target->bestScore.store(best, std::memory_order_relaxed);
+		target->worstScore.store(worst, std::memory_order_relaxed);
+		target->check.store(key ^ best ^ worst ^ meta, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#ifndef TRANSPOSITION_TABLE_H
+#define TRANSPOSITION_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace checkers
+{
+	enum PieceSide : unsigned char;
+
+	// Remembers the outcome of searching a position so AI players, in any game, don't search it again. Entries are keyed by the position, whose move it is, and how deep it was searched.
+	// Lock free: every entry is stored with a check word that is its key XOR'd with its contents, so an entry torn by two threads writing it at once no longer matches its key and reads as a miss.
+	// Positions hash into buckets of a few entries. When a bucket is full the entry replaced is the one that saved the least work, with entries from older generations counting for less
+	class TranspositionTable
+	{
+		static const int kEntriesPerBucket = 4;
+		static const unsigned int kSearchesPerGeneration = 256; // Entries age by a generation every so many searches
+		static const int kAgePenalty = 2; // Depth an entry is worth less for each generation it has gone unused
+
+		struct Entry
+		{
+			std::atomic<unsigned long long> check;
+			std::atomic<unsigned long long> bestScore; // Bits of the doubles
+			std::atomic<unsigned long long> worstScore;
+			std::atomic<unsigned long long> meta; // Depth in the low byte and generation in the next. 0 when the entry is empty
+		};
+
+		std::unique_ptr<Entry[]> entries_;
+		size_t numBuckets_; // A power of two
+		std::atomic<unsigned int> numSearches_;
+
+		unsigned int getGeneration() const;
+	public:
+		TranspositionTable();
+
+		// Sizes the table to fit in the given number of megabytes, clearing it. 0 turns it off. Must not be called while anything is using the table
+		void setCapacity(size_t megabytes);
+		bool isEnabled() const;
+		// Memory taken by the entries in bytes
+		size_t getSize() const;
+
+		// Key for the position with the given side to move, searched the given number of moves deep
+		static unsigned long long makeKey(unsigned long long boardHash, PieceSide sideToMove, int depth);
+
+		// Ages the table. Called once at the start of every search
+		void startSearch();
+
+		// Returns whether the key was found, filling in the scores it was stored with
+		bool probe(unsigned long long key, double &outBestScore, double &outWorstScore) const;
+		void store(unsigned long long key, double bestScore, double worstScore, int depth);
+	};
+}
+
+#endif // TRANSPOSITION_TABLE_H
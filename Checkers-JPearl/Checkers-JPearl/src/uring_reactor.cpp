@@ -0,0 +1,556 @@
+#include "uring_reactor.h"
+#include "connection.h"
+
+#ifdef __linux__
+	#include <linux/io_uring.h>
+	#include <sys/syscall.h>
+	#include <sys/mman.h>
+	#include <sys/eventfd.h>
+	#include <sys/socket.h>
+	#include <sys/uio.h>
+	#include <poll.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <string.h>
+#endif
+
+#include <iostream>
+#include <chrono>
+
+namespace checkers
+{
+	UringReactor * UringReactor::instance_ = nullptr;
+
+	UringReactor::UringReactor()
+	{
+		ring_ = nullptr;
+		wakeSocket_ = -1;
+		isWakePending_ = false;
+		nextId_ = 1;
+	}
+
+	bool UringReactor::start()
+	{
+		static std::mutex startMutex;
+		std::lock_guard<std::mutex> lock(startMutex);
+		if (instance_ != nullptr)
+			return true;
+
+		// Never destroyed, like the timer wheel it may be in use by connections that outlive main
+		UringReactor *reactor = new UringReactor();
+		if (!reactor->open())
+		{
+			delete reactor;
+			return false;
+		}
+
+		reactor->thread_ = std::thread([reactor] { reactor->runThread(); });
+		reactor->thread_.detach();
+		instance_ = reactor;
+		return true;
+	}
+
+	UringReactor * UringReactor::get()
+	{
+		return instance_;
+	}
+
+	unsigned long long UringReactor::add(Connection * connection)
+	{
+		Command command;
+		command.type = ADD;
+		command.connection = connection;
+		command.id = nextId_++;
+		pushCommand(command);
+		return command.id;
+	}
+
+	void UringReactor::remove(unsigned long long id)
+	{
+		Command command;
+		command.type = REMOVE;
+		command.connection = nullptr;
+		command.id = id;
+		pushCommand(command);
+	}
+
+	void UringReactor::resume(unsigned long long id)
+	{
+		Command command;
+		command.type = RESUME;
+		command.connection = nullptr;
+		command.id = id;
+		pushCommand(command);
+	}
+
+	void UringReactor::flush(Connection * connection)
+	{
+		Command command;
+		command.type = FLUSH;
+		command.connection = connection;
+		command.id = 0;
+		pushCommand(command);
+	}
+
+#ifndef __linux__
+	struct UringReactor::Ring {};
+
+	bool UringReactor::open()
+	{
+		return false;
+	}
+
+	void UringReactor::runThread() {}
+	void UringReactor::pushCommand(const Command &) {}
+#else
+	// What every user_data of the ring points to, other than the wake up poll and cancellations
+	struct UringReactor::Operation
+	{
+		enum Kind : unsigned char
+		{
+			RECEIVE,
+			SEND
+		};
+		Kind kind;
+	};
+
+	// A connection being received for
+	struct UringReactor::Registration : Operation
+	{
+		Connection *connection;
+		unsigned long long id;
+		bool isArmed; // The multishot receive is in flight
+		bool isCancelling;
+		bool isRemoved;
+		bool hasFailed; // The other end closed or the socket failed, so nothing more will arrive
+	};
+
+	// A gathered send of a connection's pending frames. The frames are held until it completes
+	struct UringReactor::SendOperation : Operation
+	{
+		Connection *connection;
+		struct msghdr header;
+		struct iovec vectors[kMaxSendVectors];
+		SharedFrame frames[kMaxSendVectors];
+	};
+
+	// Layout of the mapped rings, kept apart from the reactor so the helpers below can work on it
+	struct RingMemory
+	{
+		int fd;
+
+		unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+		unsigned int sqEntries;
+		unsigned int sqLocalTail; // Entries prepared, published to the kernel on submit
+		unsigned int numPrepared;
+		struct io_uring_sqe *sqes;
+
+		unsigned int *cqHead, *cqTail, *cqMask;
+		struct io_uring_cqe *cqes;
+
+		struct io_uring_buf *buffers; // Ring of buffers the kernel picks from to receive into. The tail shares the first entry's reserved field
+		unsigned short bufferTail;
+		char *bufferMemory;
+	};
+
+	struct UringReactor::Ring : RingMemory {};
+
+	static const unsigned long long kCancelUserData = 0;
+	static const unsigned long long kWakeUserData = 1;
+
+	static int setupRing(unsigned int entries, struct io_uring_params *params)
+	{
+		return (int)syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	static int enterRing(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+	{
+		return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+	}
+
+	static int registerRing(int fd, unsigned int opcode, void *arg, unsigned int numArgs)
+	{
+		return (int)syscall(__NR_io_uring_register, fd, opcode, arg, numArgs);
+	}
+
+	// Hands every prepared entry to the kernel. With wait set, also sleeps until at least one completion is ready
+	static bool submit(RingMemory &ring, bool wait)
+	{
+		__atomic_store_n(ring.sqTail, ring.sqLocalTail, __ATOMIC_RELEASE);
+
+		while (true)
+		{
+			int result = enterRing(ring.fd, ring.numPrepared, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+			if (result >= 0)
+			{
+				ring.numPrepared -= (unsigned int)result;
+				return true;
+			}
+			if (errno == EINTR)
+				continue;
+			// Completions have to be reaped before more can be submitted
+			return errno == EBUSY || errno == EAGAIN;
+		}
+	}
+
+	// Next free submission entry, cleared. Submits what is prepared if the queue is full
+	static struct io_uring_sqe * getEntry(RingMemory &ring)
+	{
+		while (ring.sqLocalTail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE) >= ring.sqEntries)
+		{
+			if (!submit(ring, false))
+				return nullptr;
+		}
+
+		unsigned int index = ring.sqLocalTail & *ring.sqMask;
+		struct io_uring_sqe *entry = &ring.sqes[index];
+		memset(entry, 0, sizeof *entry);
+		ring.sqArray[index] = index;
+		ring.sqLocalTail++;
+		ring.numPrepared++;
+		return entry;
+	}
+
+	// Gives a buffer back for the kernel to receive into again
+	static void recycleBuffer(RingMemory &ring, unsigned short id, unsigned int numBuffers, unsigned int bufferSize)
+	{
+		struct io_uring_buf &buffer = ring.buffers[ring.bufferTail & (numBuffers - 1)];
+		buffer.addr = (unsigned long long)(ring.bufferMemory + (size_t)id * bufferSize);
+		buffer.len = bufferSize;
+		buffer.bid = id;
+		ring.bufferTail++;
+		__atomic_store_n(&ring.buffers[0].resv, ring.bufferTail, __ATOMIC_RELEASE);
+	}
+
+	bool UringReactor::open()
+	{
+		struct io_uring_params params;
+		memset(&params, 0, sizeof params);
+		int fd = setupRing(kQueueDepth, &params);
+		if (fd < 0)
+			return false;
+
+		// Rings from before 5.4 are mapped separately, and lack the multishot receives relied on anyway
+		if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+		{
+			close(fd);
+			return false;
+		}
+
+		size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+		size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		size_t ringSize = (sqSize > cqSize) ? sqSize : cqSize;
+		char *rings = (char*)mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (rings == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+
+		struct io_uring_sqe *sqes = (struct io_uring_sqe*)mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+		{
+			munmap(rings, ringSize);
+			close(fd);
+			return false;
+		}
+
+		// The buffer ring has to be page aligned, which a fresh mapping always is
+		size_t buffersSize = kNumBuffers * sizeof(struct io_uring_buf);
+		struct io_uring_buf *buffers = (struct io_uring_buf*)mmap(nullptr, buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		struct io_uring_buf_reg registration;
+		memset(&registration, 0, sizeof registration);
+		registration.ring_addr = (unsigned long long)buffers;
+		registration.ring_entries = kNumBuffers;
+		registration.bgid = 0;
+
+		int wakeSocket = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (buffers == MAP_FAILED || registerRing(fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0 || wakeSocket < 0)
+		{
+			if (buffers != MAP_FAILED)
+				munmap(buffers, buffersSize);
+			if (wakeSocket >= 0)
+				close(wakeSocket);
+			munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+			munmap(rings, ringSize);
+			close(fd);
+			return false;
+		}
+
+		Ring *ring = new Ring();
+		ring->fd = fd;
+		ring->sqHead = (unsigned int*)(rings + params.sq_off.head);
+		ring->sqTail = (unsigned int*)(rings + params.sq_off.tail);
+		ring->sqMask = (unsigned int*)(rings + params.sq_off.ring_mask);
+		ring->sqArray = (unsigned int*)(rings + params.sq_off.array);
+		ring->sqEntries = params.sq_entries;
+		ring->sqLocalTail = *ring->sqTail;
+		ring->numPrepared = 0;
+		ring->sqes = sqes;
+		ring->cqHead = (unsigned int*)(rings + params.cq_off.head);
+		ring->cqTail = (unsigned int*)(rings + params.cq_off.tail);
+		ring->cqMask = (unsigned int*)(rings + params.cq_off.ring_mask);
+		ring->cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+		ring->buffers = buffers;
+		ring->bufferTail = 0;
+		ring->bufferMemory = new char[(size_t)kNumBuffers * kBufferSize];
+		for (unsigned int i = 0; i < kNumBuffers; i++)
+			recycleBuffer(*ring, (unsigned short)i, kNumBuffers, kBufferSize);
+
+		ring_ = ring;
+		wakeSocket_ = wakeSocket;
+		return true;
+	}
+
+	void UringReactor::pushCommand(const Command & command)
+	{
+		commandMutex_.lock();
+		commands_.push_back(command);
+		commandMutex_.unlock();
+
+		// Only the first command since the thread last looked needs to wake it
+		if (!isWakePending_.exchange(true))
+		{
+			unsigned long long one = 1;
+			if (write(wakeSocket_, &one, sizeof one) < 0) {}
+		}
+	}
+
+	void UringReactor::armWake()
+	{
+		struct io_uring_sqe *entry = getEntry(*ring_);
+		if (entry == nullptr)
+			return;
+		entry->opcode = IORING_OP_POLL_ADD;
+		entry->fd = wakeSocket_;
+		entry->poll32_events = POLLIN;
+		entry->len = IORING_POLL_ADD_MULTI;
+		entry->user_data = kWakeUserData;
+	}
+
+	void UringReactor::runThread()
+	{
+		std::vector<Command> commands;
+		armWake();
+
+		while (true)
+		{
+			// Cleared before taking the commands, so anything queued after this wakes the thread again
+			isWakePending_ = false;
+			commandMutex_.lock();
+			commands.swap(commands_);
+			commandMutex_.unlock();
+
+			for (unsigned int i = 0; i < commands.size(); i++)
+				handleCommand(commands[i]);
+			commands.clear();
+
+			// Everything prepared since the last time goes in with the same call that waits
+			if (!submit(*ring_, true))
+			{
+				std::cout << "io_uring submission failed " << errno << std::endl;
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+
+			unsigned int head = *ring_->cqHead;
+			unsigned int tail = __atomic_load_n(ring_->cqTail, __ATOMIC_ACQUIRE);
+			while (head != tail)
+			{
+				struct io_uring_cqe completion = ring_->cqes[head & *ring_->cqMask];
+				head++;
+				// Released right away, handling it may prepare entries that complete into the freed slots
+				__atomic_store_n(ring_->cqHead, head, __ATOMIC_RELEASE);
+
+				if (completion.user_data == kCancelUserData)
+					continue;
+
+				if (completion.user_data == kWakeUserData)
+				{
+					unsigned long long count;
+					if (read(wakeSocket_, &count, sizeof count) < 0) {}
+					if (!(completion.flags & IORING_CQE_F_MORE))
+						armWake();
+					continue;
+				}
+
+				Operation *operation = reinterpret_cast<Operation*>(completion.user_data);
+				if (operation->kind == Operation::RECEIVE)
+					onReceiveCompleted(*static_cast<Registration*>(operation), completion.res, completion.flags);
+				else
+					onSendCompleted(static_cast<SendOperation*>(operation), completion.res);
+
+				if (head == tail)
+					tail = __atomic_load_n(ring_->cqTail, __ATOMIC_ACQUIRE);
+			}
+		}
+	}
+
+	void UringReactor::handleCommand(const Command & command)
+	{
+		if (command.type == FLUSH)
+		{
+			startSend(command.connection);
+			return;
+		}
+
+		if (command.type == ADD)
+		{
+			Registration *registration = new Registration();
+			registration->kind = Operation::RECEIVE;
+			registration->connection = command.connection;
+			registration->id = command.id;
+			registration->isArmed = false;
+			registration->isCancelling = false;
+			registration->isRemoved = false;
+			registration->hasFailed = false;
+			registrations_[command.id] = registration;
+			armReceive(*registration);
+			return;
+		}
+
+		// The connection may have stopped being received for already
+		std::map<unsigned long long, Registration*>::iterator found = registrations_.find(command.id);
+		if (found == registrations_.end())
+			return;
+		Registration &registration = *found->second;
+
+		if (command.type == REMOVE)
+		{
+			registration.isRemoved = true;
+			if (registration.isArmed)
+				cancelReceive(registration);
+			else
+				finish(registration);
+		}
+		else if (command.type == RESUME)
+		{
+			registration.connection->onReceived(nullptr, 0);
+			if (!registration.isArmed && !registration.isRemoved && !registration.hasFailed && registration.connection->getBufferedInput() < kMaxBufferedInput)
+				armReceive(registration);
+		}
+	}
+
+	void UringReactor::armReceive(Registration & registration)
+	{
+		struct io_uring_sqe *entry = getEntry(*ring_);
+		if (entry == nullptr)
+			return;
+		entry->opcode = IORING_OP_RECV;
+		entry->fd = (int)registration.connection->socket_;
+		entry->ioprio = IORING_RECV_MULTISHOT;
+		entry->flags = IOSQE_BUFFER_SELECT;
+		entry->buf_group = 0;
+		entry->user_data = (unsigned long long)static_cast<Operation*>(&registration);
+		registration.isArmed = true;
+		registration.isCancelling = false;
+	}
+
+	void UringReactor::cancelReceive(Registration & registration)
+	{
+		if (registration.isCancelling)
+			return;
+
+		struct io_uring_sqe *entry = getEntry(*ring_);
+		if (entry == nullptr)
+			return;
+		entry->opcode = IORING_OP_ASYNC_CANCEL;
+		entry->addr = (unsigned long long)static_cast<Operation*>(&registration);
+		entry->user_data = kCancelUserData;
+		registration.isCancelling = true;
+	}
+
+	void UringReactor::finish(Registration & registration)
+	{
+		Connection *connection = registration.connection;
+		registrations_.erase(registration.id);
+		delete &registration;
+		connection->onReceiveStopped();
+	}
+
+	void UringReactor::onReceiveCompleted(Registration & registration, int result, unsigned int flags)
+	{
+		if (result > 0 && (flags & IORING_CQE_F_BUFFER))
+		{
+			unsigned short bufferId = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+			registration.connection->onReceived(ring_->bufferMemory + (size_t)bufferId * kBufferSize, (unsigned int)result);
+			recycleBuffer(*ring_, bufferId, kNumBuffers, kBufferSize);
+
+			// Stop taking more than the reader can keep up with
+			if (registration.isArmed && registration.connection->getBufferedInput() >= kMaxBufferedInput)
+				cancelReceive(registration);
+		}
+		else if (result == 0 || (result < 0 && result != -ECANCELED && result != -ENOBUFS))
+		{
+			// The other end closed or the socket failed
+			if (!registration.hasFailed && !registration.isRemoved)
+				registration.connection->onReceiveFailed();
+			registration.hasFailed = true;
+		}
+
+		if (flags & IORING_CQE_F_MORE)
+			return;
+
+		// The receive is over, either for good or until there is room for more
+		registration.isArmed = false;
+		registration.isCancelling = false;
+		if (registration.isRemoved)
+			finish(registration);
+		else if (!registration.hasFailed && registration.connection->getBufferedInput() < kMaxBufferedInput)
+			armReceive(registration);
+	}
+
+	void UringReactor::startSend(Connection * connection)
+	{
+		SendOperation *operation = new SendOperation();
+		operation->kind = Operation::SEND;
+		operation->connection = connection;
+		sendNext(operation);
+	}
+
+	void UringReactor::sendNext(SendOperation * operation)
+	{
+		unsigned int offset = 0;
+		unsigned int numFrames = operation->connection->takePendingFrames(operation->frames, kMaxSendVectors, offset);
+		if (numFrames == 0)
+		{
+			delete operation;
+			return;
+		}
+
+		for (unsigned int i = 0; i < numFrames; i++)
+		{
+			const std::string &frame = *operation->frames[i];
+			unsigned int skip = (i == 0) ? offset : 0;
+			operation->vectors[i].iov_base = const_cast<char*>(frame.data()) + skip;
+			operation->vectors[i].iov_len = frame.size() - skip;
+		}
+
+		memset(&operation->header, 0, sizeof operation->header);
+		operation->header.msg_iov = operation->vectors;
+		operation->header.msg_iovlen = numFrames;
+
+		struct io_uring_sqe *entry = getEntry(*ring_);
+		if (entry == nullptr)
+		{
+			onSendCompleted(operation, -EAGAIN);
+			return;
+		}
+		entry->opcode = IORING_OP_SENDMSG;
+		entry->fd = (int)operation->connection->socket_;
+		entry->addr = (unsigned long long)&operation->header;
+		entry->len = 1;
+		entry->msg_flags = MSG_NOSIGNAL;
+		entry->user_data = (unsigned long long)static_cast<Operation*>(operation);
+	}
+
+	void UringReactor::onSendCompleted(SendOperation * operation, int result)
+	{
+		operation->connection->onFramesSent(result, operation->frames[0]);
+		for (int i = 0; i < kMaxSendVectors; i++)
+			operation->frames[i].reset();
+
+		// Whatever was queued in the meantime goes out next
+		sendNext(operation);
+	}
+#endif
+}
@@ -0,0 +1,97 @@
+#pragma once
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace checkers
+{
+	class Connection;
+
+	// Receives and sends for every connection in the process on a single thread using io_uring (Linux only), in place of a receiving thread per connection and a system call per frame sent.
+	// Each connection has one multishot receive armed that keeps filling buffers taken from a ring shared by all connections. Frames queued by any connection are sent from here, so everything queued while the thread was busy goes to the kernel in one submission
+	class UringReactor
+	{
+		static const unsigned int kQueueDepth = 4096;
+		static const unsigned int kNumBuffers = 1024; // Must be a power of 2
+		static const unsigned int kBufferSize = 2048;
+		static const unsigned int kMaxBufferedInput = 16 * 1024; // Received bytes a connection may hold that its reader hasn't made room for before receiving for it pauses
+		static const int kMaxSendVectors = 16; // Most pending frames written out by one send
+
+		enum CommandType : unsigned char
+		{
+			ADD,
+			REMOVE,
+			RESUME,
+			FLUSH
+		};
+
+		struct Command
+		{
+			CommandType type;
+			Connection *connection;
+			unsigned long long id;
+		};
+
+		// Ring memory and the io_uring structures, kept out of the header
+		struct Ring;
+		struct Operation;
+		struct Registration;
+		struct SendOperation;
+
+		Ring *ring_;
+		int wakeSocket_; // Event descriptor written to wake the thread up when it has commands waiting
+		std::thread thread_;
+
+		std::mutex commandMutex_;
+		std::vector<Command> commands_;
+		std::atomic<bool> isWakePending_; // Set while a wake up is on its way, so it's only sent once however many commands are queued
+		std::atomic<unsigned long long> nextId_;
+
+		// Connections being received for, by registration id. Only touched by the thread
+		std::map<unsigned long long, Registration*> registrations_;
+
+		static UringReactor *instance_;
+
+		UringReactor();
+
+		// Sets up the ring and the buffers it receives into. Returns false if io_uring isn't available
+		bool open();
+		void runThread();
+		void pushCommand(const Command &command);
+		void handleCommand(const Command &command);
+
+		// Starts the registration's multishot receive
+		void armReceive(Registration &registration);
+		// Cancels the registration's receive, which finishes with one last completion
+		void cancelReceive(Registration &registration);
+		// Stops receiving for the connection for good, once nothing is armed
+		void finish(Registration &registration);
+		void onReceiveCompleted(Registration &registration, int result, unsigned int flags);
+		// Sends what the connection has pending, if it has anything and there isn't a send already going
+		void startSend(Connection *connection);
+		void sendNext(SendOperation *operation);
+		void onSendCompleted(SendOperation *operation, int result);
+		void armWake();
+	public:
+		// Starts the process wide reactor. Connections made from then on are received for and sent from here. Returns whether it is running, false if io_uring isn't available on this system
+		static bool start();
+		// The running reactor, nullptr if it wasn't started
+		static UringReactor * get();
+
+		// Starts receiving for a connection. Returns the id it is registered under
+		unsigned long long add(Connection *connection);
+		// Stops receiving for the registration. The connection's onReceiveStopped() is called once nothing is in flight
+		void remove(unsigned long long id);
+		// Carries on handing received frames to a connection whose reader made room for them
+		void resume(unsigned long long id);
+		// Sends what the connection has pending
+		void flush(Connection *connection);
+	};
+}
+
+#endif // URING_REACTOR_H